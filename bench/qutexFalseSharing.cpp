@@ -0,0 +1,154 @@
+/**	EXPLANATION:
+ * Measures what QutexArena's one-Qutex-per-cache-line layout buys over
+ * Qutexes packed back to back, as they were before Qutex was
+ * alignas(cacheLineSize).
+ *
+ * N threads, each pinned to its own CPU, hammer their own Qutex: there's no
+ * logical contention at all, so any slowdown of the packed layout relative
+ * to the arena is false sharing between neighbouring Qutexes. Each
+ * iteration touches the hot fields the way an acquire/release pair does:
+ * take the spinlock, flip isOwned, read the seqlock version and look at the
+ * queue. (Qutex's version is only written by its private acquire and
+ * release paths, so neither layout writes it here.)
+ *
+ * Usage: qutexFalseSharing [nThreads [nIterations]]
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <spinscale/qutexArena.h>
+
+using namespace sscl;
+
+namespace {
+
+/* The hot fields of a Qutex, in the same order, without the alignment: an
+ * array of these packs several onto each cache line.
+ */
+struct PackedQutex
+{
+	uint64_t readBegin() const
+		{ return version.load(std::memory_order_acquire); }
+
+	SpinLock lock;
+	bool isOwned = false;
+	std::atomic<uint64_t> version{0};
+	LockerAndInvokerBase::List queue;
+};
+
+static_assert(sizeof(PackedQutex) < cacheLineSize,
+	"PackedQutex no longer shares cache lines; the benchmark is moot");
+
+void pinSelfToCpu(unsigned int cpu)
+{
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+
+	int result = pthread_setaffinity_np(
+		pthread_self(), sizeof(cpu_set_t), &cpuset);
+	if (result != 0)
+	{
+		std::cerr << "Warning: Failed to pin to CPU " << cpu << ": "
+			<< std::strerror(result) << "\n";
+	}
+}
+
+template <class QutexT>
+void hammer(QutexT &qutex, uint64_t nIterations)
+{
+	for (uint64_t i = 0; i < nIterations; i++)
+	{
+		qutex.lock.acquire();
+		qutex.isOwned = true;
+		qutex.lock.release();
+		(void)qutex.readBegin();
+
+		qutex.lock.acquire();
+		qutex.isOwned = false;
+		if (!qutex.queue.empty()) { std::abort(); }
+		qutex.lock.release();
+		(void)qutex.readBegin();
+	}
+}
+
+// Runs fn(threadIndex) on nThreads pinned threads; returns ns per iteration.
+template <class FnT>
+double runPinned(
+	unsigned int nThreads, unsigned int nCpus, uint64_t nIterations, FnT fn)
+{
+	std::atomic<unsigned int> nReady(0);
+	std::atomic<bool> go(false);
+	std::vector<std::thread> threads;
+
+	for (unsigned int t = 0; t < nThreads; t++)
+	{
+		threads.emplace_back([&, t]
+		{
+			pinSelfToCpu(t % nCpus);
+			nReady.fetch_add(1);
+			while (!go.load()) { std::this_thread::yield(); }
+			fn(t);
+		});
+	}
+
+	while (nReady.load() < nThreads) { std::this_thread::yield(); }
+
+	auto start = std::chrono::steady_clock::now();
+	go.store(true);
+	for (auto &thread : threads) { thread.join(); }
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	return std::chrono::duration<double, std::nano>(elapsed).count()
+		/ static_cast<double>(nIterations);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	const unsigned int nCpus = std::max(1u, std::thread::hardware_concurrency());
+	const unsigned int nThreads = (argc > 1)
+		? static_cast<unsigned int>(std::stoul(argv[1]))
+		: std::min(nCpus, 8u);
+	const uint64_t nIterations = (argc > 2)
+		? std::stoull(argv[2]) : 10000000;
+
+	if (nThreads == 0)
+	{
+		std::cerr << "nThreads must be at least 1\n";
+		return 1;
+	}
+	if (nThreads > nCpus)
+	{
+		std::cerr << "Warning: " << nThreads << " threads on " << nCpus
+			<< " CPUs; threads will share CPUs and the numbers mean little\n";
+	}
+
+	std::unique_ptr<PackedQutex[]> packed(new PackedQutex[nThreads]);
+	QutexArena arena(nThreads, "bench");
+
+	double packedNs = runPinned(nThreads, nCpus, nIterations,
+		[&](unsigned int t) { hammer(packed[t], nIterations); });
+	double arenaNs = runPinned(nThreads, nCpus, nIterations,
+		[&](unsigned int t) { hammer(arena[t], nIterations); });
+
+	std::cout << nThreads << " threads, " << nIterations << " iterations each\n"
+		<< "  packed (" << sizeof(PackedQutex) << " bytes apart): "
+		<< packedNs << " ns/iteration\n"
+		<< "  QutexArena (" << sizeof(Qutex) << " bytes apart): "
+		<< arenaNs << " ns/iteration\n"
+		<< "  packed / arena: " << packedNs / arenaNs << "\n";
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+#ifndef ASYNC_BARRIER_H
+#define ASYNC_BARRIER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <spinscale/cacheLine.h>
+#include <spinscale/callback.h>
+#include <spinscale/componentThread.h>
+
+namespace sscl {
+
+/**
+ * @brief AsyncBarrier - Phase barrier for a fixed set of participants spread
+ *	across ComponentThreads
+ *
+ * No thread ever blocks on the barrier. A participant calls arriveReq() with
+ * a callback and then returns to its io_service; when the last participant
+ * arrives, every participant's callback is post()ed back to the thread it
+ * arrived from. So step k+1 of a phase-synchronous computation starts
+ * straight from the last arriver of step k, without a round trip through a
+ * coordinating thread.
+ *
+ * Arrival costs one atomic decrement on a shared counter. The barrier is
+ * reusable: the phase number's parity acts as the sense, selecting which of
+ * two slot arrays arrivals are recorded in. A participant can't arrive for
+ * phase k+1 before its phase k callback has been posted, and the counter is
+ * reset before any callback is posted, so the two phases never mix.
+ *
+ * With many participants the shared counter's cache line becomes a hot spot;
+ * use CombiningTreeAsyncBarrier instead.
+ */
+class AsyncBarrier
+{
+public:
+	typedef std::function<void()> barrierCbFn;
+
+	/**
+	 * @param nParticipants Number of arrivals that complete each phase.
+	 * @param phaseCompletionFn Optional. Run by the last arriver of each phase,
+	 *	on its thread, before anybody's callback is posted.
+	 */
+	AsyncBarrier(
+		unsigned int nParticipants,
+		std::function<void()> phaseCompletionFn = nullptr);
+	virtual ~AsyncBarrier() = default;
+
+	/**
+	 * @brief Arrive at the barrier for the current phase.
+	 * @param participant This participant's index, in [0, nParticipants).
+	 *	Each participant must arrive exactly once per phase.
+	 * @param callback Posted to the calling ComponentThread once every
+	 *	participant has arrived.
+	 */
+	virtual void arriveReq(
+		unsigned int participant, Callback<barrierCbFn> callback);
+
+	uint64_t getPhase(void) const
+		{ return phase.load(std::memory_order_acquire); }
+	unsigned int getNParticipants(void) const { return nParticipants; }
+
+protected:
+	struct Slot
+	{
+		std::shared_ptr<ComponentThread> thread;
+		Callback<barrierCbFn> callback;
+	};
+
+	// Returns the slot array in which arrivals for the current phase go.
+	std::vector<Slot> &recordArrival(
+		unsigned int participant, Callback<barrierCbFn> &&callback);
+	void completePhase(std::vector<Slot> &slots);
+
+protected:
+	const unsigned int nParticipants;
+	std::function<void()> phaseCompletionFn;
+	std::atomic<uint64_t> phase;
+	std::vector<Slot> slots[2];
+
+private:
+	alignas(cacheLineSize) std::atomic<unsigned int> nRemaining;
+};
+
+/**
+ * @brief CombiningTreeAsyncBarrier - AsyncBarrier whose arrivals are combined
+ *	up a tree of counters
+ *
+ * Participants are divided into groups of fanIn, each group arriving on its
+ * own counter (on its own cache line). The last arriver of each group
+ * arrives at the group's parent on behalf of the whole group, and so on up to
+ * the root, so no counter ever sees more than fanIn arrivals per phase.
+ */
+class CombiningTreeAsyncBarrier
+:	public AsyncBarrier
+{
+public:
+	CombiningTreeAsyncBarrier(
+		unsigned int nParticipants, unsigned int fanIn = 4,
+		std::function<void()> phaseCompletionFn = nullptr);
+
+	void arriveReq(
+		unsigned int participant, Callback<barrierCbFn> callback) override;
+
+private:
+	struct alignas(cacheLineSize) Node
+	{
+		std::atomic<unsigned int> nRemaining{0};
+		unsigned int nChildren = 0;
+		// Index into nodes; -1 for the root.
+		int parent = -1;
+	};
+
+private:
+	const unsigned int fanIn;
+	std::vector<Node> nodes;
+	// Index of the leaf node each participant arrives at.
+	std::vector<unsigned int> leafOf;
+};
+
+} // namespace sscl
+
+#endif // ASYNC_BARRIER_H
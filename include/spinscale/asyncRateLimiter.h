@@ -0,0 +1,171 @@
+#ifndef ASYNC_RATE_LIMITER_H
+#define ASYNC_RATE_LIMITER_H
+
+#include <boostAsioLinkageFix.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <boost/asio/steady_timer.hpp>
+#include <spinscale/componentThread.h>
+#include <spinscale/lockerAndInvokerBase.h>
+#include <spinscale/spinLock.h>
+
+namespace sscl {
+
+/**
+ * @brief AsyncRateLimiter - Token bucket that lockvokers wait on like a Qutex
+ *
+ * Add it to a continuation's LockSet with LockSet::addRateLimiter(), and the
+ * lockvoker won't run its target until it has also taken `cost` tokens from
+ * the bucket. The bucket holds at most `burst` tokens and refills at
+ * `ratePerSec`.
+ *
+ * A throttled lockvoker goes to sleep in the limiter's queue, just as it
+ * would in a Qutex's. The limiter arms a timer on its timer thread for the
+ * moment enough tokens will have accumulated, and awakens waiters then, so a
+ * throttled request costs nothing while it waits.
+ *
+ *	EXPLANATION:
+ * Tokens aren't granted in queue order: any waiter whose cost fits in the
+ * bucket may take them. A strict FIFO would let the front waiter, while it
+ * was blocked on one of its Qutexes, hold up a waiter behind it which is at
+ * the front of that same Qutex: a gridlock. Tokens taken during an attempt
+ * that then fails on a Qutex are refunded.
+ *
+ * Must be created with std::make_shared, and outlive the LockSets it's in.
+ */
+class AsyncRateLimiter
+:	public std::enable_shared_from_this<AsyncRateLimiter>
+{
+public:
+	struct Waiter
+	{
+		std::shared_ptr<LockerAndInvokerBase> lockvoker;
+		double cost;
+		// Whether its last attempt failed for lack of tokens.
+		bool isThrottled;
+	};
+	typedef std::list<Waiter> WaiterList;
+
+	struct Stats
+	{
+		uint64_t nGrants;
+		// Grants given back because the attempt failed on a Qutex.
+		uint64_t nRefunds;
+		// Attempts that failed for lack of tokens.
+		uint64_t nThrottles;
+		uint64_t nTimerWakeups;
+	};
+
+public:
+	/**
+	 * @param timerThread Thread whose io_service runs the refill timer.
+	 * @param ratePerSec Tokens added per second.
+	 * @param burst Capacity of the bucket. It starts out full.
+	 */
+	AsyncRateLimiter(
+		const std::shared_ptr<ComponentThread> &timerThread,
+		double ratePerSec, double burst);
+
+	/* Change the limits; waiters are re-evaluated against the new ones.
+	 * Rejects a burst below the cost of any queued waiter.
+	 */
+	void setLimits(double ratePerSec, double burst);
+
+	WaiterList::iterator registerInQueue(
+		const std::shared_ptr<LockerAndInvokerBase> &lockvoker, double cost);
+	void unregisterFromQueue(WaiterList::iterator it);
+
+	// Take the waiter's cost in tokens, if that many are available.
+	bool tryAcquire(WaiterList::iterator it);
+	// Give back tokens taken by an attempt that failed on something else.
+	void refund(double cost);
+
+	Stats getStats(void) const
+	{
+		return Stats{
+			nGrants.load(std::memory_order_relaxed),
+			nRefunds.load(std::memory_order_relaxed),
+			nThrottles.load(std::memory_order_relaxed),
+			nTimerWakeups.load(std::memory_order_relaxed)
+		};
+	}
+
+private:
+	// All called with `lock` held.
+	void refill(std::chrono::steady_clock::time_point now);
+	void armTimerFor(double cost);
+
+	void armTimerReq1_posted(std::chrono::steady_clock::time_point deadline);
+	void timerReq1_expired(void);
+
+private:
+	std::shared_ptr<ComponentThread> timerThread;
+
+	SpinLock lock;
+	// All guarded by lock.
+	double ratePerSec, burst, tokens;
+	std::chrono::steady_clock::time_point lastRefill;
+	WaiterList waiters;
+	bool timerIsArmed;
+
+	// Only touched on timerThread.
+	boost::asio::steady_timer timer;
+
+	std::atomic<uint64_t> nGrants, nRefunds, nThrottles, nTimerWakeups;
+};
+
+/**
+ * @brief KeyedRateLimiters - One AsyncRateLimiter per key, e.g: per tenant
+ *	or per downstream dependency
+ *
+ * Limiters are created on first use with the default limits, unless limits
+ * were set for their key beforehand. They're never destroyed before the
+ * KeyedRateLimiters is, since LockSets may still refer to them.
+ */
+template <class KeyT, class HashT = std::hash<KeyT>>
+class KeyedRateLimiters
+{
+public:
+	KeyedRateLimiters(
+		const std::shared_ptr<ComponentThread> &timerThread,
+		double defaultRatePerSec, double defaultBurst)
+	:	timerThread(timerThread),
+	defaultRatePerSec(defaultRatePerSec), defaultBurst(defaultBurst)
+	{}
+
+	AsyncRateLimiter &get(const KeyT &key)
+	{
+		mapLock.acquire();
+
+		auto it = limiters.find(key);
+		if (it == limiters.end())
+		{
+			it = limiters.emplace(key, std::make_shared<AsyncRateLimiter>(
+				timerThread, defaultRatePerSec, defaultBurst)).first;
+		}
+
+		AsyncRateLimiter &limiter = *it->second;
+		mapLock.release();
+		return limiter;
+	}
+
+	void setLimits(const KeyT &key, double ratePerSec, double burst)
+		{ get(key).setLimits(ratePerSec, burst); }
+
+private:
+	std::shared_ptr<ComponentThread> timerThread;
+	const double defaultRatePerSec, defaultBurst;
+
+	SpinLock mapLock;
+	// Guarded by mapLock.
+	std::unordered_map<KeyT, std::shared_ptr<AsyncRateLimiter>, HashT>
+		limiters;
+};
+
+} // namespace sscl
+
+#endif // ASYNC_RATE_LIMITER_H
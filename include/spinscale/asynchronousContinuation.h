@@ -4,9 +4,12 @@
 #include <functional>
 #include <memory>
 #include <exception>
+#include <system_error>
 #include <spinscale/componentThread.h>
 #include <spinscale/callback.h>
+#include <spinscale/callbackDelivery.h>
 #include <spinscale/callableTracer.h>
+#include <spinscale/expected.h>
 #include <spinscale/asynchronousContinuationChainLink.h>
 
 
@@ -65,11 +68,51 @@ public:
 			return; \
 		} while(0)
 
+	/**	EXPLANATION:
+	 * The allocation-free alternative to CALLEE_SETEXC. Prefer these for
+	 * errors that can occur in bulk (timeouts, cancellations, exhaustion),
+	 * where making and rethrowing an exception_ptr for every failed request
+	 * would become a bottleneck of its own.
+	 *
+	 * Callers that use getError() never throw. Callers that use
+	 * checkException() get a std::system_error, so callees can switch to
+	 * error codes without breaking exception-based callers.
+	 */
+	#define CALLEE_SETERR(continuation, err) \
+		(continuation)->error = std::error_code(err)
+
+	#define CALLEE_SETERR_CALLCB(continuation, err) \
+		do { \
+			CALLEE_SETERR(continuation, err); \
+			(continuation)->callOriginalCb(); \
+		} while(0)
+
+	#define CALLEE_SETERR_CALLCB_RET(continuation, err) \
+		do { \
+			CALLEE_SETERR_CALLCB(continuation, err); \
+			return; \
+		} while(0)
+
 	// Call this in the caller to rethrow the exception.
 	void checkException()
 	{
 		if (exception)
 			{ std::rethrow_exception(exception); }
+		if (error)
+			{ throw std::system_error(error); }
+	}
+
+	/**
+	 * @brief Call this in the caller to check for errors without throwing.
+	 *
+	 * A stored exception is converted with errorCodeFromException(), which
+	 * is slow, but only exception-based callees pay for it.
+	 */
+	std::error_code getError() const
+	{
+		if (error) { return error; }
+		if (exception) { return errorCodeFromException(exception); }
+		return std::error_code();
 	}
 
 	// Implement the virtual method from AsynchronousContinuationChainLink
@@ -80,6 +123,7 @@ public:
 public:
 	Callback<OriginalCbFnT> originalCallback;
 	std::exception_ptr exception;
+	std::error_code error;
 };
 
 /**
@@ -135,18 +179,19 @@ public:
 	caller(caller)
 	{}
 
+	/**
+	 * @brief Complete the request: run the original callback on the thread
+	 *	its delivery policy calls for (by default, post it to caller).
+	 *
+	 * See deliverCallback().
+	 */
 	template<typename... Args>
 	void callOriginalCb(Args&&... args)
 	{
-		if (AsynchronousContinuation<OriginalCbFnT>::originalCallback
-			.callbackFn)
-		{
-			caller->getIoService().post(
-				STC(std::bind(
-					AsynchronousContinuation<OriginalCbFnT>::originalCallback
-						.callbackFn,
-					std::forward<Args>(args)...)));
-		}
+		deliverCallback(
+			caller,
+			AsynchronousContinuation<OriginalCbFnT>::originalCallback,
+			std::forward<Args>(args)...);
 	}
 
 public:
@@ -5,6 +5,9 @@
 
 namespace sscl {
 
+class Qutex;
+class LockerAndInvokerBase;
+
 /**
  * @brief Base class for all asynchronous continuation chain links
  *
@@ -25,6 +28,28 @@ public:
 
 	virtual std::shared_ptr<AsynchronousContinuationChainLink>
 	getCallersContinuationShPtr() const = 0;
+
+	/**
+	 * @brief Whether this continuation currently holds qutex.
+	 *
+	 * Callees whose LockSets need a Qutex that a continuation up their chain
+	 * holds inherit it rather than queueing for it; see LockSet.
+	 */
+	virtual bool holdsQutex(const Qutex &) const { return false; }
+
+	/**
+	 * @brief Lend a Qutex this continuation holds to one callee at a time.
+	 * @param waiter If the Qutex is already lent out, awaken()ed when it's
+	 *	returned; may be nullptr.
+	 * @return false if it's already lent out, or not held.
+	 *
+	 * The borrower must hand it back with returnLentQutex() when it stops
+	 * using it.
+	 */
+	virtual bool tryLendQutex(
+		const Qutex &, const std::shared_ptr<LockerAndInvokerBase> &)
+		{ return false; }
+	virtual void returnLentQutex(const Qutex &) {}
 };
 
 } // namespace sscl
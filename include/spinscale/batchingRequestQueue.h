@@ -0,0 +1,237 @@
+#ifndef BATCHING_REQUEST_QUEUE_H
+#define BATCHING_REQUEST_QUEUE_H
+
+#include <boostAsioLinkageFix.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/asio/steady_timer.hpp>
+#include <spinscale/callback.h>
+#include <spinscale/callbackDelivery.h>
+#include <spinscale/callableTracer.h>
+#include <spinscale/componentThread.h>
+#include <spinscale/log2Histogram.h>
+#include <spinscale/swapMailbox.h>
+
+namespace sscl {
+
+/**
+ * @brief BatchedRequest - Convenience request type for BatchingRequestQueue
+ *
+ * Carries a request's argument along with everything needed to complete it
+ * individually from within a batch handler.
+ */
+template <class ArgT, class CbFnT>
+struct BatchedRequest
+{
+	ArgT arg;
+	std::shared_ptr<ComponentThread> caller;
+	Callback<CbFnT> callback;
+
+	// Deliver this request's callback to its caller; see deliverCallback().
+	template <class... Args>
+	void complete(Args&&... args)
+		{ deliverCallback(caller, callback, std::forward<Args>(args)...); }
+};
+
+/**
+ * @brief BatchingRequestQueue - Opt-in batched delivery of requests to a
+ *	Component's thread
+ *
+ * Requests submitted from any thread accumulate in the queue, and are handed
+ * to the batch handler together, as a span, on the component's thread. The
+ * handler is then free to amortize per-request work (e.g: apply 64 updates
+ * with one index traversal) and completes each request individually, e.g:
+ * via BatchedRequest::complete().
+ *
+ * Only one flush is posted for however many requests arrive before the
+ * component thread gets to it, so under load batches grow by themselves,
+ * and when idle, each request is delivered as soon as the thread runs.
+ *
+ * Caps:
+ *	* maxBatchSize bounds how many requests the handler sees at once; larger
+ *	  backlogs are split.
+ *	* maxLinger, if non-zero, lets a flush that finds a small batch wait up
+ *	  to that long (measured from the batch's first request) for more
+ *	  requests to arrive. Reaching maxBatchSize ends the wait early.
+ */
+template <class RequestT>
+class BatchingRequestQueue
+:	public std::enable_shared_from_this<BatchingRequestQueue<RequestT>>
+{
+public:
+	typedef std::function<void(std::span<RequestT> batch)> batchHandlerFn;
+
+	struct Stats
+	{
+		uint64_t nRequests;
+		uint64_t nBatches;
+		// Flushes that waited out maxLinger rather than filling a batch.
+		uint64_t nLingerExpiries;
+		Log2Histogram::Snapshot batchSizes;
+	};
+
+public:
+	BatchingRequestQueue(
+		const std::shared_ptr<ComponentThread> &thread,
+		batchHandlerFn batchHandler,
+		size_t maxBatchSize = 64,
+		std::chrono::microseconds maxLinger = std::chrono::microseconds(0))
+	:	thread(thread), batchHandler(std::move(batchHandler)),
+	maxBatchSize(maxBatchSize), maxLinger(maxLinger),
+	lingerTimer(thread->getIoService()), lingerTimerIsArmed(false),
+	lingerTimerGeneration(0),
+	nRequests(0), nBatches(0), nLingerExpiries(0)
+	{
+		if (maxBatchSize == 0)
+		{
+			throw std::invalid_argument(std::string(__func__)
+				+ ": maxBatchSize must be non-zero");
+		}
+	}
+
+	// May be called from any thread.
+	void submit(RequestT request)
+	{
+		/**	EXPLANATION:
+		 * Normally only the first request of a batch posts a flush. But if
+		 * the flush is going to linger, the request that fills the batch
+		 * posts another one so the batch doesn't wait for the timer.
+		 */
+		const bool mustPostFlush = mailbox.emplaceAndCheck(
+			[this](size_t nPending)
+			{
+				if (nPending == 1) {
+					firstPendingAt = std::chrono::steady_clock::now();
+				}
+
+				return maxLinger.count() > 0 && nPending == maxBatchSize;
+			},
+			std::move(request));
+
+		nRequests.fetch_add(1, std::memory_order_relaxed);
+
+		if (!mustPostFlush) { return; }
+
+		thread->post(
+			STC(std::bind(
+				&BatchingRequestQueue::flushReq1_posted,
+				this->shared_from_this(), false)));
+	}
+
+	Stats getStats(void) const
+	{
+		return Stats{
+			nRequests.load(std::memory_order_relaxed),
+			nBatches.load(std::memory_order_relaxed),
+			nLingerExpiries.load(std::memory_order_relaxed),
+			batchSizes.snapshot()
+		};
+	}
+
+private:
+	void flushReq1_posted(bool lingerExpired)
+	{
+		if (lingerExpired)
+		{
+			lingerTimerIsArmed = false;
+			nLingerExpiries.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		size_t nPending;
+		std::chrono::steady_clock::time_point deadline;
+		mailbox.inspect(
+			[&](const std::vector<RequestT> &pending)
+			{
+				nPending = pending.size();
+				deadline = firstPendingAt + maxLinger;
+			});
+
+		if (nPending == 0) { return; }
+
+		if (!lingerExpired && maxLinger.count() > 0
+			&& nPending < maxBatchSize
+			&& std::chrono::steady_clock::now() < deadline)
+		{
+			armLingerTimer(deadline);
+			return;
+		}
+
+		std::vector<RequestT> &draining = mailbox.takeAllAndGoIdle();
+
+		if (lingerTimerIsArmed)
+		{
+			lingerTimer.cancel();
+			lingerTimerIsArmed = false;
+			lingerTimerGeneration++;
+		}
+
+		std::span<RequestT> all(draining);
+		for (size_t offset = 0; offset < all.size(); offset += maxBatchSize)
+		{
+			std::span<RequestT> batch = all.subspan(
+				offset, std::min(maxBatchSize, all.size() - offset));
+
+			nBatches.fetch_add(1, std::memory_order_relaxed);
+			batchSizes.record(batch.size());
+			batchHandler(batch);
+		}
+
+		draining.clear();
+	}
+
+	void armLingerTimer(std::chrono::steady_clock::time_point deadline)
+	{
+		if (lingerTimerIsArmed) { return; }
+
+		/**	EXPLANATION:
+		 * cancel() can't recall a completion that has already been queued
+		 * with a success code, so a flush that cancels us bumps the
+		 * generation, and a completion from an older generation is ignored.
+		 * Otherwise it would count a spurious expiry and flush the next
+		 * batch before its linger is up.
+		 */
+		lingerTimerIsArmed = true;
+		lingerTimer.expires_at(deadline);
+		lingerTimer.async_wait(
+			[self = this->shared_from_this(),
+				generation = lingerTimerGeneration](
+				const boost::system::error_code &ec)
+			{
+				if (ec == boost::asio::error::operation_aborted
+					|| generation != self->lingerTimerGeneration)
+					{ return; }
+
+				self->flushReq1_posted(true);
+			});
+	}
+
+private:
+	std::shared_ptr<ComponentThread> thread;
+	batchHandlerFn batchHandler;
+	const size_t maxBatchSize;
+	const std::chrono::microseconds maxLinger;
+
+	SwapMailbox<RequestT> mailbox;
+	// Guarded by the mailbox's lock.
+	std::chrono::steady_clock::time_point firstPendingAt;
+
+	// Only touched on the component thread.
+	boost::asio::steady_timer lingerTimer;
+	bool lingerTimerIsArmed;
+	uint64_t lingerTimerGeneration;
+
+	std::atomic<uint64_t> nRequests, nBatches, nLingerExpiries;
+	Log2Histogram batchSizes;
+};
+
+} // namespace sscl
+
+#endif // BATCHING_REQUEST_QUEUE_H
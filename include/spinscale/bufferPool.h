@@ -0,0 +1,253 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include <spinscale/componentThread.h>
+#include <spinscale/spinLock.h>
+
+namespace sscl {
+
+/**
+ * @brief BufferPool - Fixed-size, ref-counted buffers for cross-thread payloads
+ *
+ * All buffers are carved out of a single slab which is allocated up front.
+ * Buffers are handed around by Buffer and Slice handles, which are cheap to
+ * copy into post()ed closures and Callback results: copying a handle bumps a
+ * ref-count and never copies the payload.
+ *
+ * Each ComponentThread which allocates from the pool gets its own cache of
+ * free buffers, so allocation and freeing on the same thread are lock-free.
+ * A buffer that's freed on a thread other than the one which allocated it is
+ * pushed onto the allocating thread's remote-return stack, and is reclaimed
+ * the next time that thread's cache runs dry. This keeps buffers from
+ * migrating between threads' caches and keeps the allocating thread's cache
+ * lines local to it.
+ *
+ * Threads which aren't ComponentThreads allocate from and free to the shared
+ * free list directly.
+ *
+ * N.B: Remotely returned buffers are only reclaimed when their home thread
+ * allocates again, so a thread which stops allocating keeps whatever was
+ * returned to it.
+ *
+ * The pool must outlive every handle to its buffers.
+ */
+class BufferPool
+{
+private:
+	static constexpr uint32_t invalidIndex = UINT32_MAX;
+	// ThreadId is a uint8_t.
+	static constexpr size_t maxThreadCaches = 256;
+
+	struct BufferDesc
+	{
+		std::atomic<uint32_t> refCount{0};
+		// The cache to return this buffer to; maxThreadCaches means "shared".
+		uint16_t homeCache = maxThreadCaches;
+		BufferDesc *nextRemoteReturn = nullptr;
+	};
+
+public:
+	class Slice;
+
+	/**
+	 * @brief Buffer - Owning handle to a whole pool buffer
+	 *
+	 * An empty (default constructed) Buffer evaluates to false, and has no
+	 * data, a size of 0 and a use count of 0.
+	 */
+	class Buffer
+	{
+	public:
+		Buffer(void) : pool(nullptr), index(invalidIndex) {}
+		Buffer(const Buffer &other)
+		: pool(other.pool), index(other.index)
+			{ if (pool != nullptr) { pool->ref(index); } }
+		Buffer(Buffer &&other) noexcept
+		: pool(other.pool), index(other.index)
+			{ other.pool = nullptr; other.index = invalidIndex; }
+		~Buffer() { reset(); }
+
+		Buffer &operator=(Buffer other) noexcept
+		{
+			std::swap(pool, other.pool);
+			std::swap(index, other.index);
+			return *this;
+		}
+
+		explicit operator bool() const { return pool != nullptr; }
+
+		void reset(void)
+		{
+			if (pool == nullptr) { return; }
+
+			pool->unref(index);
+			pool = nullptr;
+			index = invalidIndex;
+		}
+
+		uint8_t *data(void) const
+			{ return (pool == nullptr) ? nullptr : pool->dataOf(index); }
+		size_t size(void) const
+			{ return (pool == nullptr) ? 0 : pool->bufferSize; }
+		uint32_t useCount(void) const
+		{
+			if (pool == nullptr) { return 0; }
+
+			return pool->descs[index].refCount.load(
+				std::memory_order_relaxed);
+		}
+
+		Slice slice(size_t offset, size_t length) const;
+
+	private:
+		friend class BufferPool;
+		Buffer(BufferPool *pool, uint32_t index)
+		: pool(pool), index(index)
+		{}
+
+		BufferPool *pool;
+		uint32_t index;
+	};
+
+	/**
+	 * @brief Slice - A byte range within a Buffer which keeps it alive
+	 */
+	class Slice
+	{
+	public:
+		Slice(void) : offset(0), length(0) {}
+		Slice(Buffer buffer, size_t offset, size_t length)
+		: buffer(std::move(buffer)), offset(offset), length(length)
+		{
+			// Written so that offset + length can't wrap around.
+			const size_t bufferSize = this->buffer.size();
+			if (offset > bufferSize || length > bufferSize - offset)
+			{
+				throw std::out_of_range(std::string(__func__)
+					+ ": Slice exceeds the bounds of its buffer");
+			}
+		}
+
+		explicit operator bool() const { return static_cast<bool>(buffer); }
+
+		uint8_t *data(void) const { return buffer.data() + offset; }
+		size_t size(void) const { return length; }
+		const Buffer &getBuffer(void) const { return buffer; }
+		size_t getOffset(void) const { return offset; }
+
+		Slice subSlice(size_t subOffset, size_t subLength) const
+		{
+			if (subOffset > length || subLength > length - subOffset)
+			{
+				throw std::out_of_range(std::string(__func__)
+					+ ": Sub-slice exceeds the bounds of its slice");
+			}
+
+			return Slice(buffer, offset + subOffset, subLength);
+		}
+
+	private:
+		Buffer buffer;
+		size_t offset, length;
+	};
+
+	struct Stats
+	{
+		uint64_t nAllocations;
+		// Allocations satisfied from the calling thread's own cache.
+		uint64_t nLocalCacheHits;
+		// Buffers freed on a thread other than the one that allocated them.
+		uint64_t nRemoteFrees;
+		// Times a thread's cache had to be refilled from the shared list.
+		uint64_t nSharedRefills;
+		// Allocations that failed because the pool was empty.
+		uint64_t nExhaustions;
+		uint64_t nBuffersInUse;
+		uint64_t nBuffersTotal;
+	};
+
+public:
+	/**
+	 * @param bufferSize Size of each buffer; rounded up to a cache line.
+	 * @param nBuffers Total number of buffers in the pool.
+	 * @param threadCacheSize How many free buffers each thread may hoard
+	 *	before it returns the surplus to the shared list.
+	 */
+	BufferPool(size_t bufferSize, size_t nBuffers, size_t threadCacheSize = 32);
+	~BufferPool();
+
+	BufferPool(const BufferPool &) = delete;
+	BufferPool &operator=(const BufferPool &) = delete;
+
+	// Returns an empty Buffer if the pool is exhausted.
+	Buffer allocate(void);
+
+	Stats getStats(void) const;
+
+	size_t getBufferSize(void) const { return bufferSize; }
+
+	/* The whole slab as a single iovec, e.g. for registering the pool with
+	 * IoUringComponent::registerBuffers(). The buffer index of every pool
+	 * buffer within such a registration is 0.
+	 */
+	struct iovec getSlabIovec(void) const
+		{ return {slab, nBuffers * stride}; }
+
+private:
+	struct ThreadCache
+	{
+		// Only touched by the owning thread.
+		std::vector<uint32_t> freeIndices;
+		// Pushed to by other threads; drained by the owning thread.
+		std::atomic<BufferDesc *> remoteReturns{nullptr};
+	};
+
+	uint8_t *dataOf(uint32_t index) const { return slab + index * stride; }
+	uint32_t indexOf(const BufferDesc &desc) const
+		{ return static_cast<uint32_t>(&desc - descs.get()); }
+
+	void ref(uint32_t index)
+		{ descs[index].refCount.fetch_add(1, std::memory_order_relaxed); }
+	void unref(uint32_t index)
+	{
+		if (descs[index].refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{ free(index); }
+	}
+
+	ThreadCache &getOrCreateThreadCache(ThreadId id);
+	bool refillThreadCache(ThreadCache &cache);
+	void free(uint32_t index);
+
+private:
+	const size_t bufferSize, stride, nBuffers, threadCacheSize;
+	uint8_t *slab;
+	std::unique_ptr<BufferDesc[]> descs;
+
+	SpinLock sharedFreeListLock;
+	std::vector<uint32_t> sharedFreeList;
+
+	std::array<std::atomic<ThreadCache *>, maxThreadCaches> threadCaches;
+
+	std::atomic<uint64_t> nAllocations, nLocalCacheHits, nRemoteFrees,
+		nSharedRefills, nExhaustions, nBuffersInUse;
+};
+
+inline BufferPool::Slice BufferPool::Buffer::slice(
+	size_t offset, size_t length
+	) const
+{
+	return Slice(*this, offset, length);
+}
+
+} // namespace sscl
+
+#endif // BUFFER_POOL_H
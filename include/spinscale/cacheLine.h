@@ -0,0 +1,21 @@
+#ifndef CACHE_LINE_H
+#define CACHE_LINE_H
+
+#include <cstddef>
+
+namespace sscl {
+
+/**	EXPLANATION:
+ * We don't use std::hardware_destructive_interference_size: GCC warns that
+ * its value may differ between translation units built with different
+ * -mtune flags, which is exactly what must not happen for a type's layout.
+ * 64 bytes is right for every x86-64 and most aarch64 parts we run on.
+ */
+constexpr size_t cacheLineSize = 64;
+
+constexpr size_t roundUpToCacheLine(size_t n)
+	{ return (n + cacheLineSize - 1) & ~(cacheLineSize - 1); }
+
+} // namespace sscl
+
+#endif // CACHE_LINE_H
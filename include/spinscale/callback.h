@@ -8,6 +8,24 @@ namespace sscl {
 // Forward declaration
 class AsynchronousContinuationChainLink;
 
+/**
+ * @brief Where a callee runs its caller's callback when it completes
+ *
+ * POST_TO_CALLER: post it to the caller's thread. Always safe.
+ * INLINE: run it immediately on whichever thread completes the request. For
+ *	callbacks that touch no thread-affine state.
+ * INLINE_IF_SAME_THREAD: run it immediately if the request completes on the
+ *	caller's own thread, and post it there otherwise.
+ *
+ * See deliverCallback().
+ */
+enum class CallbackDelivery
+{
+	POST_TO_CALLER,
+	INLINE,
+	INLINE_IF_SAME_THREAD
+};
+
 /**
  * @brief Callback class that wraps a function and its caller continuation
  * 
@@ -16,6 +34,7 @@ class AsynchronousContinuationChainLink;
  * by walking the chain of continuations.
  *
  * Usage: Callback<CbFnT>{context, std::bind(...)}
+ * or: Callback<CbFnT>{context, std::bind(...), CallbackDelivery::INLINE}
  */
 template<typename CbFnT>
 class Callback
@@ -24,6 +43,7 @@ public:
 	// Aggregate initialization allows: Callback<CbFnT>{context, std::bind(...)}
 	std::shared_ptr<AsynchronousContinuationChainLink> callerContinuation;
 	CbFnT callbackFn;
+	CallbackDelivery delivery = CallbackDelivery::POST_TO_CALLER;
 };
 
 } // namespace sscl
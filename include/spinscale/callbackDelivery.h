@@ -0,0 +1,80 @@
+#ifndef SPINSCALE_CALLBACK_DELIVERY_H
+#define SPINSCALE_CALLBACK_DELIVERY_H
+
+#include <config.h>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <spinscale/callback.h>
+#include <spinscale/callableTracer.h>
+#include <spinscale/componentThread.h>
+
+namespace sscl {
+
+/**
+ * @brief Run callback with args, on the thread its delivery policy calls for
+ *
+ * Used by callees to complete requests: caller is the thread that made the
+ * request. Empty callbacks are ignored.
+ *
+ *	EXPLANATION:
+ * Running the callback inline saves a trip through the caller's io_service
+ * per completion, which adds up over a deep chain of callees. The price is
+ * that it runs on the callee's stack: it must not assume it's on the caller's
+ * thread (INLINE), and it runs while the callee is still inside its own
+ * handler, so the callee shouldn't complete requests while holding a
+ * SpinLock.
+ *
+ * With CONFIG_ENABLE_DEBUG_LOCKS, callbacks that are posted check that they
+ * actually run on the caller's thread, so code that relies on the
+ * POST_TO_CALLER guarantee finds out if it's ever broken, e.g: by an
+ * io_service being run from some other thread.
+ */
+template <class CbFnT, class... Args>
+void deliverCallback(
+	const std::shared_ptr<ComponentThread> &caller,
+	const Callback<CbFnT> &callback, Args&&... args
+	)
+{
+	if (!callback.callbackFn) { return; }
+
+	const bool runInline =
+		callback.delivery == CallbackDelivery::INLINE
+		|| (callback.delivery == CallbackDelivery::INLINE_IF_SAME_THREAD
+			&& ComponentThread::getSelfPtr() == caller.get());
+
+	if (runInline)
+	{
+		callback.callbackFn(std::forward<Args>(args)...);
+		return;
+	}
+
+#ifdef CONFIG_ENABLE_DEBUG_LOCKS
+	auto boundFn = std::bind(callback.callbackFn, std::forward<Args>(args)...);
+	auto affinityCheckedFn = [caller, boundFn]() mutable
+	{
+		if (ComponentThread::getSelfPtr() != caller.get())
+		{
+			throw std::runtime_error(std::string("deliverCallback")
+				+ ": Thread affinity violation: callback posted to its "
+				"caller ran on another thread");
+		}
+
+		boundFn();
+	};
+
+	caller->post(
+		STC(std::move(affinityCheckedFn)),
+		callback.callerContinuation.get());
+#else
+	caller->post(
+		STC(std::bind(callback.callbackFn, std::forward<Args>(args)...)),
+		callback.callerContinuation.get());
+#endif
+}
+
+} // namespace sscl
+
+#endif // SPINSCALE_CALLBACK_DELIVERY_H
@@ -0,0 +1,178 @@
+#ifndef COHORT_SCHEDULER_H
+#define COHORT_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <source_location>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <spinscale/componentThread.h>
+#include <spinscale/log2Histogram.h>
+#include <spinscale/spinLock.h>
+
+namespace sscl {
+
+/**
+ * @brief CohortScheduler - Opt-in front end to a ComponentThread which runs
+ *	handlers from the same callsite back to back
+ *
+ * A ComponentThread's io_service runs handlers strictly in post order, so
+ * under load unrelated handler types interleave and keep evicting each
+ * other's code from the i-cache and branch predictors. Handlers post()ed
+ * through a CohortScheduler instead are grouped into cohorts by callsite,
+ * and once enough are pending, the scheduler runs a whole cohort at a time.
+ *
+ *	EXPLANATION:
+ * The cohort whose oldest handler is the oldest pending one always runs
+ * next, so no handler is overtaken by more than maxBatchSize handlers from
+ * any one cohort; and a drain gives the thread back to the io_service at the
+ * end of the first batch that finishes past maxDrainDuration. Handlers within
+ * a cohort keep their post order.
+ *
+ * Handlers posted with isOrderDependent are never reordered against
+ * anything: every handler posted before one runs before it, and every one
+ * posted after runs after it.
+ *
+ * Must be created with std::make_shared.
+ */
+class CohortScheduler
+:	public std::enable_shared_from_this<CohortScheduler>
+{
+public:
+	struct Options
+	{
+		// Below this many pending handlers, run in plain post order.
+		size_t minDepthForCohorting = 8;
+		size_t maxBatchSize = 32;
+		std::chrono::microseconds maxDrainDuration{500};
+	};
+
+	struct CohortStats
+	{
+		const char *file;
+		const char *function;
+		uint_least32_t line;
+		uint64_t nHandlers;
+		// Handlers per batch: the locality gained.
+		Log2Histogram::Snapshot batchSizes;
+	};
+
+	struct Stats
+	{
+		uint64_t nDrains;
+		uint64_t nOrderDependentHandlers;
+		std::vector<CohortStats> cohorts;
+	};
+
+public:
+	CohortScheduler(
+		const std::shared_ptr<ComponentThread> &thread, Options options);
+
+	explicit CohortScheduler(const std::shared_ptr<ComponentThread> &thread)
+	:	CohortScheduler(thread, Options())
+	{}
+
+	/**
+	 * @brief Queue handler to run on the thread.
+	 * @param isOrderDependent Run it in strict post order relative to every
+	 *	other handler posted here.
+	 */
+	template <class HandlerT>
+	void post(
+		HandlerT &&handler, bool isOrderDependent = false,
+		const std::source_location &callsite = std::source_location::current())
+	{
+		enqueue(
+			std::function<void()>(std::forward<HandlerT>(handler)),
+			isOrderDependent, callsite);
+	}
+
+	Stats getStats(void);
+
+private:
+	struct CallsiteKey
+	{
+		const char *file;
+		uint_least32_t line, column;
+
+		bool operator==(const CallsiteKey &) const = default;
+	};
+
+	struct CallsiteKeyHash
+	{
+		size_t operator()(const CallsiteKey &key) const
+		{
+			return std::hash<const char *>()(key.file)
+				^ (static_cast<size_t>(key.line) << 16) ^ key.column;
+		}
+	};
+
+	struct Item
+	{
+		uint64_t seqNo;
+		std::function<void()> handler;
+	};
+
+	struct CohortStatsEntry
+	{
+		std::source_location callsite;
+		std::atomic<uint64_t> nHandlers{0};
+		Log2Histogram batchSizes;
+	};
+
+	struct Cohort
+	{
+		CohortStatsEntry *stats = nullptr;
+		std::deque<Item> items;
+	};
+
+	/**	EXPLANATION:
+	 * The handlers between two order-dependent ones. Only the front segment
+	 * is ever drained, and the last segment never has a barrier.
+	 */
+	struct Segment
+	{
+		std::unordered_map<CallsiteKey, Cohort, CallsiteKeyHash> cohorts;
+		bool hasBarrier = false;
+		std::function<void()> barrier;
+	};
+
+	void enqueue(
+		std::function<void()> handler, bool isOrderDependent,
+		const std::source_location &callsite);
+
+	// Called with lock held.
+	CohortStatsEntry *getCohortStatsEntry(
+		const CallsiteKey &key, const std::source_location &callsite);
+
+	void drainReq1_posted(void);
+	void postDrain(void);
+	// Put the batch's handlers from nRun on back at the front of its cohort.
+	void requeueUnrun(
+		const CallsiteKey &key, std::vector<Item> &batch, size_t nRun);
+
+private:
+	std::shared_ptr<ComponentThread> thread;
+	const Options options;
+
+	SpinLock lock;
+	// All guarded by lock.
+	std::deque<Segment> segments;
+	size_t nPending;
+	uint64_t nextSeqNo;
+	bool drainIsPosted;
+	std::unordered_map<
+		CallsiteKey, std::unique_ptr<CohortStatsEntry>, CallsiteKeyHash>
+		cohortStats;
+
+	std::atomic<uint64_t> nDrains, nOrderDependentHandlers;
+};
+
+} // namespace sscl
+
+#endif // COHORT_SCHEDULER_H
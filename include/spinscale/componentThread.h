@@ -1,8 +1,11 @@
 #ifndef COMPONENT_THREAD_H
 #define COMPONENT_THREAD_H
 
+#include <config.h>
 #include <boostAsioLinkageFix.h>
 #include <atomic>
+#include <chrono>
+#include <source_location>
 #include <thread>
 #include <unordered_map>
 #include <boost/asio/io_service.hpp>
@@ -14,8 +17,14 @@
 #include <unistd.h>
 #include <memory>
 #include <spinscale/callback.h>
+#include <spinscale/spinLock.h>
+#include <spinscale/asynchronousContinuationChainLink.h>
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+#include <spinscale/recordReplay.h>
+#endif
 #include <cstdint>
 #include <string>
+#include <vector>
 
 namespace sscl {
 
@@ -43,7 +52,28 @@ public:
 
 	boost::asio::io_service& getIoService(void) { return io_service; }
 
+	/**
+	 * @brief Post a handler to this thread's io_service
+	 * @param handler The handler to post
+	 * @param continuation The continuation which the handler advances, if any.
+	 *	Only used to enrich diagnostics (e.g: HandlerWatchdog stall reports).
+	 * @param callsite Where the post originated; defaults to the caller.
+	 *
+	 * Prefer this over getIoService().post(): it's the hook through which
+	 * per-handler instrumentation is applied. When no instrumentation is
+	 * configured it compiles down to a plain io_service::post().
+	 */
+	template <class HandlerT>
+	void post(
+		HandlerT &&handler,
+		AsynchronousContinuationChainLink *continuation = nullptr,
+		const std::source_location &callsite = std::source_location::current());
+
 	static const std::shared_ptr<ComponentThread> getSelf(void);
+	/* Doesn't copy the sh_ptr, for use on hot paths which only need to know
+	 * which thread they're on. Returns nullptr if TLS isn't initialized.
+	 */
+	static ComponentThread *getSelfPtr(void);
 	static bool tlsInitialized(void);
 	static std::shared_ptr<MarionetteThread> getMrntt();
 
@@ -58,14 +88,212 @@ public:
 	// Intentionally doesn't take a callback.
 	void userShutdownInd();
 
+#ifdef CONFIG_ENABLE_HANDLER_WATCHDOG
+	/**
+	 * @brief Heartbeat - Progress indicator for the handlers run by a thread
+	 *
+	 * Written only by the owning thread as it enters and leaves handlers that
+	 * were post()ed through ComponentThread::post(); sampled from other
+	 * threads by the HandlerWatchdog.
+	 *
+	 * Nested handlers (e.g: those run by an AsynchronousBridge's inner loop)
+	 * bump seqNo, but the outer* fields continue to describe the outermost
+	 * handler, because that's the one which is holding up the thread's queue.
+	 */
+	struct Heartbeat
+	{
+		std::atomic<uint64_t> seqNo{0};
+		std::atomic<uint64_t> outerSeqNo{0};
+		// Zero when the thread isn't executing a tracked handler.
+		std::atomic<int64_t> outerStartNs{0};
+		std::atomic<const char *> outerCallsiteFn{nullptr};
+		std::atomic<uint_least32_t> outerCallsiteLine{0};
+		// Only ever touched by the owning thread.
+		unsigned int depth = 0;
+
+		SpinLock outerContinuationLock;
+		std::weak_ptr<AsynchronousContinuationChainLink> outerContinuation;
+
+		static int64_t nowNs(void)
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		void handlerBegin(
+			const std::source_location &callsite,
+			const std::weak_ptr<AsynchronousContinuationChainLink> &contin)
+		{
+			uint64_t seq = seqNo.fetch_add(1, std::memory_order_relaxed) + 1;
+			if (depth++ > 0) { return; }
+
+			outerContinuationLock.acquire();
+			outerContinuation = contin;
+			outerContinuationLock.release();
+
+			outerCallsiteFn.store(
+				callsite.function_name(), std::memory_order_relaxed);
+			outerCallsiteLine.store(callsite.line(), std::memory_order_relaxed);
+			outerSeqNo.store(seq, std::memory_order_relaxed);
+			outerStartNs.store(nowNs(), std::memory_order_release);
+		}
+
+		void handlerEnd(void)
+		{
+			if (--depth > 0) { return; }
+
+			outerStartNs.store(0, std::memory_order_release);
+
+			outerContinuationLock.acquire();
+			outerContinuation.reset();
+			outerContinuationLock.release();
+		}
+	};
+#endif
+
+	/**
+	 * @brief TrackedHandler - Wraps handlers post()ed via ComponentThread::post()
+	 *
+	 * Holds the handler by value (no type erasure) along with whatever
+	 * per-handler instrumentation state is compiled in.
+	 */
+	template <class HandlerT>
+	class TrackedHandler
+	{
+	public:
+		TrackedHandler(
+			ComponentThread &thread, HandlerT handler,
+			[[maybe_unused]] AsynchronousContinuationChainLink *continuation,
+			[[maybe_unused]] const std::source_location &callsite)
+		:	thread(&thread),
+#ifdef CONFIG_ENABLE_HANDLER_WATCHDOG
+		callsite(callsite),
+		continuation(continuation != nullptr
+			? continuation->weak_from_this()
+			: std::weak_ptr<AsynchronousContinuationChainLink>()),
+#endif
+		handler(std::move(handler))
+		{}
+
+		void operator()()
+		{
+#ifdef CONFIG_QUTEX_IDLE_AWARE_WAKEUP
+			struct PendingScope
+			{
+				explicit PendingScope(ComponentThread &t) : t(t) {}
+				~PendingScope()
+				{
+					t.nPendingHandlers.fetch_sub(
+						1, std::memory_order_relaxed);
+				}
+
+				ComponentThread &t;
+			} pendingScope(*thread);
+#endif
+#ifdef CONFIG_ENABLE_HANDLER_WATCHDOG
+			struct HeartbeatScope
+			{
+				HeartbeatScope(Heartbeat &hb, const TrackedHandler &th)
+				: hb(hb)
+					{ hb.handlerBegin(th.callsite, th.continuation); }
+				~HeartbeatScope() { hb.handlerEnd(); }
+
+				Heartbeat &hb;
+			} heartbeatScope(thread->heartbeat, *this);
+#endif
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+			RecordReplay::HandlerScope recordReplayScope(
+				*thread, recordReplayId, recordReplayIsOrdered);
+#endif
+
+			handler();
+		}
+
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+		RecordReplay::EventId recordReplayId = 0;
+		bool recordReplayIsOrdered = true;
+#endif
+
+	private:
+		[[maybe_unused]] ComponentThread *thread;
+#ifdef CONFIG_ENABLE_HANDLER_WATCHDOG
+		std::source_location callsite;
+		std::weak_ptr<AsynchronousContinuationChainLink> continuation;
+#endif
+		HandlerT handler;
+	};
+
 public:
 	ThreadId id;
 	std::string name;
 	boost::asio::io_service io_service;
 	boost::asio::io_service::work work;
 	std::atomic<bool> keepLooping;
+#ifdef CONFIG_ENABLE_HANDLER_WATCHDOG
+	Heartbeat heartbeat;
+#endif
+#ifdef CONFIG_QUTEX_IDLE_AWARE_WAKEUP
+	/**	EXPLANATION:
+	 * Handlers post()ed through ComponentThread::post() which haven't
+	 * finished running yet, including the one that's running now. Handlers
+	 * posted directly to the io_service (timers, raw I/O completions) aren't
+	 * counted, so this is a lower bound on the thread's backlog. It's only
+	 * used as a hint by Qutex wakeup selection.
+	 */
+	std::atomic<uint32_t> nPendingHandlers{0};
+
+	bool isIdleOrNearlyIdle(void) const
+		{ return nPendingHandlers.load(std::memory_order_relaxed) <= 1; }
+#endif
 };
 
+template <class HandlerT>
+void ComponentThread::post(
+	HandlerT &&handler,
+	[[maybe_unused]] AsynchronousContinuationChainLink *continuation,
+	[[maybe_unused]] const std::source_location &callsite
+	)
+{
+#if defined(CONFIG_ENABLE_HANDLER_WATCHDOG) \
+	|| defined(CONFIG_QUTEX_IDLE_AWARE_WAKEUP) \
+	|| defined(CONFIG_ENABLE_RECORD_REPLAY)
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+	/**	EXPLANATION:
+	 * Lockvokers carry their continuation's id. Their (re)posts depend on
+	 * timing, so they're not ordered, and the lockvoker runs under the
+	 * continuation's id.
+	 */
+	constexpr bool isLockvoker = requires (const std::decay_t<HandlerT> &h)
+		{ h.getRecordReplayId(); };
+	RecordReplay::EventId lockvokerRecordReplayId = 0;
+	if constexpr (isLockvoker)
+		{ lockvokerRecordReplayId = handler.getRecordReplayId(); }
+#endif
+	TrackedHandler<std::decay_t<HandlerT>> tracked(
+		*this, std::forward<HandlerT>(handler), continuation, callsite);
+#ifdef CONFIG_QUTEX_IDLE_AWARE_WAKEUP
+	nPendingHandlers.fetch_add(1, std::memory_order_relaxed);
+#endif
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+	RecordReplay::PostScope recordReplayScope(*this, !isLockvoker);
+	tracked.recordReplayId = isLockvoker
+		? lockvokerRecordReplayId : recordReplayScope.getPostId();
+	tracked.recordReplayIsOrdered = !isLockvoker;
+
+	if (recordReplayScope.mustDefer())
+	{
+		auto held = std::make_shared<decltype(tracked)>(std::move(tracked));
+		recordReplayScope.defer([this, held]()
+			{ io_service.post([held]() { (*held)(); }); });
+		return;
+	}
+#endif
+	io_service.post(std::move(tracked));
+#else
+	io_service.post(std::forward<HandlerT>(handler));
+#endif
+}
+
 class MarionetteThread
 :	public std::enable_shared_from_this<MarionetteThread>,
 	public ComponentThread
@@ -137,6 +365,46 @@ public:
 	// CPU management methods
 	void pinToCpu(int cpuId);
 
+	/**
+	 * @brief RealtimeConfig - Scheduling and memory settings for a thread
+	 *
+	 * Some of these settings (timer slack, stack prefaulting) can only be
+	 * applied by a thread to itself, so the whole config is applied by the
+	 * thread when it handles startThreadReq(). Anything that the kernel
+	 * refuses is recorded rather than thrown, and can be retrieved with
+	 * getRealtimeRefusals() once the START request has completed.
+	 */
+	struct RealtimeConfig
+	{
+		enum class Policy
+		{
+			// Leave the scheduling policy as inherited from the creator.
+			INHERIT,
+			FIFO,
+			RR,
+			DEADLINE
+		};
+
+		Policy policy = Policy::INHERIT;
+		// Static priority for FIFO and RR.
+		int priority = 0;
+		// Reservation parameters for DEADLINE.
+		std::chrono::nanoseconds deadlineRuntime{0};
+		std::chrono::nanoseconds deadlineDeadline{0};
+		std::chrono::nanoseconds deadlinePeriod{0};
+		// 0 leaves the kernel's default timer slack in place.
+		unsigned long timerSlackNs = 0;
+		// Number of bytes of this thread's stack to touch ahead of time.
+		size_t prefaultStackBytes = 0;
+	};
+
+	// Must be called before startThreadReq().
+	void setRealtimeConfig(const RealtimeConfig &config)
+		{ realtimeConfig = config; }
+
+	const std::vector<std::string> &getRealtimeRefusals(void) const
+		{ return realtimeRefusals; }
+
 protected:
 	/**
 	 * Handle exception - called from main() when an exception occurs.
@@ -144,8 +412,13 @@ protected:
 	 */
 	virtual void handleException() {}
 
+	// Must execute on this thread. Fills in realtimeRefusals.
+	void applyRealtimeConfig(void);
+
 public:
 	int pinnedCpuId;
+	RealtimeConfig realtimeConfig;
+	std::vector<std::string> realtimeRefusals;
 	boost::asio::io_service pause_io_service;
 	boost::asio::io_service::work pause_work;
 	std::thread thread;
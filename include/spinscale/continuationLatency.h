@@ -0,0 +1,138 @@
+#ifndef CONTINUATION_LATENCY_H
+#define CONTINUATION_LATENCY_H
+
+#include <config.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <spinscale/log2Histogram.h>
+#include <spinscale/spinLock.h>
+
+namespace sscl {
+
+/**
+ * @brief ContinuationLatency - Where one SerializedAsynchronousContinuation's
+ *	time went
+ *
+ * Filled in by its lockvokers: every post to the target's io_service, every
+ * wakeup (acquisition attempt), and the final acquisition; then handed to
+ * ContinuationLatencyRegistry when the LockSet is released.
+ *
+ *	EXPLANATION:
+ * Only one copy of a lockvoker is ever awake at a time (see awakeState), and
+ * each post happens-before the wakeup it causes, so none of this needs to be
+ * atomic.
+ */
+class ContinuationLatency
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	void notePosted(void)
+	{
+		lastPostedAt = Clock::now();
+		if (!hasBeenPosted)
+		{
+			firstPostedAt = lastPostedAt;
+			hasBeenPosted = true;
+		}
+	}
+
+	void noteWokenUp(void)
+	{
+		if (!hasBeenPosted) { return; }
+
+		queueNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+			Clock::now() - lastPostedAt).count();
+	}
+
+	void noteFailedAttempt(void) { nFailedAttempts++; }
+
+	// Only the first acquisition counts: extensions don't restart hold time.
+	void noteAcquired(void)
+	{
+		if (hasAcquired) { return; }
+
+		acquiredAt = Clock::now();
+		hasAcquired = true;
+	}
+
+	bool hasBeenAcquired(void) const { return hasAcquired; }
+
+	// Time spent waiting for an io_service to run our lockvokers.
+	uint64_t getQueueNs(void) const { return queueNs; }
+	// Time spent asleep in Qutex (and rate limiter) queues.
+	uint64_t getLockWaitNs(void) const;
+	// Time from acquisition until releasedAt.
+	uint64_t getHoldNs(Clock::time_point releasedAt) const;
+	uint64_t getNFailedAttempts(void) const { return nFailedAttempts; }
+
+public:
+	const Clock::time_point createdAt = Clock::now();
+
+private:
+	Clock::time_point firstPostedAt, lastPostedAt, acquiredAt;
+	uint64_t queueNs = 0, nFailedAttempts = 0;
+	bool hasBeenPosted = false, hasAcquired = false;
+};
+
+/**
+ * @brief ContinuationLatencyRegistry - Latency histograms per continuation
+ *	type
+ *
+ * A continuation's type is its most derived class, e.g: the request struct a
+ * Component derives from SerializedAsynchronousContinuation. For each one,
+ * this tells which lever to pull: a large queueNs means its target threads
+ * are saturated, a large lockWaitNs means contention, a large holdNs means
+ * the critical section (including any async I/O done under the LockSet) is
+ * too long, and many failed attempts mean wasted wakeups.
+ *
+ * Only built with ENABLE_CONTINUATION_LATENCY_STATS.
+ */
+class ContinuationLatencyRegistry
+{
+public:
+	// All in nanoseconds, bar nFailedAttempts.
+	struct Histograms
+	{
+		Log2Histogram queueNs, lockWaitNs, holdNs, nFailedAttempts;
+	};
+
+	struct Entry
+	{
+		std::string typeName;
+		Histograms histograms;
+	};
+
+public:
+	static ContinuationLatencyRegistry &getInstance()
+	{
+		static ContinuationLatencyRegistry instance;
+		return instance;
+	}
+
+	// Entries are never removed, so the reference stays valid.
+	Entry &getEntry(std::type_index type);
+
+	void record(
+		std::type_index type, const ContinuationLatency &latency,
+		ContinuationLatency::Clock::time_point releasedAt);
+
+	// Visit every type seen so far. fn mustn't call back into the registry.
+	void forEach(const std::function<void(const Entry &)> &fn);
+
+private:
+	ContinuationLatencyRegistry(void) = default;
+
+	SpinLock lock;
+	// Guarded by lock.
+	std::unordered_map<std::type_index, std::unique_ptr<Entry>> entries;
+};
+
+} // namespace sscl
+
+#endif // CONTINUATION_LATENCY_H
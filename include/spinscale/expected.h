@@ -0,0 +1,149 @@
+#ifndef SPINSCALE_EXPECTED_H
+#define SPINSCALE_EXPECTED_H
+
+#include <exception>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace sscl {
+
+/**
+ * @brief Error codes raised by spinscale itself
+ *
+ * Callees are free to return any std::error_code; these just cover the
+ * conditions that the library's own components report.
+ */
+enum class Errc
+{
+	// 0 is reserved for "no error", as std::error_code requires.
+	TIMED_OUT = 1,
+	CANCELLED,
+	SHUTTING_DOWN,
+	RESOURCE_EXHAUSTED,
+	// An exception was converted to an error code and its details were lost.
+	EXCEPTION_THROWN
+};
+
+} // namespace sscl
+
+namespace std {
+template <>
+struct is_error_code_enum<sscl::Errc> : true_type {};
+} // namespace std
+
+namespace sscl {
+
+const std::error_category &spinscaleCategory(void) noexcept;
+
+inline std::error_code make_error_code(Errc e) noexcept
+	{ return std::error_code(static_cast<int>(e), spinscaleCategory()); }
+
+/**
+ * @brief Convert a stored exception into an error code
+ *
+ * std::system_error keeps its code; anything else becomes
+ * Errc::EXCEPTION_THROWN. This rethrows internally, so it's only meant for
+ * the boundary between exception-based and Expected-based code, not for hot
+ * paths.
+ */
+std::error_code errorCodeFromException(const std::exception_ptr &exc) noexcept;
+
+/**
+ * @brief Unexpected - Tag wrapper used to construct an Expected in its error
+ *	state
+ *
+ * Usage: return Unexpected(Errc::TIMED_OUT);
+ */
+class Unexpected
+{
+public:
+	explicit Unexpected(std::error_code error) : error(error) {}
+	template <class ErrcT,
+		class = std::enable_if_t<std::is_error_code_enum_v<ErrcT>>>
+	explicit Unexpected(ErrcT e) : error(make_error_code(e)) {}
+
+	std::error_code error;
+};
+
+/**
+ * @brief Expected - Either a value or a std::error_code
+ *
+ * This is the result type for callees that report errors without allocating
+ * or throwing: pass it as the argument of a Callback's callbackFn, e.g.
+ * Callback<std::function<void(Expected<size_t>)>>. Constructing and checking
+ * an error costs no more than returning an int.
+ *
+ * value() throws std::system_error when there's no value, so Expected-based
+ * results can be handed to exception-based code unchanged.
+ */
+template <class T>
+class Expected
+{
+public:
+	Expected(const T &value) : storage(std::in_place_index<0>, value) {}
+	Expected(T &&value) : storage(std::in_place_index<0>, std::move(value)) {}
+	Expected(Unexpected unexpected)
+	: storage(std::in_place_index<1>, unexpected.error)
+	{}
+
+	bool hasValue(void) const noexcept { return storage.index() == 0; }
+	explicit operator bool() const noexcept { return hasValue(); }
+
+	std::error_code error(void) const noexcept
+		{ return hasValue() ? std::error_code() : std::get<1>(storage); }
+
+	T &value(void) &
+		{ throwIfError(); return std::get<0>(storage); }
+	const T &value(void) const &
+		{ throwIfError(); return std::get<0>(storage); }
+	T &&value(void) &&
+		{ throwIfError(); return std::get<0>(std::move(storage)); }
+
+	template <class U>
+	T valueOr(U &&fallback) const &
+	{
+		return hasValue()
+			? std::get<0>(storage) : static_cast<T>(std::forward<U>(fallback));
+	}
+
+	// Unchecked access; only valid when hasValue().
+	T &operator*() & noexcept { return *std::get_if<0>(&storage); }
+	const T &operator*() const & noexcept { return *std::get_if<0>(&storage); }
+	T *operator->() noexcept { return std::get_if<0>(&storage); }
+	const T *operator->() const noexcept { return std::get_if<0>(&storage); }
+
+	void throwIfError(void) const
+	{
+		if (!hasValue()) { throw std::system_error(std::get<1>(storage)); }
+	}
+
+private:
+	std::variant<T, std::error_code> storage;
+};
+
+template <>
+class Expected<void>
+{
+public:
+	Expected(void) {}
+	Expected(Unexpected unexpected) : err(unexpected.error) {}
+
+	bool hasValue(void) const noexcept { return !err; }
+	explicit operator bool() const noexcept { return hasValue(); }
+
+	std::error_code error(void) const noexcept { return err; }
+
+	void value(void) const { throwIfError(); }
+
+	void throwIfError(void) const
+		{ if (err) { throw std::system_error(err); } }
+
+private:
+	std::error_code err;
+};
+
+} // namespace sscl
+
+#endif // SPINSCALE_EXPECTED_H
@@ -0,0 +1,117 @@
+#ifndef HANDLER_WATCHDOG_H
+#define HANDLER_WATCHDOG_H
+
+#include <config.h>
+#include <boostAsioLinkageFix.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio/steady_timer.hpp>
+#include <spinscale/component.h>
+#include <spinscale/componentThread.h>
+#include <spinscale/spinLock.h>
+
+#ifndef CONFIG_ENABLE_HANDLER_WATCHDOG
+#error "handlerWatchdog.h requires the library to be built with ENABLE_HANDLER_WATCHDOG"
+#endif
+
+namespace sscl {
+
+/**
+ * @brief HandlerWatchdog - Detects ComponentThreads stuck in a slow handler
+ *
+ * Periodically samples the Heartbeat of each watched ComponentThread from
+ * its own host thread (usually the marionette thread). Whenever the outermost
+ * handler on a watched thread has been running for longer than the handler
+ * SLO, the watchdog counts a stall and emits a StallReport describing the
+ * handler's callsite and the continuation chain it was advancing.
+ *
+ * Each handler is reported at most once, no matter how long it stalls.
+ *
+ * Only handlers post()ed via ComponentThread::post() are tracked.
+ */
+class HandlerWatchdog
+:	public std::enable_shared_from_this<HandlerWatchdog>,
+	public Component
+{
+public:
+	struct StallReport
+	{
+		std::shared_ptr<ComponentThread> thread;
+		uint64_t handlerSeqNo;
+		std::chrono::nanoseconds elapsed;
+		const char *callsiteFn;
+		uint_least32_t callsiteLine;
+		// Demangled type names of the continuation chain, innermost first.
+		std::vector<std::string> continuationChain;
+	};
+
+	typedef std::function<void(const StallReport &report)> stallHandlerFn;
+
+public:
+	/**
+	 * @param host The thread on which sampling is done.
+	 * @param handlerSlo How long a single handler may run before it's
+	 *	considered stalled.
+	 * @param samplePeriod How often to sample the watched threads.
+	 */
+	HandlerWatchdog(
+		const std::shared_ptr<ComponentThread> &host,
+		std::chrono::milliseconds handlerSlo,
+		std::chrono::milliseconds samplePeriod);
+	~HandlerWatchdog() = default;
+
+	void watch(const std::shared_ptr<ComponentThread> &thread);
+
+	/* Must be called before start(). If no stall handler is set, stalls are
+	 * printed to std::cerr. The handler is invoked on the host thread.
+	 */
+	void setStallHandler(stallHandlerFn handler);
+
+	// Both of these may be called from any thread.
+	void start(void);
+	void stop(void);
+
+	uint64_t getStallCount(ThreadId threadId) const;
+	uint64_t getTotalStallCount(void) const
+		{ return nTotalStalls.load(std::memory_order_relaxed); }
+
+	static std::string formatStallReport(const StallReport &report);
+
+private:
+	struct WatchedThread
+	{
+		explicit WatchedThread(const std::shared_ptr<ComponentThread> &thread)
+		: thread(thread), lastReportedSeqNo(0), nStalls(0)
+		{}
+
+		std::shared_ptr<ComponentThread> thread;
+		// Only touched on the host thread.
+		uint64_t lastReportedSeqNo;
+		std::atomic<uint64_t> nStalls;
+	};
+
+	void armTimer(void);
+	void sample(void);
+	bool sampleThread(WatchedThread &watched, int64_t nowNs);
+	static std::vector<std::string> captureContinuationChain(
+		const std::shared_ptr<AsynchronousContinuationChainLink> &innermost);
+
+private:
+	const std::chrono::milliseconds handlerSlo, samplePeriod;
+	boost::asio::steady_timer timer;
+	bool isRunning;
+	stallHandlerFn stallHandler;
+
+	mutable SpinLock watchedThreadsLock;
+	std::vector<std::unique_ptr<WatchedThread>> watchedThreads;
+	std::atomic<uint64_t> nTotalStalls;
+};
+
+} // namespace sscl
+
+#endif // HANDLER_WATCHDOG_H
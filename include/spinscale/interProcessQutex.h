@@ -0,0 +1,103 @@
+#ifndef INTER_PROCESS_QUTEX_H
+#define INTER_PROCESS_QUTEX_H
+
+#include <config.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <sys/types.h>
+#include <spinscale/cacheLine.h>
+#include <spinscale/componentThread.h>
+#include <spinscale/sharedMemory.h>
+
+namespace sscl {
+
+/**
+ * @brief InterProcessQutex - A lock that lives in shared memory and can be
+ *	held by threads of different processes
+ *
+ * This is the cross-process counterpart of Qutex. A Qutex's waiter queue
+ * holds shared_ptrs to lockvokers, which can't be shared between address
+ * spaces, so an InterProcessQutex has no queue: it's a single futex word,
+ * which holds the owner's pid so that a dead owner can be detected.
+ *
+ * ComponentThreads acquire it asynchronously with acquireReq(), which never
+ * blocks the thread: while the lock is held elsewhere, the request retries
+ * from a timer on the thread's io_service with exponential backoff. Threads
+ * that are free to block (e.g: helper threads) can use acquire(), which
+ * sleeps on the futex and is woken directly by release().
+ *
+ * Construct it in a SharedMemorySegment, e.g:
+ *	segment.construct<InterProcessQutex>();
+ * or as a member of a larger struct that lives there.
+ */
+class alignas(cacheLineSize) InterProcessQutex
+{
+public:
+	InterProcessQutex()
+	:	word(FREE)
+	{}
+
+	InterProcessQutex(const InterProcessQutex &) = delete;
+	InterProcessQutex &operator=(const InterProcessQutex &) = delete;
+
+	bool tryAcquire(void);
+	// Blocks the calling thread; don't call this from a ComponentThread.
+	void acquire(void);
+	void release(void);
+
+	/**
+	 * @brief Acquire the lock asynchronously, then run onAcquired on thread
+	 *	with the lock held. onAcquired is responsible for calling release().
+	 * @param maxBackoff Upper bound on the retry interval while the lock is
+	 *	contended.
+	 */
+	void acquireReq(
+		const std::shared_ptr<ComponentThread> &thread,
+		std::function<void()> onAcquired,
+		std::chrono::microseconds maxBackoff = std::chrono::microseconds(500));
+
+	// pid of the process that holds the lock, or 0 if it's free.
+	pid_t getOwnerPid(void) const
+		{ return word.load(std::memory_order_relaxed) & ~WAITERS_BIT; }
+
+	/**	EXPLANATION:
+	 * A process that dies while holding the lock leaves it held forever.
+	 * This releases it if (and only if) its owner no longer exists. Whatever
+	 * the lock guarded may be half-updated, so callers must be able to
+	 * repair or discard it.
+	 *
+	 * The owner's pid is written by the same CAS that takes the lock, so
+	 * there's no window in which a dying owner goes unrecorded; and the
+	 * reclaim is a CAS from the exact word naming the dead owner, so it can
+	 * never free a lock that someone else has since taken. The one residual
+	 * race is pid reuse: if the dead owner's pid is recycled by a process
+	 * that then takes this lock between our liveness check and our CAS, we
+	 * free its lock. That needs a full pid wraparound inside a few
+	 * instructions.
+	 * @return true if the lock was reclaimed.
+	 */
+	bool releaseIfOwnerDied(void);
+
+private:
+	/* The word is FREE, or the owner's pid, optionally with WAITERS_BIT set
+	 * (as for the kernel's PI futexes). The releaser only makes the wake
+	 * syscall when someone may be sleeping on the word. Linux pids never
+	 * exceed 2^22, so they can't collide with the bit.
+	 */
+	static constexpr uint32_t FREE = 0;
+	static constexpr uint32_t WAITERS_BIT = 0x80000000u;
+
+	struct AcquireOp;
+
+private:
+	std::atomic<uint32_t> word;
+
+	static_assert(sizeof(pid_t) <= sizeof(uint32_t));
+};
+
+} // namespace sscl
+
+#endif // INTER_PROCESS_QUTEX_H
@@ -0,0 +1,148 @@
+#ifndef IO_URING_COMPONENT_H
+#define IO_URING_COMPONENT_H
+
+#include <config.h>
+#include <boostAsioLinkageFix.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <sys/uio.h>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <spinscale/bufferPool.h>
+#include <spinscale/callback.h>
+#include <spinscale/component.h>
+#include <spinscale/componentThread.h>
+
+#ifndef CONFIG_ENABLE_IO_URING
+#error "ioUringComponent.h requires the library to be built with ENABLE_IO_URING"
+#endif
+
+namespace sscl {
+
+/**
+ * @brief IoUringComponent - Asynchronous file I/O driven by an io_uring ring
+ *
+ * The ring is owned and driven by this component's thread. Requests may be
+ * issued from any ComponentThread; they're forwarded to the component thread,
+ * which places them in the submission queue. All requests that arrive before
+ * the component thread gets around to flushing are submitted together with a
+ * single io_uring_enter().
+ *
+ * Completions are signalled through an eventfd that's watched by the
+ * component thread's io_service, and each completion is post()ed back to the
+ * requesting thread, as with any other PostedAsynchronousContinuation.
+ *
+ * Busy-polling threads that drive this component's io_service by polling
+ * may also call reapCompletions() directly to skip the eventfd round trip.
+ */
+class IoUringComponent
+:	public std::enable_shared_from_this<IoUringComponent>,
+	public Component
+{
+public:
+	/**
+	 * @param thread The thread which drives the ring.
+	 * @param nEntries Submission queue depth; rounded up by the kernel to a
+	 *	power of 2.
+	 */
+	IoUringComponent(
+		const std::shared_ptr<ComponentThread> &thread, unsigned nEntries);
+	~IoUringComponent();
+
+	/**	EXPLANATION:
+	 * The result is what the kernel put in the CQE: the number of bytes
+	 * transferred, or -errno.
+	 */
+	typedef std::function<void(int result)> ioOpCbFn;
+
+	void readReq(
+		int fd, void *buf, size_t len, uint64_t offset,
+		Callback<ioOpCbFn> callback);
+	void writeReq(
+		int fd, const void *buf, size_t len, uint64_t offset,
+		Callback<ioOpCbFn> callback);
+	void fsyncReq(int fd, bool dataOnly, Callback<ioOpCbFn> callback);
+
+	/* As above, but the I/O is done into/out of a BufferPool Slice, which is
+	 * kept alive until the request completes. The caller need not hold on to
+	 * its own handle.
+	 */
+	void readReq(
+		int fd, const BufferPool::Slice &slice, uint64_t offset,
+		Callback<ioOpCbFn> callback);
+	void writeReq(
+		int fd, const BufferPool::Slice &slice, uint64_t offset,
+		Callback<ioOpCbFn> callback);
+
+	/**
+	 * Registered files and buffers save the kernel from looking up the fd and
+	 * pinning the user pages on every request. The fixed variants below take
+	 * an index into the registered file table, and buf must lie within the
+	 * registered buffer at bufIndex.
+	 *
+	 * Registration must be done before any requests are issued. These throw
+	 * on failure.
+	 */
+	void registerFiles(const std::vector<int> &fds);
+	void registerBuffers(const std::vector<struct iovec> &buffers);
+
+	void readFixedReq(
+		unsigned fileIndex, unsigned bufIndex,
+		void *buf, size_t len, uint64_t offset,
+		Callback<ioOpCbFn> callback);
+	void writeFixedReq(
+		unsigned fileIndex, unsigned bufIndex,
+		const void *buf, size_t len, uint64_t offset,
+		Callback<ioOpCbFn> callback);
+
+	/**
+	 * Must be called once, after the component has been make_shared()d, to
+	 * start watching for completions.
+	 */
+	void start(void);
+
+	/**
+	 * Dispatch all available completions. Must be called on the component
+	 * thread.
+	 * @return The number of completions dispatched.
+	 */
+	unsigned reapCompletions(void);
+
+	uint64_t getNSubmitted(void) const
+		{ return nSubmitted.load(std::memory_order_relaxed); }
+	uint64_t getNSubmitCalls(void) const
+		{ return nSubmitCalls.load(std::memory_order_relaxed); }
+	uint64_t getNCompleted(void) const
+		{ return nCompleted.load(std::memory_order_relaxed); }
+
+private:
+	class IoOp;
+	struct Ring;
+
+	void submitReq(const std::shared_ptr<IoOp> &op);
+	void submitReq1_posted(std::shared_ptr<IoOp> op);
+	void flushSubmissions(void);
+	void armCompletionWatch(void);
+
+private:
+	std::unique_ptr<Ring> ring;
+	int eventFd;
+	boost::asio::posix::stream_descriptor eventFdDescriptor;
+	uint64_t eventFdReadBuf;
+
+	/* Only touched on the component thread. Ops wait here when the SQ is
+	 * full, and are moved into the SQ as completions free up space.
+	 */
+	std::vector<std::shared_ptr<IoOp>> backlog;
+	unsigned nQueuedSqes;
+	unsigned nInFlight;
+	bool flushIsScheduled;
+
+	std::atomic<uint64_t> nSubmitted, nSubmitCalls, nCompleted;
+};
+
+} // namespace sscl
+
+#endif // IO_URING_COMPONENT_H
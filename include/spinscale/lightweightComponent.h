@@ -0,0 +1,130 @@
+#ifndef LIGHTWEIGHT_COMPONENT_H
+#define LIGHTWEIGHT_COMPONENT_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <spinscale/componentThread.h>
+#include <spinscale/swapMailbox.h>
+
+namespace sscl {
+
+class LightweightComponentScheduler;
+
+// Unlike ThreadId, this isn't limited to 256 values.
+typedef uint32_t LightweightComponentId;
+
+/**
+ * @brief LightweightComponent - A mailbox with serial execution, hosted on a
+ *	shared ComponentThread
+ *
+ * Many LightweightComponents are multiplexed onto each of a fixed set of
+ * ComponentThreads by a LightweightComponentScheduler. Each one has its own
+ * mailbox; messages posted to a LightweightComponent are executed one at a
+ * time, in post order, on its home thread. So state that's only touched by
+ * a LightweightComponent's messages needs no locking.
+ *
+ * A LightweightComponent is only present in its home thread's io_service
+ * queue while its mailbox is non-empty. When it's scheduled, it runs at most
+ * `quantum` messages before it re-posts itself to the back of its home
+ * thread's queue. That way a busy LightweightComponent can't starve the
+ * others on its thread.
+ *
+ * A LightweightComponent costs an object of roughly a hundred bytes plus its
+ * queued messages, instead of an OS thread and an io_service.
+ */
+class LightweightComponent
+:	public std::enable_shared_from_this<LightweightComponent>
+{
+public:
+	explicit LightweightComponent(LightweightComponentScheduler &scheduler);
+	virtual ~LightweightComponent() = default;
+
+	typedef std::function<void()> messageFn;
+
+	// May be called from any thread.
+	void post(messageFn message);
+
+	/**
+	 * @brief Wrap a callable so that invoking it posts it into this
+	 *	component's mailbox.
+	 *
+	 * Use this for the callbackFn of a Callback passed to a ComponentThread
+	 * request, so that the completion runs serially with this component's
+	 * other messages rather than just on its home thread.
+	 */
+	template <class CallableT>
+	auto viaMailbox(CallableT callable)
+	{
+		return [self = shared_from_this(), callable = std::move(callable)](
+			auto &&...args)
+		{
+			self->post(std::bind(
+				callable, std::forward<decltype(args)>(args)...));
+		};
+	}
+
+	const std::shared_ptr<ComponentThread> &getHomeThread(void) const
+		{ return homeThread; }
+
+public:
+	const LightweightComponentId id;
+
+private:
+	void runQuantum(void);
+	// Re-post runQuantum() if there's more to do, else go idle.
+	void rescheduleOrIdle(void);
+
+private:
+	std::shared_ptr<ComponentThread> homeThread;
+	const unsigned int quantum;
+
+	SwapMailbox<messageFn> mailbox;
+
+	// Only touched on the home thread. Index into mailbox.getDraining().
+	size_t drainPos;
+};
+
+/**
+ * @brief LightweightComponentScheduler - Assigns LightweightComponents to a
+ *	fixed set of ComponentThreads
+ *
+ * Components are spread across the threads round-robin, in order of
+ * creation.
+ */
+class LightweightComponentScheduler
+{
+public:
+	/**
+	 * @param threads The threads to multiplex components onto.
+	 * @param quantum Max number of messages a component may run each time
+	 *	it's scheduled.
+	 */
+	LightweightComponentScheduler(
+		const std::vector<std::shared_ptr<ComponentThread>> &threads,
+		unsigned int quantum = 16);
+
+	unsigned int getQuantum(void) const { return quantum; }
+	uint64_t getNComponentsCreated(void) const
+		{ return nextId.load(std::memory_order_relaxed); }
+
+private:
+	friend class LightweightComponent;
+
+	LightweightComponentId allocateId(void)
+		{ return nextId.fetch_add(1, std::memory_order_relaxed); }
+	const std::shared_ptr<ComponentThread> &getThreadFor(
+		LightweightComponentId id) const
+		{ return threads[id % threads.size()]; }
+
+private:
+	std::vector<std::shared_ptr<ComponentThread>> threads;
+	const unsigned int quantum;
+	std::atomic<LightweightComponentId> nextId;
+};
+
+} // namespace sscl
+
+#endif // LIGHTWEIGHT_COMPONENT_H
@@ -2,12 +2,17 @@
 #define LOCK_SET_H
 
 #include <vector>
+#include <algorithm>
+#include <functional>
 #include <stdexcept>
 #include <utility>
 #include <memory>
 #include <optional>
 #include <spinscale/qutex.h>
+#include <spinscale/lockSetSignature.h>
 #include <spinscale/lockerAndInvokerBase.h>
+#include <spinscale/asynchronousContinuationChainLink.h>
+#include <spinscale/asyncRateLimiter.h>
 
 namespace sscl {
 
@@ -33,14 +38,55 @@ public:
 		std::reference_wrapper<Qutex> qutex;
 		typename LockerAndInvokerBase::List::iterator iterator;
 		bool hasBeenReleased = false;
+		/* Borrowed from `lender`, a continuation up our caller chain, and so
+		 * treated as granted: never acquired or released by us, only handed
+		 * back.
+		 */
+		bool isInherited = false;
+		/* Held up our caller chain when we registered; so each acquisition
+		 * attempt tries to borrow it, and queues for it in case it's lent
+		 * to another callee.
+		 */
+		bool mayBorrow = false;
+		// Still to be acquired by the current (or next) acquisition attempt.
+		bool needsAcquisition = true;
+		// Whether `iterator` currently refers to an entry in the Qutex's queue.
+		bool isQueued = false;
+		/* While this LockSet's hold on the Qutex is lent to a callee, and
+		 * the other callees waiting for it back. Both are touched from the
+		 * callees' threads, so they're guarded by the Qutex's spinlock.
+		 */
+		bool isLent = false;
+		std::vector<std::shared_ptr<LockerAndInvokerBase>> loanWaiters;
+		std::shared_ptr<AsynchronousContinuationChainLink> lender;
 
 		LockUsageDesc(std::reference_wrapper<Qutex> qutexRef,
 			typename LockerAndInvokerBase::List::iterator iter)
-			: qutex(qutexRef), iterator(iter), hasBeenReleased(false) {}
+			: qutex(qutexRef), iterator(iter), hasBeenReleased(false),
+			isInherited(false), mayBorrow(false), needsAcquisition(true),
+			isQueued(false), isLent(false) {}
+	};
+
+	// An AsyncRateLimiter that must also grant tokens before the target runs.
+	struct LimiterUsageDesc
+	{
+		std::reference_wrapper<AsyncRateLimiter> limiter;
+		double cost;
+		AsyncRateLimiter::WaiterList::iterator iterator;
 	};
 
 	typedef std::vector<std::reference_wrapper<Qutex>> Set;
 
+	enum class ExtendResult
+	{
+		// Every extra Qutex was already held; nothing to acquire.
+		ALREADY_HELD,
+		// The held Qutexes are kept; only the extra ones are to be acquired.
+		EXTENDING,
+		// Everything was released; the whole LockSet is to be reacquired.
+		RESTARTING
+	};
+
 public:
 	/**
 	 * @brief Constructor
@@ -52,7 +98,8 @@ public:
 		SerializedAsynchronousContinuation<OriginalCbFnT> &parentContinuation,
 		std::vector<std::reference_wrapper<Qutex>> qutexes = {})
 	: parentContinuation(parentContinuation), allLocksAcquired(false),
-	registeredInQutexQueues(false)
+	registeredInQutexQueues(false), isExtending(false),
+	limitersAreQueued(false), limitersArePaid(false), nRequiredLocks(0)
 	{
 		/* Convert Qutex references to LockUsageDesc (iterators will be filled
 		 * in during registration)
@@ -64,6 +111,27 @@ public:
 				qutexRef,
 				typename LockerAndInvokerBase::List::iterator{});
 		}
+
+		recomputeSignature();
+	}
+
+	/**
+	 * @brief Also require `cost` tokens from limiter before the target runs.
+	 *
+	 * Must be called before the LockSet's continuation is lockvoked.
+	 */
+	void addRateLimiter(AsyncRateLimiter &limiter, double cost = 1)
+	{
+		if (registeredInQutexQueues)
+		{
+			throw std::runtime_error(
+				std::string(__func__) +
+				": LockSet::addRateLimiter() called after registering in "
+				"Qutex queues");
+		}
+
+		limiters.push_back(LimiterUsageDesc{
+			limiter, cost, AsyncRateLimiter::WaiterList::iterator{}});
 	}
 
 	/**
@@ -86,6 +154,34 @@ public:
 		const std::shared_ptr<LockerAndInvokerBase> &lockvoker
 		)
 	{
+		/**	EXPLANATION:
+		 * Lock inheritance: if a continuation up our caller chain holds one
+		 * of our Qutexes, it's suspended waiting for its callees to complete,
+		 * so we may use the Qutex under its ownership instead of queueing
+		 * behind it forever.
+		 *
+		 * But an ancestor may have several callees in flight at once, and
+		 * they mustn't all use the Qutex concurrently. So the ancestor lends
+		 * it to one callee at a time. Here we only note which Qutexes may be
+		 * borrowed; the borrowing is done by tryAcquireOrBackOff(), so that a
+		 * loan is just another acquisition: it's handed back when the attempt
+		 * backs off, and when the LockSet is released. Callees queue on the
+		 * Qutex like anybody else, and are woken by the ancestor when a loan
+		 * they were refused is returned.
+		 *
+		 * This relies on the usual nesting: the ancestor mustn't release the
+		 * Qutex before its callees have completed.
+		 */
+		nRequiredLocks = 0;
+		for (auto& lockUsageDesc : locks)
+		{
+			if (!lockUsageDesc.needsAcquisition) { continue; }
+
+			lockUsageDesc.mayBorrow = findHolderInCallerChain(
+				lockUsageDesc.qutex.get()) != nullptr;
+			nRequiredLocks++;
+		}
+
 		/**	EXPLANATION:
 		 * Register the lockvoker with each Qutex and store the returned
 		 * iterator to its place within each Qutex's queue. We store the
@@ -95,8 +191,22 @@ public:
 		 */
 		for (auto& lockUsageDesc : locks)
 		{
+			if (!lockUsageDesc.needsAcquisition) { continue; }
+
 			lockUsageDesc.iterator = lockUsageDesc.qutex.get().registerInQueue(
-				lockvoker);
+				lockvoker, isExtending);
+			lockUsageDesc.isQueued = true;
+		}
+
+		// Rate limiters are only paid once, even if the LockSet is reacquired.
+		if (!limitersArePaid)
+		{
+			for (auto& limiterUsageDesc : limiters)
+			{
+				limiterUsageDesc.iterator = limiterUsageDesc.limiter.get()
+					.registerInQueue(lockvoker, limiterUsageDesc.cost);
+			}
+			limitersAreQueued = true;
 		}
 
 		registeredInQutexQueues = true;
@@ -115,8 +225,21 @@ public:
 		// Unregister from all qutex queues
 		for (auto& lockUsageDesc : locks)
 		{
+			if (!lockUsageDesc.isQueued) { continue; }
+
 			auto it = lockUsageDesc.iterator;
 			lockUsageDesc.qutex.get().unregisterFromQueue(it);
+			lockUsageDesc.isQueued = false;
+		}
+
+		if (limitersAreQueued)
+		{
+			for (auto& limiterUsageDesc : limiters)
+			{
+				limiterUsageDesc.limiter.get().unregisterFromQueue(
+					limiterUsageDesc.iterator);
+			}
+			limitersAreQueued = false;
 		}
 	}
 
@@ -141,7 +264,7 @@ public:
 				": LockSet::tryAcquireOrBackOff() called but not registered in "
 				"Qutex queues");
 		}
-		if (allLocksAcquired)
+		if (allLocksAcquired && !isExtending)
 		{
 			throw std::runtime_error(
 				std::string(__func__) +
@@ -149,33 +272,96 @@ public:
 				"is already true");
 		}
 
+		/**	EXPLANATION:
+		 * Take tokens first: a throttled request then never touches the
+		 * Qutexes, so it can't make anybody queued on them back off. If a
+		 * Qutex fails afterwards, the tokens are refunded.
+		 */
+		const size_t nLimitersToPay = limitersArePaid ? 0 : limiters.size();
+		size_t nLimitersAcquired = 0;
+		for (; nLimitersAcquired < nLimitersToPay; nLimitersAcquired++)
+		{
+			auto& limiterUsageDesc = limiters[nLimitersAcquired];
+
+			if (!limiterUsageDesc.limiter.get().tryAcquire(
+				limiterUsageDesc.iterator))
+				{ break; }
+		}
+
+		if (nLimitersAcquired < nLimitersToPay)
+		{
+			refundLimiters(nLimitersAcquired);
+			return false;
+		}
+
 		// Try to acquire all required locks
-		int nAcquired = 0;
-		const int nRequiredLocks = static_cast<int>(locks.size());
+		size_t nTried = 0;
+		bool acquiredAll = true;
 		for (auto& lockUsageDesc : locks)
 		{
-			if (!lockUsageDesc.qutex.get().tryAcquire(
-				lockvoker, nRequiredLocks))
+			if (!lockUsageDesc.needsAcquisition) { nTried++; continue; }
+
+			if (lockUsageDesc.mayBorrow)
+			{
+				bool isHeldByCaller;
+				lockUsageDesc.lender = borrowFromCallerChain(
+					lockUsageDesc.qutex.get(), *lockUsageDesc.iterator,
+					isHeldByCaller);
+				if (!isHeldByCaller) { lockUsageDesc.mayBorrow = false; }
+			}
+
+			if (lockUsageDesc.lender == nullptr
+				&& !lockUsageDesc.qutex.get().tryAcquire(
+					lockvoker, nRequiredLocks))
 			{
 				// Set the first failed qutex for debugging
 				firstFailedQutex = std::ref(lockUsageDesc.qutex.get());
+				acquiredAll = false;
 				break;
 			}
 
-			nAcquired++;
+			nTried++;
 		}
 
-		if (nAcquired < nRequiredLocks)
+		if (!acquiredAll)
 		{
 			// Release any locks we managed to acquire
-			for (int i = 0; i < nAcquired; i++) {
-				locks[i].qutex.get().backoff(lockvoker, nRequiredLocks);
+			for (size_t i = 0; i < nTried; i++)
+			{
+				if (!locks[i].needsAcquisition) { continue; }
+
+				if (locks[i].lender != nullptr) { returnLoan(locks[i]); }
+				else {
+					locks[i].qutex.get().backoff(lockvoker, nRequiredLocks);
+				}
 			}
 
+			refundLimiters(nLimitersToPay);
 			return false;
 		}
 
+		SpinLock::Guard membershipGuard(membershipLock);
+
+		for (auto& lockUsageDesc : locks)
+		{
+			if (!lockUsageDesc.needsAcquisition) { continue; }
+
+			if (lockUsageDesc.lender != nullptr) {
+				lockUsageDesc.isInherited = true;
+			}
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+			else
+			{
+				RecordReplay::lockSetAcquired(
+					lockUsageDesc.qutex.get(), lockvoker.getRecordReplayId());
+			}
+#endif
+			lockUsageDesc.needsAcquisition = false;
+		}
+
 		allLocksAcquired = true;
+		isExtending = false;
+		limitersArePaid = true;
 		return true;
 	}
 
@@ -197,14 +383,275 @@ public:
 				": LockSet::release() called but allLocksAcquired is false");
 		}
 
+		if (isExtending)
+		{
+			throw std::runtime_error(
+				std::string(__func__) +
+				": LockSet::release() called while an extension is pending");
+		}
+
+		{
+			SpinLock::Guard membershipGuard(membershipLock);
+
+			for (auto& lockUsageDesc : locks) { throwIfLent(lockUsageDesc); }
+			// Callees stop seeing us as holding anything before we let go.
+			allLocksAcquired = false;
+		}
+
+		/* Everything is to be acquired afresh if we're lockvoked again,
+		 * including Qutexes that were released early.
+		 */
+		for (auto& lockUsageDesc : locks)
+		{
+			if (!lockUsageDesc.hasBeenReleased)
+				{ releaseOrReturn(lockUsageDesc); }
+
+			lockUsageDesc.hasBeenReleased = false;
+			lockUsageDesc.isInherited = false;
+			lockUsageDesc.mayBorrow = false;
+			lockUsageDesc.needsAcquisition = true;
+		}
+	}
+
+	/**
+	 * @brief Add extraQutexes to the held LockSet, keeping the Qutexes it
+	 *	already holds if that can be done without risking deadlock.
+	 * @return What the caller must do next: for EXTENDING and RESTARTING,
+	 *	lockvoke the continuation again to acquire what's missing.
+	 *
+	 *	EXPLANATION:
+	 * A normal lockvoker never waits while holding a Qutex: it backs off
+	 * everything unless it gets everything. An extension does wait while
+	 * holding, so extensions must follow a global order to stay out of
+	 * cycles with each other. The order is the Qutexes' addresses: if every
+	 * extra Qutex ranks above every Qutex we hold, we keep what we hold and
+	 * queue only on the extra ones. Otherwise we release everything and
+	 * start over with the larger LockSet, which is what callers had to do
+	 * by hand before.
+	 *
+	 * An extension queues at the front of the extra Qutexes' queues. Behind
+	 * a waiter that needs one of the Qutexes we hold, we'd never be admitted,
+	 * and that waiter would never get what we hold.
+	 */
+	ExtendResult extend(const Set &extraQutexes)
+	{
+		if (!allLocksAcquired || isExtending)
+		{
+			throw std::runtime_error(
+				std::string(__func__) +
+				": LockSet::extend() called but the LockSet isn't held");
+		}
+
+		std::less<const Qutex *> ranksBelow;
+		const Qutex *highestHeld = nullptr;
 		for (auto& lockUsageDesc : locks)
 		{
-			if (lockUsageDesc.hasBeenReleased) { continue; }
+			if (lockUsageDesc.hasBeenReleased || lockUsageDesc.isInherited)
+				{ continue; }
+
+			const Qutex *qutex = &lockUsageDesc.qutex.get();
+			if (highestHeld == nullptr || ranksBelow(highestHeld, qutex))
+				{ highestHeld = qutex; }
+		}
+
+		std::vector<std::reference_wrapper<Qutex>> toAcquire;
+		bool ranksAboveAllHeld = true;
+		for (auto& qutexRef : extraQutexes)
+		{
+			LockUsageDesc *lockUsageDesc = findLockUsageDesc(qutexRef.get());
+			if (lockUsageDesc != nullptr && !lockUsageDesc->hasBeenReleased)
+				{ continue; }
+
+			toAcquire.push_back(qutexRef);
+			if (highestHeld != nullptr
+				&& !ranksBelow(highestHeld, &qutexRef.get()))
+				{ ranksAboveAllHeld = false; }
+		}
+
+		if (toAcquire.empty()) { return ExtendResult::ALREADY_HELD; }
+
+		if (!ranksAboveAllHeld) { release(); }
+
+		SpinLock::Guard membershipGuard(membershipLock);
+
+		for (auto& qutexRef : toAcquire)
+		{
+			LockUsageDesc *lockUsageDesc = findLockUsageDesc(qutexRef.get());
+			if (lockUsageDesc == nullptr)
+			{
+				lockUsageDesc = &locks.emplace_back(
+					qutexRef,
+					typename LockerAndInvokerBase::List::iterator{});
+				signature.add(qutexRef.get().getRegistryId());
+			}
+
+			lockUsageDesc->hasBeenReleased = false;
+			lockUsageDesc->isInherited = false;
+			lockUsageDesc->mayBorrow = false;
+			lockUsageDesc->needsAcquisition = true;
+		}
+
+		membershipGuard.unlockPrematurely();
+
+		if (!ranksAboveAllHeld) { return ExtendResult::RESTARTING; }
+
+		isExtending = true;
+		return ExtendResult::EXTENDING;
+	}
+
+	/**
+	 * @brief Release qutex, if still held, and remove it from the LockSet
+	 *	altogether.
+	 *
+	 * Unlike releaseQutexEarly(), the Qutex no longer counts as part of the
+	 * LockSet afterwards: callees don't inherit it, deadlock tracing ignores
+	 * it, and a later extend() or relockvoke doesn't reacquire it.
+	 */
+	void dropQutex(Qutex &qutex)
+	{
+		if (!allLocksAcquired || isExtending)
+		{
+			throw std::runtime_error(
+				std::string(__func__) +
+				": LockSet::dropQutex() called but the LockSet isn't held");
+		}
+
+		SpinLock::Guard membershipGuard(membershipLock);
+
+		for (auto it = locks.begin(); it != locks.end(); ++it)
+		{
+			if (&it->qutex.get() != &qutex) { continue; }
+
+			throwIfLent(*it);
+
+			// Out of callees' sight first; then release it unlocked.
+			LockUsageDesc dropped = std::move(*it);
+			locks.erase(it);
+			recomputeSignature();
+			membershipGuard.unlockPrematurely();
+
+			if (!dropped.hasBeenReleased) { releaseOrReturn(dropped); }
+			return;
+		}
+
+		throw std::runtime_error(
+			std::string(__func__) +
+			": Qutex not found in this LockSet");
+	}
+
+	/**
+	 * @brief Run readFn against the data guarded by this LockSet without
+	 *	acquiring any of its locks.
+	 * @param readFn Copies out whatever it needs. It may run more than once,
+	 *	and it may observe torn or inconsistent values on attempts that end up
+	 *	being discarded. So it must not follow pointers or make decisions based
+	 *	on what it reads; it should only copy scalars (ideally through
+	 *	std::atomic loads with memory_order_relaxed).
+	 * @param nAttempts How many times to try before giving up.
+	 * @return true if some attempt saw a consistent snapshot. The caller
+	 *	should fall back to a normal LockerAndInvoker acquisition on false.
+	 *
+	 * This never touches the qutex queues, so optimistic readers don't queue
+	 * behind writers or each other. It doesn't pay any rate limiters either,
+	 * so it may not be used on a LockSet that has any.
+	 */
+	template <class ReadFnT>
+	bool tryOptimisticRead(ReadFnT &&readFn, unsigned int nAttempts = 3)
+	{
+		if (registeredInQutexQueues)
+		{
+			throw std::runtime_error(
+				std::string(__func__) +
+				": LockSet::tryOptimisticRead() called after registering in "
+				"Qutex queues");
+		}
+
+		if (!limiters.empty())
+		{
+			throw std::runtime_error(
+				std::string(__func__) +
+				": LockSet::tryOptimisticRead() called on a LockSet with rate "
+				"limiters, which it would bypass");
+		}
+
+		/* Qutexes our callers hold are owned (by them) for as long as we
+		 * run, so their versions are always odd. We borrow them for the
+		 * duration of the read, so that no other callee can write under
+		 * them meanwhile, and leave them out of the validation. If one is
+		 * already lent out, a sibling may be writing: give up.
+		 */
+		struct LoanScope
+		{
+			explicit LoanScope(LockSet &lockSet)
+			: lockSet(lockSet), lenders(lockSet.locks.size()) {}
+			~LoanScope()
+			{
+				for (size_t i = 0; i < lenders.size(); i++)
+				{
+					if (lenders[i] == nullptr) { continue; }
+					lenders[i]->returnLentQutex(lockSet.locks[i].qutex.get());
+				}
+			}
+
+			LockSet &lockSet;
+			std::vector<std::shared_ptr<AsynchronousContinuationChainLink>>
+				lenders;
+		} loans(*this);
+
+		for (size_t i = 0; i < locks.size(); i++)
+		{
+			bool isHeldByCaller;
+			loans.lenders[i] = borrowFromCallerChain(
+				locks[i].qutex.get(), nullptr, isHeldByCaller);
+			if (isHeldByCaller && loans.lenders[i] == nullptr) { return false; }
+		}
+
+		std::vector<uint64_t> versions(locks.size());
+
+		for (unsigned int attempt = 0; attempt < nAttempts; attempt++)
+		{
+			bool anyOwned = false;
+			for (size_t i = 0; i < locks.size(); i++)
+			{
+				if (loans.lenders[i] != nullptr) { continue; }
+
+				versions[i] = locks[i].qutex.get().readBegin();
+				if (versions[i] & 1) { anyOwned = true; break; }
+			}
+
+			// A writer is active; don't bother running readFn.
+			if (anyOwned) { continue; }
+
+			readFn();
+
+			bool consistent = true;
+			for (size_t i = 0; i < locks.size(); i++)
+			{
+				if (loans.lenders[i] != nullptr) { continue; }
+
+				if (!locks[i].qutex.get().readValidate(versions[i]))
+				{
+					consistent = false;
+					break;
+				}
+			}
 
-			lockUsageDesc.qutex.get().release();
+			if (consistent) { return true; }
 		}
 
-		allLocksAcquired = false;
+		return false;
+	}
+
+	LockUsageDesc *findLockUsageDesc(const Qutex &criterionLock)
+	{
+		for (auto& lockUsageDesc : locks)
+		{
+			if (&lockUsageDesc.qutex.get() == &criterionLock) {
+				return &lockUsageDesc;
+			}
+		}
+
+		return nullptr;
 	}
 
 	const LockUsageDesc &getLockUsageDesc(const Qutex &criterionLock) const
@@ -238,21 +685,245 @@ public:
 		auto& lockUsageDesc = const_cast<LockUsageDesc&>(
 			getLockUsageDesc(qutex));
 
-		if (!lockUsageDesc.hasBeenReleased)
 		{
-			lockUsageDesc.qutex.get().release();
+			SpinLock::Guard membershipGuard(membershipLock);
+
+			if (lockUsageDesc.hasBeenReleased) { return; }
+
+			throwIfLent(lockUsageDesc);
 			lockUsageDesc.hasBeenReleased = true;
 		}
 
-		return;
+		releaseOrReturn(lockUsageDesc);
+	}
+
+	/**
+	 * @brief Bitmap of every Qutex in this LockSet, held or not; for fast
+	 *	overlap, subset and equality tests against other LockSets.
+	 *
+	 *	EXPLANATION:
+	 * Kept up to date by the constructor, extend() and dropQutex() rather
+	 * than computed lazily on first use: callees on other threads call
+	 * isHolding() on their ancestors' LockSets, so a lazy cache would be
+	 * filled in by several threads at once. Those callees read it under
+	 * membershipLock; on the owning thread it can be read freely.
+	 */
+	const LockSetSignature &getSignature(void) const
+		{ return signature; }
+
+	/* Whether this LockSet currently holds qutex, inherited or not. May be
+	 * called from any thread.
+	 */
+	bool isHolding(const Qutex &qutex) const
+	{
+		SpinLock::Guard membershipGuard(membershipLock);
+		return isHoldingLocked(qutex);
+	}
+
+	/**
+	 * @brief Lend qutex to a callee, if we hold it and haven't already lent
+	 *	it out. Called from the callee's thread.
+	 * @param waiter Awakened when the current loan is returned, if the
+	 *	Qutex is lent out; may be nullptr.
+	 */
+	bool tryLend(
+		const Qutex &qutex,
+		const std::shared_ptr<LockerAndInvokerBase> &waiter
+		)
+	{
+		SpinLock::Guard membershipGuard(membershipLock);
+
+		if (!isHoldingLocked(qutex)) { return false; }
+
+		LockUsageDesc *lockUsageDesc = findLockUsageDesc(qutex);
+		SpinLock &qutexLock = lockUsageDesc->qutex.get().lock;
+		bool ret = false;
+
+		qutexLock.acquire();
+		if (!lockUsageDesc->isLent)
+		{
+			lockUsageDesc->isLent = true;
+			ret = true;
+		}
+		else if (waiter != nullptr
+			&& std::find(
+				lockUsageDesc->loanWaiters.begin(),
+				lockUsageDesc->loanWaiters.end(), waiter)
+				== lockUsageDesc->loanWaiters.end())
+		{
+			lockUsageDesc->loanWaiters.push_back(waiter);
+		}
+		qutexLock.release();
+
+		return ret;
+	}
+
+	// Take back a loan made by tryLend(), and wake whoever waited for it.
+	void returnLent(const Qutex &qutex)
+	{
+		SpinLock::Guard membershipGuard(membershipLock);
+
+		LockUsageDesc *lockUsageDesc = findLockUsageDesc(qutex);
+		if (lockUsageDesc == nullptr)
+		{
+			throw std::runtime_error(
+				std::string(__func__) +
+				": Returned a Qutex that isn't in this LockSet");
+		}
+
+		SpinLock &qutexLock = lockUsageDesc->qutex.get().lock;
+		std::vector<std::shared_ptr<LockerAndInvokerBase>> waiters;
+
+		qutexLock.acquire();
+		const bool wasLent = lockUsageDesc->isLent;
+		lockUsageDesc->isLent = false;
+		waiters.swap(lockUsageDesc->loanWaiters);
+		qutexLock.release();
+
+		membershipGuard.unlockPrematurely();
+
+		if (!wasLent)
+		{
+			throw std::runtime_error(
+				std::string(__func__) +
+				": Returned a Qutex that this LockSet hasn't lent out");
+		}
+
+		for (auto &waiter : waiters) { waiter->awaken(); }
+	}
+
+private:
+	// Called with membershipLock held.
+	bool isHoldingLocked(const Qutex &qutex) const
+	{
+		if (!allLocksAcquired) { return false; }
+		// Callees ask every continuation up their chain; most don't have it.
+		if (!getSignature().mayContain(qutex.getRegistryId()))
+			{ return false; }
+
+		for (auto& lockUsageDesc : locks)
+		{
+			if (&lockUsageDesc.qutex.get() == &qutex)
+			{
+				return !lockUsageDesc.hasBeenReleased
+					&& !lockUsageDesc.needsAcquisition;
+			}
+		}
+
+		return false;
+	}
+
+	std::shared_ptr<AsynchronousContinuationChainLink> findHolderInCallerChain(
+		const Qutex &qutex
+		) const
+	{
+		for (std::shared_ptr<AsynchronousContinuationChainLink> currContin =
+				parentContinuation.getCallersContinuationShPtr();
+			currContin != nullptr;
+			currContin = currContin->getCallersContinuationShPtr())
+		{
+			if (currContin->holdsQutex(qutex)) { return currContin; }
+		}
+
+		return nullptr;
+	}
+
+	/**	EXPLANATION:
+	 * Only the nearest continuation up our chain that holds qutex can lend
+	 * it: any further up has lent it to the chain below it already.
+	 * @param waiter Passed on to tryLendQutex().
+	 * @param isHeldByCaller Set if some caller holds qutex, whether or not
+	 *	it could be borrowed.
+	 * @return The lender, or nullptr if not borrowed.
+	 */
+	std::shared_ptr<AsynchronousContinuationChainLink> borrowFromCallerChain(
+		const Qutex &qutex,
+		const std::shared_ptr<LockerAndInvokerBase> &waiter,
+		bool &isHeldByCaller
+		) const
+	{
+		std::shared_ptr<AsynchronousContinuationChainLink> holder =
+			findHolderInCallerChain(qutex);
+
+		isHeldByCaller = holder != nullptr;
+		if (holder == nullptr || !holder->tryLendQutex(qutex, waiter))
+			{ return nullptr; }
+
+		return holder;
+	}
+
+	void returnLoan(LockUsageDesc &lockUsageDesc)
+	{
+		std::shared_ptr<AsynchronousContinuationChainLink> lender =
+			std::move(lockUsageDesc.lender);
+		lockUsageDesc.lender = nullptr;
+		lender->returnLentQutex(lockUsageDesc.qutex.get());
+	}
+
+	// Release a held Qutex, or hand back a borrowed one.
+	void releaseOrReturn(LockUsageDesc &lockUsageDesc)
+	{
+		if (lockUsageDesc.isInherited) { returnLoan(lockUsageDesc); }
+		else { lockUsageDesc.qutex.get().release(); }
+	}
+
+	// Our callees must have completed before we let go of what they borrowed.
+	static void throwIfLent(LockUsageDesc &lockUsageDesc)
+	{
+		SpinLock &qutexLock = lockUsageDesc.qutex.get().lock;
+
+		qutexLock.acquire();
+		const bool isLent = lockUsageDesc.isLent;
+		qutexLock.release();
+
+		if (!isLent) { return; }
+
+		throw std::runtime_error(
+			std::string(__func__) +
+			": Releasing a Qutex that's still lent to a callee");
+	}
+
+	void recomputeSignature(void)
+	{
+		signature.clear();
+		for (auto& lockUsageDesc : locks)
+			{ signature.add(lockUsageDesc.qutex.get().getRegistryId()); }
+	}
+
+	void refundLimiters(size_t nLimitersAcquired)
+	{
+		for (size_t i = 0; i < nLimitersAcquired; i++)
+			{ limiters[i].limiter.get().refund(limiters[i].cost); }
 	}
 
 public:
 	std::vector<LockUsageDesc> locks;
+	std::vector<LimiterUsageDesc> limiters;
 
 private:
 	SerializedAsynchronousContinuation<OriginalCbFnT> &parentContinuation;
 	bool allLocksAcquired, registeredInQutexQueues;
+	// Holding the LockSet, and waiting to acquire the Qutexes extend() added.
+	bool isExtending;
+	bool limitersAreQueued, limitersArePaid;
+	/* Number of Qutexes the current acquisition attempt acquires, i.e:
+	 * excluding inherited ones, and when extending, the ones already held.
+	 */
+	int nRequiredLocks;
+	LockSetSignature signature;
+	/**	EXPLANATION:
+	 * Callees on other threads look into this LockSet through isHolding(),
+	 * tryLend() and returnLent() while it's held, and it may have several
+	 * callees in flight at once. So membership changes (extend(),
+	 * dropQutex()), the signature, and whether a Qutex counts as held
+	 * (allLocksAcquired, hasBeenReleased, needsAcquisition) are only changed
+	 * with this held, and those lookups are made with it held. The owning
+	 * thread reads them without it.
+	 *
+	 * Qutexes are released outside it, once callees can no longer see them
+	 * as held, and only after checking, under it, that they aren't lent out.
+	 */
+	mutable SpinLock membershipLock;
 };
 
 } // namespace sscl
@@ -0,0 +1,106 @@
+#ifndef LOCK_SET_SIGNATURE_H
+#define LOCK_SET_SIGNATURE_H
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace sscl {
+
+/**
+ * @brief LockSetSignature - Fixed-size bitmap of the Qutexes in a LockSet,
+ *	indexed by their QutexRegistry ids
+ *
+ * Overlap, subset and equality tests are a handful of word-wise ANDs and
+ * compares over 64 bytes, with no branches in the loops, so the
+ * compiler vectorizes them; versus quadratic walks over two LockSets'
+ * LockUsageDescs.
+ *
+ *	EXPLANATION:
+ * Ids at or beyond nBits fold onto lower bits, turning the bitmap into a
+ * one-hash Bloom filter. isExact() says whether that happened. When both
+ * signatures are exact, every test is exact. Otherwise there are no false
+ * negatives: overlaps(), isSubsetOf() and == may report true spuriously,
+ * but never false spuriously, so callers that need certainty only have to
+ * fall back to comparing Qutexes when a test says true.
+ */
+class LockSetSignature
+{
+public:
+	static constexpr size_t nBits = 512;
+	static constexpr size_t nWords = nBits / 64;
+
+	void add(uint32_t qutexId)
+	{
+		if (qutexId >= nBits) { exact = false; }
+
+		const uint32_t bit = qutexId % nBits;
+		words[bit / 64] |= uint64_t(1) << (bit % 64);
+	}
+
+	// False means definitely not; see isExact().
+	bool mayContain(uint32_t qutexId) const
+	{
+		const uint32_t bit = qutexId % nBits;
+		return (words[bit / 64] >> (bit % 64)) & 1;
+	}
+
+	bool overlaps(const LockSetSignature &other) const
+	{
+		uint64_t common = 0;
+		for (size_t i = 0; i < nWords; i++)
+			{ common |= words[i] & other.words[i]; }
+
+		return common != 0;
+	}
+
+	bool isSubsetOf(const LockSetSignature &other) const
+	{
+		uint64_t extra = 0;
+		for (size_t i = 0; i < nWords; i++)
+			{ extra |= words[i] & ~other.words[i]; }
+
+		return extra == 0;
+	}
+
+	bool operator==(const LockSetSignature &other) const
+	{
+		uint64_t diff = 0;
+		for (size_t i = 0; i < nWords; i++)
+			{ diff |= words[i] ^ other.words[i]; }
+
+		return diff == 0;
+	}
+
+	bool isEmpty(void) const
+	{
+		uint64_t any = 0;
+		for (size_t i = 0; i < nWords; i++) { any |= words[i]; }
+		return any == 0;
+	}
+
+	size_t count(void) const
+	{
+		size_t ret = 0;
+		for (size_t i = 0; i < nWords; i++)
+			{ ret += std::popcount(words[i]); }
+		return ret;
+	}
+
+	bool isExact(void) const { return exact; }
+
+	void clear(void)
+	{
+		words.fill(0);
+		exact = true;
+	}
+
+private:
+	std::array<uint64_t, nWords> words{};
+	bool exact = true;
+};
+
+} // namespace sscl
+
+#endif // LOCK_SET_SIGNATURE_H
@@ -1,13 +1,18 @@
 #ifndef LOCKER_AND_INVOKER_BASE_H
 #define LOCKER_AND_INVOKER_BASE_H
 
+#include <config.h>
 #include <list>
 #include <memory>
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+#include <spinscale/recordReplay.h>
+#endif
 
 namespace sscl {
 
-// Forward declaration
+// Forward declarations
 class Qutex;
+class ComponentThread;
 
 /**
  * @brief LockerAndInvokerBase - Base class for lockvoking mechanism
@@ -50,6 +55,14 @@ public:
 	virtual size_t getLockSetSize() const = 0;
 	virtual Qutex& getLockAt(size_t index) const = 0;
 
+	// The thread that this lockvoker runs on when it's awakened.
+	virtual ComponentThread *getTargetThread() const = 0;
+
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+	// Id of the continuation being lockvoked; stable across runs.
+	virtual RecordReplay::EventId getRecordReplayId() const = 0;
+#endif
+
 	/**
 	 * @brief Equality operator
 	 * 
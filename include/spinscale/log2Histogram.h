@@ -0,0 +1,105 @@
+#ifndef LOG2_HISTOGRAM_H
+#define LOG2_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+namespace sscl {
+
+/**
+ * @brief Log2Histogram - Lock-free histogram with power-of-2 buckets
+ *
+ * Bucket 0 counts zeroes; bucket i (i >= 1) counts values in
+ * [2^(i-1), 2^i). Recording is a couple of relaxed atomic increments, so
+ * it's cheap enough for hot paths, and any thread may record or snapshot
+ * concurrently. Snapshots aren't atomic across buckets.
+ */
+class Log2Histogram
+{
+public:
+	static constexpr size_t nBuckets = 65;
+
+	struct Snapshot
+	{
+		std::array<uint64_t, nBuckets> buckets;
+		uint64_t count;
+		uint64_t sum;
+
+		double mean(void) const
+			{ return count == 0 ? 0.0 : static_cast<double>(sum) / count; }
+
+		/**
+		 * @brief Upper bound of the bucket containing the given quantile.
+		 * @param q In [0, 1].
+		 */
+		uint64_t quantileUpperBound(double q) const
+		{
+			if (count == 0) { return 0; }
+
+			const uint64_t target = static_cast<uint64_t>(q * count);
+			uint64_t seen = 0;
+
+			for (size_t i = 0; i < nBuckets; i++)
+			{
+				seen += buckets[i];
+				if (seen > target || seen == count)
+					{ return bucketUpperBound(i); }
+			}
+
+			return 0;
+		}
+	};
+
+	Log2Histogram(void)
+	{
+		for (auto &bucket : buckets) {
+			bucket.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	static size_t bucketFor(uint64_t value)
+		{ return static_cast<size_t>(std::bit_width(value)); }
+
+	// Largest value that lands in bucket i.
+	static uint64_t bucketUpperBound(size_t i)
+		{ return i == 0 ? 0 : (i >= 64 ? UINT64_MAX : (uint64_t(1) << i) - 1); }
+
+	void record(uint64_t value)
+	{
+		buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+		sum.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	Snapshot snapshot(void) const
+	{
+		Snapshot ret;
+		for (size_t i = 0; i < nBuckets; i++) {
+			ret.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+		}
+
+		ret.count = count.load(std::memory_order_relaxed);
+		ret.sum = sum.load(std::memory_order_relaxed);
+		return ret;
+	}
+
+	void reset(void)
+	{
+		for (auto &bucket : buckets) {
+			bucket.store(0, std::memory_order_relaxed);
+		}
+
+		count.store(0, std::memory_order_relaxed);
+		sum.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	std::array<std::atomic<uint64_t>, nBuckets> buckets;
+	std::atomic<uint64_t> count{0}, sum{0};
+};
+
+} // namespace sscl
+
+#endif // LOG2_HISTOGRAM_H
@@ -0,0 +1,243 @@
+#ifndef NODE_REPLICATED_H
+#define NODE_REPLICATED_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+#include <spinscale/cacheLine.h>
+#include <spinscale/numaTopology.h>
+#include <spinscale/spinLock.h>
+
+namespace sscl {
+
+/**
+ * @brief NodeReplicated - One copy of a read-mostly object per NUMA node
+ *
+ * For structures (routing tables, config) that threads on every socket read
+ * on every request. Reads are served from the replica on the reader's own
+ * node, so their cache lines never cross the interconnect. Writes are
+ * appended to a shared operation log, and each replica replays the log
+ * lazily: just before a read on that node finds it behind, or when one of
+ * the node's threads calls sync().
+ *
+ * Reads see every write that completed before they started. A write is
+ * applied to the writer's own replica before execute() returns.
+ *
+ *	EXPLANATION:
+ * Each replica applies every op itself, so ops must be deterministic and
+ * mustn't throw; they may not capture references into a replica.
+ *
+ * A replica is created by the first thread on its node to touch it, by
+ * copying an existing replica. With Linux's default first-touch policy, that
+ * places its memory (including whatever T allocates while being copied) on
+ * that node. Nodes nobody reads from cost nothing.
+ *
+ * The log is trimmed up to the oldest replica's position. A node whose
+ * threads stop reading holds it back, so long-lived programs with idle nodes
+ * should call sync() on them now and then, e.g: from a timer.
+ */
+template <class T>
+class NodeReplicated
+{
+public:
+	typedef std::function<void(T &)> OpFn;
+
+public:
+	explicit NodeReplicated(
+		T initial, const NumaTopology &topology = NumaTopology::get())
+	:	topology(topology),
+		replicas(std::max(topology.getNNodes(), 1u)),
+		logBase(0), logTail(0)
+	{
+		replicas[getLocalNode()].store(
+			new Replica(std::move(initial), 0), std::memory_order_release);
+	}
+
+	~NodeReplicated()
+	{
+		for (auto &replica : replicas)
+			{ delete replica.load(std::memory_order_relaxed); }
+	}
+
+	NodeReplicated(const NodeReplicated &) = delete;
+	NodeReplicated &operator=(const NodeReplicated &) = delete;
+
+	/**
+	 * @brief Run readFn on the calling node's replica and return its result.
+	 *
+	 * readFn runs under the replica's shared lock: it should be short, and
+	 * mustn't call back into this NodeReplicated.
+	 */
+	template <class ReadFnT>
+	auto read(ReadFnT &&readFn)
+	{
+		Replica &replica = getLocalReplica();
+		catchUp(replica);
+
+		std::shared_lock<std::shared_mutex> guard(replica.mutex);
+		return std::forward<ReadFnT>(readFn)(std::as_const(replica.value));
+	}
+
+	// Append op to the log, then apply it (and any before it) locally.
+	void execute(OpFn op)
+	{
+		logLock.acquire();
+		log.push_back(std::make_shared<const OpFn>(std::move(op)));
+		logTail.store(logBase + log.size(), std::memory_order_release);
+		logLock.release();
+
+		catchUp(getLocalReplica());
+	}
+
+	// Apply any pending ops to the calling node's replica.
+	void sync(void) { catchUp(getLocalReplica()); }
+
+	size_t getLogLength(void)
+	{
+		logLock.acquire();
+		const size_t ret = log.size();
+		logLock.release();
+		return ret;
+	}
+
+	unsigned int getNReplicas(void) const
+	{
+		unsigned int ret = 0;
+		for (const auto &replica : replicas)
+			{ ret += replica.load(std::memory_order_acquire) != nullptr; }
+		return ret;
+	}
+
+private:
+	struct alignas(cacheLineSize) Replica
+	{
+		Replica(T value, uint64_t appliedUpTo)
+		:	value(std::move(value)), appliedUpTo(appliedUpTo)
+		{}
+
+		std::shared_mutex mutex;
+		// Guarded by mutex.
+		T value;
+		// Log position applied up to. Only advanced with mutex held.
+		std::atomic<uint64_t> appliedUpTo;
+	};
+
+	unsigned int getLocalNode(void) const
+	{
+		const unsigned int node = topology.getCurrentNode();
+		return node < replicas.size() ? node : 0;
+	}
+
+	Replica &getLocalReplica(void)
+	{
+		const unsigned int node = getLocalNode();
+		Replica *replica = replicas[node].load(std::memory_order_acquire);
+		if (replica != nullptr) { return *replica; }
+
+		return createReplica(node);
+	}
+
+	Replica &createReplica(unsigned int node)
+	{
+		Replica *source = nullptr;
+		for (auto &replica : replicas)
+		{
+			source = replica.load(std::memory_order_acquire);
+			if (source != nullptr) { break; }
+		}
+
+		/**	EXPLANATION:
+		 * source can't advance while we hold its shared lock, and the log
+		 * is only trimmed (under logLock) up to the oldest registered
+		 * replica, which is at most source's position. So everything the
+		 * new replica still has to replay is in the log once it's
+		 * registered, below.
+		 */
+		std::shared_lock<std::shared_mutex> guard(source->mutex);
+		auto *newReplica = new Replica(
+			source->value,
+			source->appliedUpTo.load(std::memory_order_relaxed));
+
+		logLock.acquire();
+		Replica *existing = nullptr;
+		const bool installed = replicas[node].compare_exchange_strong(
+			existing, newReplica, std::memory_order_acq_rel);
+		logLock.release();
+
+		if (!installed)
+		{
+			delete newReplica;
+			return *existing;
+		}
+
+		return *newReplica;
+	}
+
+	void catchUp(Replica &replica)
+	{
+		if (replica.appliedUpTo.load(std::memory_order_acquire)
+			>= logTail.load(std::memory_order_acquire))
+			{ return; }
+
+		std::unique_lock<std::shared_mutex> guard(replica.mutex);
+
+		const uint64_t from = replica.appliedUpTo.load(
+			std::memory_order_relaxed);
+
+		// Copy the ops out so other nodes can append and replay meanwhile.
+		logLock.acquire();
+		const uint64_t to = logBase + log.size();
+		std::vector<std::shared_ptr<const OpFn>> pending(
+			log.begin() + (from - logBase), log.end());
+		logLock.release();
+
+		for (const auto &op : pending) { (*op)(replica.value); }
+		replica.appliedUpTo.store(to, std::memory_order_release);
+		guard.unlock();
+
+		trimLog();
+	}
+
+	void trimLog(void)
+	{
+		logLock.acquire();
+
+		uint64_t oldestApplied = logBase + log.size();
+		for (auto &replica : replicas)
+		{
+			Replica *r = replica.load(std::memory_order_acquire);
+			if (r == nullptr) { continue; }
+
+			oldestApplied = std::min(
+				oldestApplied,
+				r->appliedUpTo.load(std::memory_order_acquire));
+		}
+
+		for (; logBase < oldestApplied; logBase++) { log.pop_front(); }
+
+		logLock.release();
+	}
+
+private:
+	const NumaTopology &topology;
+	// Indexed by node; created on first use from that node.
+	std::vector<std::atomic<Replica *>> replicas;
+
+	SpinLock logLock;
+	// Guarded by logLock. log[0] is the op at position logBase.
+	std::deque<std::shared_ptr<const OpFn>> log;
+	uint64_t logBase;
+	// logBase + log.size(); also read without logLock by catchUp().
+	alignas(cacheLineSize) std::atomic<uint64_t> logTail;
+};
+
+} // namespace sscl
+
+#endif // NODE_REPLICATED_H
@@ -0,0 +1,59 @@
+#ifndef NUMA_TOPOLOGY_H
+#define NUMA_TOPOLOGY_H
+
+#include <string>
+#include <vector>
+
+namespace sscl {
+
+/**
+ * @brief NumaTopology - Which CPUs belong to which NUMA node
+ *
+ * Read once from /sys/devices/system/node. Machines (or containers) which
+ * don't expose it are treated as a single node holding every online CPU, so
+ * callers never need a separate non-NUMA path.
+ */
+class NumaTopology
+{
+public:
+	static const NumaTopology &get(void)
+	{
+		static const NumaTopology instance;
+		return instance;
+	}
+
+	unsigned int getNNodes(void) const { return nodeCpus.size(); }
+	const std::vector<int> &getCpusOfNode(unsigned int node) const
+		{ return nodeCpus.at(node); }
+
+	// CPUs the topology doesn't know about are reported as node 0.
+	unsigned int getNodeOfCpu(int cpu) const
+	{
+		if (cpu < 0 || static_cast<size_t>(cpu) >= cpuToNode.size())
+			{ return 0; }
+
+		return cpuToNode[cpu];
+	}
+
+	/**
+	 * @brief Node of the CPU the calling thread is running on right now.
+	 *
+	 * Cheap (sched_getcpu() is a vDSO call), but only a hint unless the
+	 * thread is pinned, e.g: by PuppetApplication::distributeAndPinThreadsAcrossCpus().
+	 */
+	unsigned int getCurrentNode(void) const;
+
+	// Parses sysfs' "0-3,8-11" CPU list format.
+	static std::vector<int> parseCpuList(const std::string &cpuList);
+
+private:
+	NumaTopology(void);
+
+private:
+	std::vector<std::vector<int>> nodeCpus;
+	std::vector<unsigned int> cpuToNode;
+};
+
+} // namespace sscl
+
+#endif // NUMA_TOPOLOGY_H
@@ -4,6 +4,7 @@
 #include <config.h>
 #include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 #include <spinscale/callback.h>
 #include <spinscale/componentThread.h>
@@ -34,6 +35,22 @@ public:
 	// CPU distribution method
 	void distributeAndPinThreadsAcrossCpus();
 
+	/**
+	 * If set before startAllPuppetThreadsReq(), all current and future
+	 * mappings of the process are locked into RAM (mlockall()) at start.
+	 * MCL_FUTURE also makes the kernel populate later mappings (pools,
+	 * thread stacks) as they're created, so they don't page fault later.
+	 */
+	void setLockAllMemory(bool lock) { lockAllMemory = lock; }
+
+	/**
+	 * Everything the kernel refused while applying memory locking and each
+	 * PuppetThread's RealtimeConfig during the last startAllPuppetThreadsReq().
+	 * Each entry is prefixed with the name of the thread it applies to.
+	 */
+	const std::vector<std::string> &getRealtimeRefusals(void) const
+		{ return realtimeRefusals; }
+
 protected:
 	// Collection of PuppetThread instances
 	std::vector<std::shared_ptr<PuppetThread>> componentThreads;
@@ -59,6 +76,9 @@ protected:
 	 */
 	bool threadsHaveBeenJolted = false;
 
+	bool lockAllMemory = false;
+	std::vector<std::string> realtimeRefusals;
+
 private:
 	class PuppetThreadLifetimeMgmtOp;
 };
@@ -2,11 +2,18 @@
 #define QUTEX_H
 
 #include <config.h>
+#include <atomic>
+#include <cstdint>
 #include <list>
 #include <memory>
 #include <string>
+#include <spinscale/cacheLine.h>
 #include <spinscale/spinLock.h>
 #include <spinscale/lockerAndInvokerBase.h>
+#include <spinscale/qutexRegistry.h>
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+#include <spinscale/recordReplay.h>
+#endif
 
 namespace sscl {
 
@@ -16,32 +23,53 @@ namespace sscl {
  * A Qutex combines a spinlock, an ownership flag, and a queue of waiting
  * lockvokers to provide efficient asynchronous lock management with
  * priority-based acquisition for LockSets.
+ *
+ * A Qutex also carries a seqlock-style version counter which is odd while the
+ * Qutex is owned and even while it's free. This lets readers which only need
+ * a consistent snapshot of a few guarded fields read them without queueing:
+ * see readBegin()/readValidate() and LockSet::tryOptimisticRead().
+ *
+ *	EXPLANATION:
+ * Every Qutex starts on its own cache line, and the fields touched on every
+ * acquire/release (lock, isOwned, version and the queue's list header) all
+ * fit within that first line. Debug-only fields go on a line of their own
+ * after the hot ones, so enabling debug locks doesn't push the hot fields
+ * apart. The upshot is that two Qutexes that sit next to each other (in an
+ * array, in a QutexArena, or as members of the same object) never
+ * false-share.
  */
-class Qutex
+class alignas(cacheLineSize) Qutex
 {
 public:
 	/**
 	 * @brief Constructor
 	 */
 	Qutex([[maybe_unused]] const std::string &_name)
-	:
+	:	isOwned(false), version(0), registryId(QutexRegistry::allocateId())
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
-	name(_name), currOwner(nullptr),
+	, name(_name), currOwner(nullptr)
+#endif
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+	, recordReplayOrdinal(RecordReplay::allocateQutexOrdinal())
 #endif
-	isOwned(false)
 	{}
 
+	~Qutex() { QutexRegistry::releaseId(registryId); }
+
 	/**
 	 * @brief Register a lockvoker in the queue
 	 * @param lockvoker The lockvoker to register
+	 * @param atFront Queue ahead of everybody else rather than at the back
 	 * @return Iterator pointing to the registered lockvoker in the queue
 	 */
 	LockerAndInvokerBase::List::iterator registerInQueue(
-		const std::shared_ptr<LockerAndInvokerBase> &lockvoker
+		const std::shared_ptr<LockerAndInvokerBase> &lockvoker,
+		bool atFront = false
 		)
 	{
 		lock.acquire();
-		auto it = queue.insert(queue.end(), lockvoker);
+		auto it = queue.insert(
+			atFront ? queue.begin() : queue.end(), lockvoker);
 		lock.release();
 		return it;
 	}
@@ -87,19 +115,132 @@ public:
 	 */
 	void release();
 
+#ifdef CONFIG_ENABLE_QUTEX_STATS
+	struct Stats
+	{
+		/* Number of times the Qutex was acquired after having been released
+		 * with waiters queued, and the total time it sat free in between:
+		 * i.e: granted to the queue, but idle until one of the waiters'
+		 * threads got around to running it.
+		 */
+		uint64_t nGrantsToWaiters;
+		uint64_t idleWhileGrantedNs;
+		// Waiters woken in addition to the front, because their threads were idle.
+		uint64_t nIdleAwareWakeups;
+	};
+
+	Stats getStats() const
+	{
+		return Stats{
+			nGrantsToWaiters.load(std::memory_order_relaxed),
+			idleWhileGrantedNs.load(std::memory_order_relaxed),
+			nIdleAwareWakeups.load(std::memory_order_relaxed)
+		};
+	}
+#endif
+
+	/**
+	 * @brief Begin an optimistic read of the data guarded by this Qutex.
+	 * @return A version stamp to pass to readValidate(). If it's odd, the
+	 *	Qutex is currently owned and the read is already doomed.
+	 */
+	uint64_t readBegin() const
+		{ return version.load(std::memory_order_acquire); }
+
+	/**
+	 * @brief Check whether an optimistic read begun with readBegin() saw a
+	 *	consistent snapshot.
+	 *
+	 *	EXPLANATION:
+	 * The acquire fence keeps the reader's loads of the guarded fields from
+	 * being reordered after the second load of the version. If the version
+	 * is unchanged and even, nobody owned the Qutex at any point during the
+	 * read.
+	 */
+	bool readValidate(uint64_t versionAtBegin) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return (versionAtBegin & 1) == 0
+			&& version.load(std::memory_order_relaxed) == versionAtBegin;
+	}
+
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
 	std::shared_ptr<LockerAndInvokerBase> getCurrOwner() const
 		{ return currOwner; }
 #endif
 
+	// Dense id, for indexing bitmaps such as LockSetSignature.
+	uint32_t getRegistryId() const { return registryId; }
+
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+	// Position in the order of Qutex creation; identifies it across runs.
+	uint32_t getRecordReplayOrdinal() const { return recordReplayOrdinal; }
+#endif
+
 public:
+	// Hot: all on the Qutex's first cache line.
+	SpinLock lock;
+	bool isOwned;
+private:
+	std::atomic<uint64_t> version;
+public:
+	LockerAndInvokerBase::List queue;
+private:
+	const uint32_t registryId;
+public:
+
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
-	std::string name;
+	// Cold: only read when reporting.
+	alignas(cacheLineSize) std::string name;
 	std::shared_ptr<LockerAndInvokerBase> currOwner;
 #endif
-	SpinLock lock;
-	LockerAndInvokerBase::List queue;
-	bool isOwned;
+
+private:
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+	const uint32_t recordReplayOrdinal;
+#endif
+
+	/**	EXPLANATION:
+	 * Both of these are only called with `lock` held, so a plain
+	 * load-then-store is enough. The release fence after making the version
+	 * odd orders it before the new owner's writes to the guarded data; the
+	 * release store that makes it even again orders it after them.
+	 */
+	void bumpVersionOnAcquire()
+	{
+		version.store(
+			version.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void bumpVersionOnRelease()
+	{
+		version.store(
+			version.load(std::memory_order_relaxed) + 1,
+			std::memory_order_release);
+	}
+
+	// Marks the Qutex as owned by newOwner. Called with `lock` held.
+	void grantTo(const LockerAndInvokerBase &newOwner);
+
+#ifdef CONFIG_QUTEX_IDLE_AWARE_WAKEUP
+	// Max number of waiters behind the front to consider in pickIdleWaiter().
+	static constexpr int maxIdleAwareWakeupScan = 8;
+
+	std::shared_ptr<LockerAndInvokerBase> pickIdleWaiter(
+		const LockerAndInvokerBase *exclude);
+#endif
+
+#ifdef CONFIG_ENABLE_QUTEX_STATS
+	void noteFreedWithWaiters();
+	void noteAcquired();
+
+	// Guarded by `lock`; 0 means "not freed with waiters queued".
+	int64_t freedWithWaitersAtNs = 0;
+	std::atomic<uint64_t> nGrantsToWaiters{0}, idleWhileGrantedNs{0},
+		nIdleAwareWakeups{0};
+#endif
 };
 
 } // namespace sscl
@@ -0,0 +1,58 @@
+#ifndef QUTEX_ARENA_H
+#define QUTEX_ARENA_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include <spinscale/qutex.h>
+
+namespace sscl {
+
+/**
+ * @brief QutexArena - Contiguous, cache-line-aligned storage for many Qutexes
+ *
+ * For components that guard many independent items (table rows, hash
+ * buckets, per-slot state) with a Qutex apiece. All of the arena's Qutexes
+ * come from one allocation, back to back, each starting on its own cache
+ * line, so walking them is prefetch-friendly and neighbours never
+ * false-share. Qutexes aren't movable, so they can't be kept in a
+ * std::vector; this is the equivalent.
+ *
+ * The arena's size is fixed at construction, and Qutex references stay valid
+ * for the arena's lifetime.
+ */
+class QutexArena
+{
+public:
+	/**
+	 * @param nQutexes Number of Qutexes to construct.
+	 * @param namePrefix Each Qutex is named namePrefix + its index (the
+	 *	names are only kept in debug-locks builds).
+	 */
+	QutexArena(size_t nQutexes, const std::string &namePrefix);
+	~QutexArena();
+
+	QutexArena(const QutexArena &) = delete;
+	QutexArena &operator=(const QutexArena &) = delete;
+
+	size_t size(void) const { return nQutexes; }
+
+	Qutex &operator[](size_t i) { return qutexes[i]; }
+	const Qutex &operator[](size_t i) const { return qutexes[i]; }
+
+	Qutex *begin(void) { return qutexes; }
+	Qutex *end(void) { return qutexes + nQutexes; }
+
+	// Convenience for building a LockSet over some of the arena's Qutexes.
+	std::vector<std::reference_wrapper<Qutex>> getQutexes(
+		const std::vector<size_t> &indices);
+
+private:
+	const size_t nQutexes;
+	Qutex *qutexes;
+};
+
+} // namespace sscl
+
+#endif // QUTEX_ARENA_H
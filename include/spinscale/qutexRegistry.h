@@ -0,0 +1,28 @@
+#ifndef QUTEX_REGISTRY_H
+#define QUTEX_REGISTRY_H
+
+#include <cstdint>
+
+namespace sscl {
+
+/**
+ * @brief QutexRegistry - Hands out dense ids to live Qutexes
+ *
+ * Every Qutex gets the lowest id not in use by another live Qutex, and gives
+ * it back when destroyed. Ids therefore stay small, and can index bitmaps
+ * such as LockSetSignature. Unlike RecordReplay's ordinals, they're reused,
+ * so they don't identify a Qutex across runs or over time.
+ */
+class QutexRegistry
+{
+public:
+	static uint32_t allocateId(void);
+	static void releaseId(uint32_t id);
+
+	// Number of live Qutexes, i.e: ids currently handed out.
+	static uint32_t getNIdsInUse(void);
+};
+
+} // namespace sscl
+
+#endif // QUTEX_REGISTRY_H
@@ -0,0 +1,227 @@
+#ifndef RECORD_REPLAY_H
+#define RECORD_REPLAY_H
+
+#include <config.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#ifndef CONFIG_ENABLE_RECORD_REPLAY
+#error "recordReplay.h requires the library to be built with ENABLE_RECORD_REPLAY"
+#endif
+
+namespace sscl {
+
+class ComponentThread;
+class Qutex;
+typedef uint8_t ThreadId;
+
+/**
+ * @brief RecordReplay - Records, and later enforces, the order in which
+ *	ComponentThreads receive posts and acquire Qutexes
+ *
+ * In RECORD mode, every post() made through ComponentThread::post(), every
+ * execution of such a post, and every LockSet acquisition is appended to a
+ * compact binary log. In REPLAY mode, a log recorded earlier is loaded and:
+ *	* Each post is held back until every post that preceded it into the same
+ *	  destination's queue has been made, so each thread runs its handlers in
+ *	  the recorded order.
+ *	* Each Qutex only admits its recorded sequence of acquiring
+ *	  continuations.
+ * Together these reproduce the recorded interleaving, e.g: a lock convoy, so
+ * that it can be run again and again under a profiler or debugger.
+ *
+ *	EXPLANATION:
+ * Events have to be matched up across runs without relying on timing, so
+ * they're identified causally: each post, and each
+ * SerializedAsynchronousContinuation, gets an id derived from the id of the
+ * handler that was running when it was created and how many posts and
+ * continuations that handler had already created. Lockvokers' own wakeup and
+ * retry posts depend on timing, so they're neither ordered nor counted; a
+ * lockvoker runs under its continuation's id instead.
+ *
+ * Not captured: handlers posted directly to an io_service (timers, I/O
+ * completions), and nondeterminism inside handlers (clocks, randomness,
+ * external input). Posts from outside ComponentThreads are reproducible only
+ * if they all come from one thread. If the replayed run stops following the
+ * log, i.e: the next recorded event hasn't happened within the divergence
+ * timeout, RecordReplay reports the divergence once on std::cerr and stops
+ * enforcing order, so the program runs on rather than hanging.
+ *
+ * Start recording or replaying before the threads start exchanging work, and
+ * stop after they're done.
+ */
+class RecordReplay
+{
+public:
+	enum class Mode : uint8_t { OFF, RECORD, REPLAY };
+
+	typedef uint64_t EventId;
+
+	// Logged as the thread of events that happen outside ComponentThreads.
+	static constexpr ThreadId externalThreadId = 0xFF;
+
+	/**	EXPLANATION:
+	 * The log file is a 16 byte header followed by an array of these. An
+	 * event's global sequence number is its index in the array.
+	 */
+	enum class EventType : uint8_t { POST = 1, EXEC, QUTEX_ACQUIRE };
+
+	struct Event
+	{
+		// POST/EXEC: the post. QUTEX_ACQUIRE: the acquiring continuation.
+		EventId id;
+		// QUTEX_ACQUIRE only.
+		uint32_t qutexOrdinal;
+		EventType type;
+		// POST: destination. EXEC: executing thread. QUTEX_ACQUIRE: acquirer.
+		ThreadId thread;
+		// POST only: the posting thread.
+		ThreadId sourceThread;
+		uint8_t reserved;
+	};
+	static_assert(sizeof(Event) == 16);
+
+	/**
+	 * @brief PostScope - Brackets the enqueueing of one post
+	 *
+	 * Constructed by ComponentThread::post() just before it enqueues the
+	 * handler, and destroyed just after.
+	 *
+	 *	EXPLANATION:
+	 * While replaying, a post that arrives before its turn mustn't block the
+	 * posting thread: the post it would be waiting for may well be queued on
+	 * that same thread, behind the handler that's waiting. So instead, the
+	 * poster hands the enqueueing over to defer(), and it's done by whichever
+	 * thread makes the post that precedes it.
+	 */
+	class PostScope
+	{
+	public:
+		PostScope(ComponentThread &destination, bool isOrdered)
+		:	destination(destination),
+		isActive(isOrdered && getMode() != Mode::OFF)
+		{
+			if (isActive) { begin(); }
+		}
+
+		~PostScope()
+		{
+			if (isActive) { end(); }
+		}
+
+		PostScope(const PostScope &) = delete;
+		PostScope &operator=(const PostScope &) = delete;
+
+		EventId getPostId(void) const { return postId; }
+
+		// True if the caller must defer() the enqueueing instead of doing it.
+		bool mustDefer(void) const { return isEarly; }
+		void defer(std::function<void()> enqueueFn);
+
+	private:
+		void begin(void);
+		void end(void);
+
+	private:
+		ComponentThread &destination;
+		const bool isActive;
+		bool isInTurn = false, isEarly = false;
+		EventId postId = 0;
+	};
+
+	/**
+	 * @brief HandlerScope - Makes a handler's id current while it runs, so
+	 *	that whatever it creates is identified relative to it
+	 */
+	class HandlerScope
+	{
+	public:
+		HandlerScope(ComponentThread &thread, EventId id, bool isOrdered)
+		:	isActive(getMode() != Mode::OFF)
+		{
+			if (isActive) { begin(thread, id, isOrdered); }
+		}
+
+		~HandlerScope()
+		{
+			if (isActive) { end(); }
+		}
+
+		HandlerScope(const HandlerScope &) = delete;
+		HandlerScope &operator=(const HandlerScope &) = delete;
+
+	private:
+		void begin(ComponentThread &thread, EventId id, bool isOrdered);
+		void end(void);
+
+	private:
+		const bool isActive;
+		EventId savedId = 0;
+		uint64_t savedNChildren = 0;
+	};
+
+public:
+	static void startRecording(const std::string &logPath);
+	static void stopRecording(void);
+
+	static void startReplay(
+		const std::string &logPath,
+		std::chrono::milliseconds divergenceTimeout
+			= std::chrono::milliseconds(2000));
+	static void stopReplay(void);
+
+	static Mode getMode(void)
+		{ return mode.load(std::memory_order_acquire); }
+	static bool hasDiverged(void);
+
+	// Id for a continuation being constructed by the current handler.
+	static EventId allocateContinuationId(void)
+		{ return getMode() == Mode::OFF ? 0 : allocateChildId(); }
+
+	/**	EXPLANATION:
+	 * While replaying, an unowned Qutex with a recorded acquirer still to come
+	 * is reserved for that acquirer: it's ADMITted even where the Qutex's
+	 * fairness rules would turn it away, since it got the Qutex in the
+	 * recording, and everyone else is REFUSEd. Otherwise the normal rules
+	 * apply.
+	 */
+	enum class QutexVerdict : uint8_t { UNCONSTRAINED, ADMIT, REFUSE };
+
+	/* Called with qutex.lock held. On REFUSE, expectedAcquirer is set to the
+	 * id of the continuation that the Qutex is reserved for.
+	 */
+	static QutexVerdict checkQutexAcquirer(
+		const Qutex &qutex, EventId acquirer, EventId &expectedAcquirer)
+	{
+		if (getMode() != Mode::REPLAY) { return QutexVerdict::UNCONSTRAINED; }
+		return replayCheckQutexAcquirer(qutex, acquirer, expectedAcquirer);
+	}
+
+	/* Called for each of a LockSet's Qutexes once the whole LockSet has been
+	 * acquired. Partial acquisitions that back off aren't logged.
+	 */
+	static void lockSetAcquired(const Qutex &qutex, EventId acquirer)
+	{
+		if (getMode() != Mode::OFF) { noteLockSetAcquired(qutex, acquirer); }
+	}
+
+	static uint32_t allocateQutexOrdinal(void)
+		{ return nextQutexOrdinal.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+	static EventId allocateChildId(void);
+	static QutexVerdict replayCheckQutexAcquirer(
+		const Qutex &qutex, EventId acquirer, EventId &expectedAcquirer);
+	static void noteLockSetAcquired(const Qutex &qutex, EventId acquirer);
+
+private:
+	static std::atomic<Mode> mode;
+	static std::atomic<uint32_t> nextQutexOrdinal;
+};
+
+} // namespace sscl
+
+#endif // RECORD_REPLAY_H
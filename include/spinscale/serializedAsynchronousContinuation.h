@@ -5,17 +5,45 @@
 #include <memory>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <optional>
+#include <source_location>
+#include <spinscale/cacheLine.h>
 #include <spinscale/componentThread.h>
 #include <spinscale/lockSet.h>
 #include <spinscale/asynchronousContinuation.h>
 #include <spinscale/lockerAndInvokerBase.h>
 #include <spinscale/callback.h>
 #include <spinscale/qutexAcquisitionHistoryTracker.h>
+#ifdef CONFIG_ENABLE_CONTINUATION_LATENCY_STATS
+#include <typeinfo>
+#include <spinscale/continuationLatency.h>
+#endif
 
 namespace sscl {
 
+/**
+ * @brief TwoPhaseStats - Timing for SerializedAsynchronousContinuation::
+ *	lockvokeTwoPhase()
+ *
+ * Usually one instance is shared by every request of a given kind. All times
+ * are in nanoseconds.
+ */
+struct TwoPhaseStats
+{
+	std::atomic<uint64_t> nPrepares{0}, nCommits{0}, nRevalidationFailures{0};
+	// Total time spent in prepare, including prepares that were redone.
+	std::atomic<uint64_t> prepareNs{0};
+	// Time spent in commit, i.e: with the LockSet held.
+	std::atomic<uint64_t> commitNs{0};
+	/* Time spent in the prepares that led to a successful commit: this is
+	 * hold time that would otherwise have been spent under the LockSet.
+	 */
+	std::atomic<uint64_t> holdTimeSavedNs{0};
+};
+
 template <class OriginalCbFnT>
 class SerializedAsynchronousContinuation
 :	public PostedAsynchronousContinuation<OriginalCbFnT>
@@ -32,11 +60,64 @@ public:
 	template<typename... Args>
 	void callOriginalCb(Args&&... args)
 	{
-		requiredLocks.release();
+		if (!completedOptimistically) { requiredLocks.release(); }
+#ifdef CONFIG_ENABLE_CONTINUATION_LATENCY_STATS
+		if (latency.hasBeenAcquired())
+		{
+			ContinuationLatencyRegistry::getInstance().record(
+				typeid(*this), latency, ContinuationLatency::Clock::now());
+		}
+#endif
 		PostedAsynchronousContinuation<OriginalCbFnT>::callOriginalCb(
 			std::forward<Args>(args)...);
 	}
 
+	/**
+	 * @brief Try to complete a read-only request without acquiring its locks.
+	 *
+	 * Usage:
+	 *	if (request->tryOptimisticRead([&]{ request->result = x.load(...); }))
+	 *		{ request->callOriginalCb(request->result); return; }
+	 *	// Otherwise lockvoke as usual.
+	 *
+	 * See LockSet::tryOptimisticRead() for the constraints on readFn. On
+	 * success, callOriginalCb() knows not to release() the LockSet, and the
+	 * continuation must not be lockvoked afterwards.
+	 */
+	template <class ReadFnT>
+	bool tryOptimisticRead(ReadFnT &&readFn, unsigned int nAttempts = 3)
+	{
+		if (!requiredLocks.tryOptimisticRead(
+			std::forward<ReadFnT>(readFn), nAttempts))
+			{ return false; }
+
+		completedOptimistically = true;
+		return true;
+	}
+
+	/**
+	 * @brief Lockvoke in two phases: prepare without the LockSet, then commit
+	 *	with it.
+	 * @param target The ComponentThread to run both phases on.
+	 * @param prepare Does the expensive work (parsing, allocation,
+	 *	computation) that doesn't need the locks, stashing its results in the
+	 *	continuation.
+	 * @param commit Applies the prepared results; runs with the LockSet held.
+	 *	As with any lockvoked target, it (or a later segment) must
+	 *	eventually call callOriginalCb().
+	 * @param revalidate Optional. Runs with the LockSet held, just before
+	 *	commit. If it returns false, whatever prepare depended on changed
+	 *	before the locks were acquired: the LockSet is released, and prepare
+	 *	and acquisition are redone.
+	 * @param stats Optional.
+	 */
+	void lockvokeTwoPhase(
+		const std::shared_ptr<ComponentThread> &target,
+		std::function<void()> prepare,
+		std::function<void()> commit,
+		std::function<bool()> revalidate = nullptr,
+		TwoPhaseStats *stats = nullptr);
+
 	// Return list of all qutexes in predecessors' LockSets; excludes self.
 	[[nodiscard]]
 	std::unique_ptr<std::forward_list<std::reference_wrapper<Qutex>>>
@@ -49,9 +130,72 @@ public:
 	void releaseQutexEarly(Qutex &qutex)
 		{ requiredLocks.releaseQutexEarly(qutex); }
 
+	bool holdsQutex(const Qutex &qutex) const override
+		{ return requiredLocks.isHolding(qutex); }
+	bool tryLendQutex(
+		const Qutex &qutex,
+		const std::shared_ptr<LockerAndInvokerBase> &waiter) override
+		{ return requiredLocks.tryLend(qutex, waiter); }
+	void returnLentQutex(const Qutex &qutex) override
+		{ requiredLocks.returnLent(qutex); }
+
+	typedef std::function<void(bool keptLocks)> extendLockSetCbFn;
+
+	/**
+	 * @brief Grow the held LockSet by extraQutexes, e.g: once the critical
+	 *	section has worked out which other objects it needs.
+	 * @param target The ComponentThread to run onExtended on.
+	 * @param onExtended Runs once the whole, larger LockSet is held.
+	 *	keptLocks is false if the LockSet had to be released in between (see
+	 *	LockSet::extend()), in which case anything read under the old LockSet
+	 *	must be re-read.
+	 */
+	void extendLockSetReq(
+		const std::shared_ptr<ComponentThread> &target,
+		const typename LockSet<OriginalCbFnT>::Set &extraQutexes,
+		extendLockSetCbFn onExtended);
+
+	/**
+	 * @brief Release a qutex and remove it from the LockSet; see
+	 *	LockSet::dropQutex().
+	 */
+	void dropQutex(Qutex &qutex)
+		{ requiredLocks.dropQutex(qutex); }
+
+	/**
+	 * @brief Also require `cost` tokens from limiter before the lockvoked
+	 *	target runs. Call before lockvoking.
+	 */
+	void addRateLimiter(AsyncRateLimiter &limiter, double cost = 1)
+		{ requiredLocks.addRateLimiter(limiter, cost); }
+
 public:
 	LockSet<OriginalCbFnT> requiredLocks;
-	std::atomic<bool> isAwakeOrBeingAwakened{false};
+	bool completedOptimistically = false;
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+	// Identifies this continuation's Qutex acquisitions across runs.
+	const RecordReplay::EventId recordReplayId
+		= RecordReplay::allocateContinuationId();
+#endif
+#ifdef CONFIG_ENABLE_CONTINUATION_LATENCY_STATS
+	ContinuationLatency latency;
+#endif
+	/**	EXPLANATION:
+	 * Whether a copy of this continuation's lockvoker is currently queued on
+	 * (or running on) its target's io_service. AWAKE_WAKEUP_PENDING means
+	 * someone tried to awaken it while it was already awake.
+	 *
+	 * This is CASed by whichever thread releases or backs off a Qutex we're
+	 * queued on, while those same threads read requiredLocks to decide
+	 * whether to wake us. It gets a cache line to itself so the CASes don't
+	 * keep invalidating the line that requiredLocks (and members of derived
+	 * continuations) live on.
+	 */
+	enum AwakeState : uint8_t { ASLEEP, AWAKE, AWAKE_WAKEUP_PENDING };
+	alignas(cacheLineSize) std::atomic<uint8_t> awakeState{ASLEEP};
+private:
+	char awakeStatePadding[cacheLineSize - sizeof(std::atomic<uint8_t>)];
+public:
 
 	/**
 	 * @brief LockerAndInvoker - Template class for lockvoking mechanism
@@ -71,18 +215,23 @@ public:
 		 *	containing LockSet and target io_service
 		 * @param target The ComponentThread whose io_service to post to
 		 * @param invocationTarget The std::bind result to invoke when locks are acquired
+		 * @param callsite Where the lockvoker was created; reported by
+		 *	ComponentThread::post() instrumentation on each wakeup.
 		 */
 		LockerAndInvoker(
 			SerializedAsynchronousContinuation<OriginalCbFnT>
 				&serializedContinuation,
 			const std::shared_ptr<ComponentThread>& target,
-			InvocationTargetT invocationTarget)
+			InvocationTargetT invocationTarget,
+			const std::source_location &callsite
+				= std::source_location::current())
 		:	LockerAndInvokerBase(&serializedContinuation),
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
 		creationTimestamp(std::chrono::steady_clock::now()),
 #endif
 		serializedContinuation(serializedContinuation),
 		target(target),
+		callsite(callsite),
 		invocationTarget(std::move(invocationTarget))
 		{
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
@@ -124,13 +273,35 @@ public:
 		 */
 		void awaken(bool forceAwaken = false) override
 		{
-			bool prevVal = serializedContinuation.isAwakeOrBeingAwakened
-				.exchange(true);
+			auto &state = serializedContinuation.awakeState;
+			uint8_t prevVal = state.load();
 
-			if (prevVal == true && !forceAwaken)
-				{ return; }
+			for (;;)
+			{
+				if (prevVal == ASLEEP || forceAwaken)
+				{
+					if (!state.compare_exchange_weak(prevVal, AWAKE))
+						{ continue; }
 
-			target->getIoService().post(*this);
+#ifdef CONFIG_ENABLE_CONTINUATION_LATENCY_STATS
+					serializedContinuation.latency.notePosted();
+#endif
+					target->post(*this, &serializedContinuation, callsite);
+					return;
+				}
+
+				/**	EXPLANATION:
+				 * We're already awake, and may be part way through a failed
+				 * acquisition attempt which started before whatever is waking
+				 * us now changed the state of the Qutex. Leave a note so the
+				 * attempt is retried rather than going back to sleep; see
+				 * allowAwakening().
+				 */
+				if (prevVal == AWAKE_WAKEUP_PENDING
+					|| state.compare_exchange_weak(
+						prevVal, AWAKE_WAKEUP_PENDING))
+					{ return; }
+			}
 		}
 
 		size_t getLockSetSize() const override
@@ -142,10 +313,36 @@ public:
 				.qutex.get();
 		}
 
+		ComponentThread *getTargetThread() const override
+			{ return target.get(); }
+
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+		RecordReplay::EventId getRecordReplayId() const override
+			{ return serializedContinuation.recordReplayId; }
+#endif
+
 	private:
-		// Allow awakening by resetting the awake flag
-		void allowAwakening()
-			{ serializedContinuation.isAwakeOrBeingAwakened.store(false); }
+		/**
+		 * @brief Go back to sleep after a failed acquisition attempt, unless
+		 *	someone tried to awaken us during the attempt.
+		 * @return true if the attempt must be retried.
+		 *
+		 *	EXPLANATION:
+		 * If a Qutex we failed on was released between our failed
+		 * tryAcquire() and now, its awaken() of us found us AWAKE and did
+		 * nothing. If we just went to sleep, nobody would ever wake us.
+		 */
+		bool allowAwakening()
+		{
+			auto &state = serializedContinuation.awakeState;
+			uint8_t expected = AWAKE;
+
+			if (state.compare_exchange_strong(expected, ASLEEP))
+				{ return false; }
+
+			state.store(AWAKE);
+			return true;
+		}
 
 		/**	EXPLANATION:
 		 * We create a copy of the Lockvoker and then give sh_ptrs to that
@@ -175,13 +372,13 @@ public:
 		/**
 		 * @brief First wake - register in queues and awaken
 		 * 
-		 * Sets isAwake=true before calling awaken with forceAwaken to ensure
+		 * Sets awakeState=AWAKE before calling awaken with forceAwaken to ensure
 		 * that none of the locks we just registered with awaken()s a duplicate
 		 * copy of this lockvoker on the io_service.
 		 */
 		void firstWake()
 		{
-			serializedContinuation.isAwakeOrBeingAwakened.store(true);
+			serializedContinuation.awakeState.store(AWAKE);
 			registerInLockSet();
 			// Force awaken since we just set the flag above
 			awaken(true);
@@ -259,10 +456,134 @@ public:
 		SerializedAsynchronousContinuation<OriginalCbFnT>
 			&serializedContinuation;
 		std::shared_ptr<ComponentThread> target;
+		std::source_location callsite;
 		InvocationTargetT invocationTarget;
 	};
+
+private:
+	struct TwoPhaseOp;
+
+	static void lockvokeTwoPhaseReq1_posted(std::shared_ptr<TwoPhaseOp> op);
+	static void lockvokeTwoPhaseReq2_locked(std::shared_ptr<TwoPhaseOp> op);
+};
+
+/******************************************************************************/
+
+template <class OriginalCbFnT>
+struct SerializedAsynchronousContinuation<OriginalCbFnT>::TwoPhaseOp
+{
+	std::shared_ptr<SerializedAsynchronousContinuation<OriginalCbFnT>> contin;
+	std::shared_ptr<ComponentThread> target;
+	std::function<void()> prepare, commit;
+	std::function<bool()> revalidate;
+	TwoPhaseStats *stats;
+	uint64_t lastPrepareNs;
 };
 
+template <class OriginalCbFnT>
+void SerializedAsynchronousContinuation<OriginalCbFnT>::lockvokeTwoPhase(
+	const std::shared_ptr<ComponentThread> &target,
+	std::function<void()> prepare,
+	std::function<void()> commit,
+	std::function<bool()> revalidate,
+	TwoPhaseStats *stats
+	)
+{
+	auto op = std::make_shared<TwoPhaseOp>(TwoPhaseOp{
+		std::static_pointer_cast<
+			SerializedAsynchronousContinuation<OriginalCbFnT>>(
+				this->shared_from_this()),
+		target, std::move(prepare), std::move(commit), std::move(revalidate),
+		stats, 0});
+
+	target->post(
+		STC(std::bind(&lockvokeTwoPhaseReq1_posted, op)), this);
+}
+
+template <class OriginalCbFnT>
+void SerializedAsynchronousContinuation<OriginalCbFnT>::extendLockSetReq(
+	const std::shared_ptr<ComponentThread> &target,
+	const typename LockSet<OriginalCbFnT>::Set &extraQutexes,
+	extendLockSetCbFn onExtended
+	)
+{
+	typedef typename LockSet<OriginalCbFnT>::ExtendResult ExtendResult;
+
+	const ExtendResult result = requiredLocks.extend(extraQutexes);
+
+	if (result == ExtendResult::ALREADY_HELD)
+	{
+		target->post(STC(std::bind(std::move(onExtended), true)), this);
+		return;
+	}
+
+	LockerAndInvoker<std::function<void()>>(
+		*this, target,
+		std::bind(std::move(onExtended), result == ExtendResult::EXTENDING));
+}
+
+template <class OriginalCbFnT>
+void SerializedAsynchronousContinuation<OriginalCbFnT>
+::lockvokeTwoPhaseReq1_posted(std::shared_ptr<TwoPhaseOp> op)
+{
+	auto start = std::chrono::steady_clock::now();
+	op->prepare();
+	op->lastPrepareNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+
+	if (op->stats != nullptr)
+	{
+		op->stats->nPrepares.fetch_add(1, std::memory_order_relaxed);
+		op->stats->prepareNs.fetch_add(
+			op->lastPrepareNs, std::memory_order_relaxed);
+	}
+
+	LockerAndInvoker<std::function<void()>>(
+		*op->contin, op->target,
+		std::bind(&lockvokeTwoPhaseReq2_locked, op));
+}
+
+template <class OriginalCbFnT>
+void SerializedAsynchronousContinuation<OriginalCbFnT>
+::lockvokeTwoPhaseReq2_locked(std::shared_ptr<TwoPhaseOp> op)
+{
+	if (op->revalidate && !op->revalidate())
+	{
+		if (op->stats != nullptr)
+		{
+			op->stats->nRevalidationFailures.fetch_add(
+				1, std::memory_order_relaxed);
+		}
+
+		/**	EXPLANATION:
+		 * Drop the locks before redoing prepare, otherwise we'd be doing
+		 * exactly what two-phase lockvoking is meant to avoid. The LockSet
+		 * can be re-registered by a fresh lockvoker once it's released.
+		 */
+		op->contin->requiredLocks.release();
+		lockvokeTwoPhaseReq1_posted(std::move(op));
+		return;
+	}
+
+	if (op->stats != nullptr)
+	{
+		op->stats->holdTimeSavedNs.fetch_add(
+			op->lastPrepareNs, std::memory_order_relaxed);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	op->commit();
+
+	if (op->stats != nullptr)
+	{
+		op->stats->nCommits.fetch_add(1, std::memory_order_relaxed);
+		op->stats->commitNs.fetch_add(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count(),
+			std::memory_order_relaxed);
+	}
+}
+
 /******************************************************************************/
 
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
@@ -327,6 +648,9 @@ SerializedAsynchronousContinuation<OriginalCbFnT>
 		currContin != nullptr;
 		currContin = currContin->getCallersContinuationShPtr())
 	{
+		// We'll inherit it rather than wait for it; see LockSet.
+		if (currContin->holdsQutex(firstFailedQutex)) { return false; }
+
 		auto serializedCont = std::dynamic_pointer_cast<
 			SerializedAsynchronousContinuation<OriginalCbFnT>>(currContin);
 
@@ -472,6 +796,10 @@ void SerializedAsynchronousContinuation<OriginalCbFnT>
 			"executing on wrong ComponentThread");
 	}
 
+#ifdef CONFIG_ENABLE_CONTINUATION_LATENCY_STATS
+	serializedContinuation.latency.noteWokenUp();
+#endif
+
 	std::optional<std::reference_wrapper<Qutex>> firstFailedQutexRet;
 	bool deadlockLikely = isDeadlockLikely();
 	bool gridlockLikely = isGridlockLikely();
@@ -479,12 +807,28 @@ void SerializedAsynchronousContinuation<OriginalCbFnT>
 	if (!serializedContinuation.requiredLocks.tryAcquireOrBackOff(
 		*this, firstFailedQutexRet))
 	{
+#ifdef CONFIG_ENABLE_CONTINUATION_LATENCY_STATS
+		/* Before allowAwakening(): once we're ASLEEP, another thread may
+		 * awaken us and note a post.
+		 */
+		serializedContinuation.latency.noteFailedAttempt();
+#endif
+
 		// Just allow this lockvoker to be dropped from its io_service.
-		allowAwakening();
+		if (allowAwakening())
+		{
+#ifdef CONFIG_ENABLE_CONTINUATION_LATENCY_STATS
+			serializedContinuation.latency.notePosted();
+#endif
+			target->post(*this, &serializedContinuation, callsite);
+		}
 		if (!deadlockLikely && !gridlockLikely)
 			{ return; }
 
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
+		// Throttled by an AsyncRateLimiter: waiting, but not on a Qutex.
+		if (!firstFailedQutexRet.has_value()) { return; }
+
 		Qutex	&firstFailedQutex = firstFailedQutexRet.value().get();
 		bool isDeadlock = traceContinuationHistoryForDeadlockOn(
 			firstFailedQutex);
@@ -551,6 +895,10 @@ void SerializedAsynchronousContinuation<OriginalCbFnT>
 	 */
 	serializedContinuation.requiredLocks.unregisterFromQutexQueues();
 
+#ifdef CONFIG_ENABLE_CONTINUATION_LATENCY_STATS
+	serializedContinuation.latency.noteAcquired();
+#endif
+
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
 	/**	EXPLANATION:
 	 * If we were being tracked for gridlock detection but successfully
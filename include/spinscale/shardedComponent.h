@@ -0,0 +1,666 @@
+#ifndef SHARDED_COMPONENT_H
+#define SHARDED_COMPONENT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <spinscale/callback.h>
+#include <spinscale/callableTracer.h>
+#include <spinscale/componentThread.h>
+#include <spinscale/qutex.h>
+#include <spinscale/serializedAsynchronousContinuation.h>
+
+namespace sscl {
+
+/**
+ * @brief ShardedComponent - Shared-nothing, key-routed state
+ *
+ * Keys are hashed into a fixed number of virtual buckets, and each bucket is
+ * owned by exactly one of the component's threads (its shard). post(key, ...)
+ * runs the handler on the owning thread, so state that's only touched by a
+ * key's handlers needs no locking at all. Handlers for the same key run
+ * serially, in post order.
+ *
+ * Each shard also has a Qutex. These are never acquired on the single-key
+ * path: they serialize the operations that span shards, i.e:
+ *	* crossShardReq(): runs an operation with every shard that owns one of
+ *	  its keys frozen. While a shard is frozen, its thread defers all of
+ *	  that shard's routed handlers until the operation is done.
+ *	* migrateBucketReq(): moves a bucket to another shard online, without
+ *	  reordering the handlers of any key in the bucket.
+ *
+ * Per-bucket load counters can be used to find hot buckets, and
+ * rebalanceReq() moves the hottest buckets off of the busiest shard.
+ *
+ * Compared with striping a table over a set of Qutexes, the single-key path
+ * costs one post() and a couple of uncontended atomics, and never queues
+ * behind other keys' critical sections.
+ */
+template <class K, class Hash = std::hash<K>>
+class ShardedComponent
+:	public std::enable_shared_from_this<ShardedComponent<K, Hash>>
+{
+public:
+	typedef std::function<void()> handlerFn;
+	typedef std::function<void()> shardOpCbFn;
+
+	/**
+	 * @param threads The shards' threads; shard i is owned by threads[i].
+	 * @param nBuckets Number of virtual buckets. Buckets, not keys, are the
+	 *	unit of migration, so this should comfortably exceed the number of
+	 *	threads.
+	 */
+	ShardedComponent(
+		const std::vector<std::shared_ptr<ComponentThread>> &threads,
+		size_t nBuckets = 1024, Hash hash = Hash())
+	:	threads(threads), nBuckets(nBuckets), hash(std::move(hash)),
+	buckets(std::make_unique<Bucket[]>(nBuckets))
+	{
+		if (threads.empty() || threads.size() > UINT16_MAX || nBuckets == 0)
+		{
+			throw std::invalid_argument(std::string(__func__)
+				+ ": Need between 1 and 65535 threads and at least 1 bucket");
+		}
+
+		shards.reserve(threads.size());
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			shards.push_back(std::make_unique<Shard>(
+				"shard" + std::to_string(i)));
+		}
+
+		for (size_t i = 0; i < nBuckets; i++)
+		{
+			buckets[i].owner.store(
+				static_cast<uint16_t>(i % threads.size()),
+				std::memory_order_relaxed);
+		}
+	}
+
+	size_t getNShards(void) const { return threads.size(); }
+	size_t getNBuckets(void) const { return nBuckets; }
+	size_t getBucket(const K &key) const { return hash(key) % nBuckets; }
+	size_t getShardForBucket(size_t bucket) const
+		{ return buckets[bucket].owner.load(std::memory_order_acquire); }
+	size_t getShard(const K &key) const
+		{ return getShardForBucket(getBucket(key)); }
+
+	/**
+	 * @brief Run handler on the thread that owns key. May be called from any
+	 *	thread.
+	 */
+	void post(const K &key, handlerFn handler)
+	{
+		const size_t bucketIdx = getBucket(key);
+		Bucket &bucket = buckets[bucketIdx];
+
+		bucket.load.fetch_add(1, std::memory_order_relaxed);
+
+		/**	EXPLANATION:
+		 * Routers register in flight under the bucket's current router
+		 * generation, which migrateBucketReq2_onOldOwner() bumps right after
+		 * its seq_cst store of the new owner. Either we see the new owner, or
+		 * we registered under the old generation and the migration waits for
+		 * our post() to land on the old owner's queue before it starts the
+		 * handoff. Otherwise a handler could reach the old owner after the
+		 * handoff and be forwarded behind a later handler for the same key.
+		 *
+		 * The migration only waits for the old generation's routers, so a
+		 * steady stream of new ones to a hot bucket can't hold it up. If the
+		 * generation moves between our load and our increment, we may have
+		 * registered under a generation nobody will wait for: retry.
+		 */
+		uint32_t generation = bucket.routerGeneration.load(
+			std::memory_order_seq_cst);
+		for (;;)
+		{
+			bucket.nRoutersInFlight[generation & 1].fetch_add(
+				1, std::memory_order_seq_cst);
+
+			const uint32_t current = bucket.routerGeneration.load(
+				std::memory_order_seq_cst);
+			if (current == generation) { break; }
+
+			bucket.nRoutersInFlight[generation & 1].fetch_sub(
+				1, std::memory_order_release);
+			generation = current;
+		}
+
+		const size_t shard = bucket.owner.load(std::memory_order_seq_cst);
+
+		threads[shard]->post(
+			STC(std::bind(
+				&ShardedComponent::runOnShard, this->shared_from_this(),
+				shard, bucketIdx, std::move(handler), false)));
+
+		bucket.nRoutersInFlight[generation & 1].fetch_sub(
+			1, std::memory_order_release);
+	}
+
+	/**
+	 * @brief The Qutexes of the shards which currently own keys, in a
+	 *	consistent order. For building LockSets by hand; crossShardReq() is
+	 *	usually what you want.
+	 */
+	std::vector<std::reference_wrapper<Qutex>> getQutexesForKeys(
+		const std::vector<K> &keys) const
+	{
+		std::vector<std::reference_wrapper<Qutex>> ret;
+		for (size_t shard : getShardsForKeys(keys)) {
+			ret.push_back(shards[shard]->qutex);
+		}
+
+		return ret;
+	}
+
+	/**
+	 * @brief Run op with exclusive access to the state of every key in keys.
+	 *
+	 * op runs on the calling ComponentThread, after every shard that owns one
+	 * of keys has been frozen. It must not block waiting on those shards'
+	 * handlers. callback is posted back to the calling thread afterwards.
+	 */
+	void crossShardReq(
+		const std::vector<K> &keys, std::function<void()> op,
+		Callback<shardOpCbFn> callback);
+
+	/**
+	 * @brief Move bucket to newShard without dropping or reordering any of
+	 *	its handlers.
+	 */
+	void migrateBucketReq(
+		size_t bucket, size_t newShard, Callback<shardOpCbFn> callback);
+
+	/**
+	 * @brief Migrate up to maxMoves of the hottest buckets from the busiest
+	 *	shard to the least busy one, based on the load counted since the last
+	 *	resetLoadCounters().
+	 */
+	void rebalanceReq(unsigned int maxMoves, Callback<shardOpCbFn> callback);
+
+	uint64_t getBucketLoad(size_t bucket) const
+		{ return buckets[bucket].load.load(std::memory_order_relaxed); }
+
+	std::vector<uint64_t> getShardLoads(void) const
+	{
+		std::vector<uint64_t> loads(threads.size(), 0);
+		for (size_t i = 0; i < nBuckets; i++) {
+			loads[getShardForBucket(i)] += getBucketLoad(i);
+		}
+
+		return loads;
+	}
+
+	void resetLoadCounters(void)
+	{
+		for (size_t i = 0; i < nBuckets; i++) {
+			buckets[i].load.store(0, std::memory_order_relaxed);
+		}
+	}
+
+private:
+	struct Bucket
+	{
+		std::atomic<uint16_t> owner{0};
+		// Set by the old owner while it hands the bucket off to a new owner.
+		std::atomic<bool> inHandoff{false};
+		// Bumped by every migration; see post().
+		std::atomic<uint32_t> routerGeneration{0};
+		// Indexed by the parity of the generation the routers registered in.
+		std::atomic<uint32_t> nRoutersInFlight[2]{0, 0};
+		std::atomic<uint64_t> load{0};
+		/* Only touched by the new owner's thread during a handoff: handlers
+		 * routed straight to the new owner, which must wait for those that
+		 * are still being forwarded from the old owner.
+		 */
+		std::vector<handlerFn> handoffDeferred;
+	};
+
+	struct Shard
+	{
+		explicit Shard(const std::string &name) : qutex(name) {}
+
+		Qutex qutex;
+		// Only touched by the shard's own thread.
+		bool frozen = false;
+		std::vector<handlerFn> frozenDeferred;
+	};
+
+	class ShardOp;
+
+	std::vector<size_t> getShardsForKeys(const std::vector<K> &keys) const
+	{
+		std::vector<size_t> ret;
+		for (const K &key : keys) { ret.push_back(getShard(key)); }
+
+		std::sort(ret.begin(), ret.end());
+		ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+		return ret;
+	}
+
+	std::vector<std::reference_wrapper<Qutex>> getQutexesForShards(
+		const std::vector<size_t> &shardIdxs) const
+	{
+		std::vector<std::reference_wrapper<Qutex>> ret;
+		for (size_t shard : shardIdxs) {
+			ret.push_back(shards[shard]->qutex);
+		}
+
+		return ret;
+	}
+
+	void runOnShard(
+		size_t shard, size_t bucketIdx, handlerFn handler, bool forwarded);
+
+	void freezeShards(const std::shared_ptr<ShardOp> &op);
+	void unfreezeShards(const std::vector<size_t> &shardIdxs);
+	void freezeShardReq1_posted(std::shared_ptr<ShardOp> op, size_t shard);
+	void unfreezeShardReq1_posted(size_t shard);
+
+	void crossShardReq1_locked(std::shared_ptr<ShardOp> op);
+	void crossShardReq2_frozen(std::shared_ptr<ShardOp> op);
+
+	void migrateBucketReq1_locked(std::shared_ptr<ShardOp> op);
+	void migrateBucketReq2_onOldOwner(std::shared_ptr<ShardOp> op);
+	void migrateBucketReq3_oldOwnerDrained(std::shared_ptr<ShardOp> op);
+	void migrateBucketReq4_onNewOwner(std::shared_ptr<ShardOp> op);
+
+private:
+	std::vector<std::shared_ptr<ComponentThread>> threads;
+	const size_t nBuckets;
+	Hash hash;
+	std::unique_ptr<Bucket[]> buckets;
+	std::vector<std::unique_ptr<Shard>> shards;
+};
+
+/******************************************************************************/
+
+template <class K, class Hash>
+class ShardedComponent<K, Hash>::ShardOp
+:	public SerializedAsynchronousContinuation<shardOpCbFn>
+{
+public:
+	ShardOp(
+		const std::shared_ptr<ComponentThread> &caller,
+		Callback<shardOpCbFn> callback,
+		std::vector<size_t> lockedShards,
+		std::vector<std::reference_wrapper<Qutex>> requiredLocks)
+	:	SerializedAsynchronousContinuation<shardOpCbFn>(
+			caller, callback, std::move(requiredLocks)),
+	lockedShards(std::move(lockedShards)),
+	nPendingFreezeAcks(0), bucket(0), oldShard(0), newShard(0),
+	routerGeneration(0)
+	{}
+
+public:
+	std::vector<size_t> lockedShards;
+	std::atomic<unsigned int> nPendingFreezeAcks;
+
+	// crossShardReq.
+	std::vector<K> keys;
+	std::function<void()> op;
+
+	// migrateBucketReq.
+	size_t bucket, oldShard, newShard;
+	// The generation whose routers the handoff waits for.
+	uint32_t routerGeneration;
+};
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::runOnShard(
+	size_t shard, size_t bucketIdx, handlerFn handler, bool forwarded
+	)
+{
+	Bucket &bucket = buckets[bucketIdx];
+	Shard &self = *shards[shard];
+
+	const size_t owner = bucket.owner.load(std::memory_order_acquire);
+	if (owner != shard)
+	{
+		// The bucket was migrated away after this handler was routed.
+		threads[owner]->post(
+			STC(std::bind(
+				&ShardedComponent::runOnShard, this->shared_from_this(),
+				owner, bucketIdx, std::move(handler), true)));
+		return;
+	}
+
+	if (self.frozen)
+	{
+		self.frozenDeferred.push_back(
+			std::bind(
+				&ShardedComponent::runOnShard, this->shared_from_this(),
+				shard, bucketIdx, std::move(handler), forwarded));
+		return;
+	}
+
+	/* Forwarded handlers were routed before the bucket changed hands, so they
+	 * go ahead of anything routed to us directly since.
+	 */
+	if (!forwarded && bucket.inHandoff.load(std::memory_order_acquire))
+	{
+		bucket.handoffDeferred.push_back(std::move(handler));
+		return;
+	}
+
+	handler();
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::freezeShards(const std::shared_ptr<ShardOp> &op)
+{
+	op->nPendingFreezeAcks.store(
+		static_cast<unsigned int>(op->lockedShards.size()));
+
+	for (size_t shard : op->lockedShards)
+	{
+		threads[shard]->post(
+			STC(std::bind(
+				&ShardedComponent::freezeShardReq1_posted,
+				this->shared_from_this(), op, shard)),
+			op.get());
+	}
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::freezeShardReq1_posted(
+	std::shared_ptr<ShardOp> op, size_t shard
+	)
+{
+	shards[shard]->frozen = true;
+
+	if (op->nPendingFreezeAcks.fetch_sub(1) != 1) { return; }
+
+	op->caller->post(
+		STC(std::bind(
+			&ShardedComponent::crossShardReq2_frozen,
+			this->shared_from_this(), op)),
+		op.get());
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::unfreezeShards(
+	const std::vector<size_t> &shardIdxs
+	)
+{
+	for (size_t shard : shardIdxs)
+	{
+		threads[shard]->post(
+			STC(std::bind(
+				&ShardedComponent::unfreezeShardReq1_posted,
+				this->shared_from_this(), shard)));
+	}
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::unfreezeShardReq1_posted(size_t shard)
+{
+	Shard &self = *shards[shard];
+	self.frozen = false;
+
+	std::vector<handlerFn> deferred;
+	deferred.swap(self.frozenDeferred);
+	for (auto &handler : deferred) { handler(); }
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::crossShardReq(
+	const std::vector<K> &keys, std::function<void()> op,
+	Callback<shardOpCbFn> callback
+	)
+{
+	const std::shared_ptr<ComponentThread> caller = ComponentThread::getSelf();
+	std::vector<size_t> shardIdxs = getShardsForKeys(keys);
+
+	auto request = std::make_shared<ShardOp>(
+		caller, std::move(callback), shardIdxs,
+		getQutexesForShards(shardIdxs));
+	request->keys = keys;
+	request->op = std::move(op);
+
+	typename ShardOp::template LockerAndInvoker<std::function<void()>>(
+		*request, caller,
+		std::bind(
+			&ShardedComponent::crossShardReq1_locked,
+			this->shared_from_this(), request));
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::crossShardReq1_locked(
+	std::shared_ptr<ShardOp> op
+	)
+{
+	/**	EXPLANATION:
+	 * A migration may have moved one of our keys to a shard we don't hold
+	 * between our computing the LockSet and acquiring it. Migrations hold the
+	 * Qutexes of both shards involved, so once we hold ours, the mapping of
+	 * our keys can only have changed in ways that are visible now. If it
+	 * has, start over with the new mapping.
+	 */
+	if (getShardsForKeys(op->keys) != op->lockedShards)
+	{
+		op->requiredLocks.release();
+		crossShardReq(
+			op->keys, std::move(op->op), std::move(op->originalCallback));
+		return;
+	}
+
+	if (op->lockedShards.empty())
+	{
+		crossShardReq2_frozen(std::move(op));
+		return;
+	}
+
+	freezeShards(op);
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::crossShardReq2_frozen(
+	std::shared_ptr<ShardOp> op
+	)
+{
+	if (op->op) { op->op(); }
+
+	unfreezeShards(op->lockedShards);
+	op->callOriginalCb();
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::migrateBucketReq(
+	size_t bucket, size_t newShard, Callback<shardOpCbFn> callback
+	)
+{
+	if (bucket >= nBuckets || newShard >= threads.size())
+	{
+		throw std::out_of_range(std::string(__func__)
+			+ ": Bucket or shard index out of range");
+	}
+
+	const std::shared_ptr<ComponentThread> caller = ComponentThread::getSelf();
+	const size_t oldShard = getShardForBucket(bucket);
+
+	std::vector<size_t> shardIdxs{oldShard};
+	if (newShard != oldShard) { shardIdxs.push_back(newShard); }
+	std::sort(shardIdxs.begin(), shardIdxs.end());
+
+	auto request = std::make_shared<ShardOp>(
+		caller, std::move(callback), shardIdxs,
+		getQutexesForShards(shardIdxs));
+	request->bucket = bucket;
+	request->oldShard = oldShard;
+	request->newShard = newShard;
+
+	typename ShardOp::template LockerAndInvoker<std::function<void()>>(
+		*request, caller,
+		std::bind(
+			&ShardedComponent::migrateBucketReq1_locked,
+			this->shared_from_this(), request));
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::migrateBucketReq1_locked(
+	std::shared_ptr<ShardOp> op
+	)
+{
+	const size_t currentOwner = getShardForBucket(op->bucket);
+
+	if (currentOwner == op->newShard)
+	{
+		op->callOriginalCb();
+		return;
+	}
+
+	// Someone else migrated the bucket before we got the locks; start over.
+	if (currentOwner != op->oldShard)
+	{
+		op->requiredLocks.release();
+		migrateBucketReq(
+			op->bucket, op->newShard, std::move(op->originalCallback));
+		return;
+	}
+
+	threads[op->oldShard]->post(
+		STC(std::bind(
+			&ShardedComponent::migrateBucketReq2_onOldOwner,
+			this->shared_from_this(), op)),
+		op.get());
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::migrateBucketReq2_onOldOwner(
+	std::shared_ptr<ShardOp> op
+	)
+{
+	Bucket &bucket = buckets[op->bucket];
+
+	if (bucket.owner.load(std::memory_order_relaxed) == op->oldShard)
+	{
+		bucket.inHandoff.store(true, std::memory_order_release);
+		bucket.owner.store(
+			static_cast<uint16_t>(op->newShard), std::memory_order_seq_cst);
+		op->routerGeneration = bucket.routerGeneration.fetch_add(
+			1, std::memory_order_seq_cst);
+	}
+
+	/* Wait out any router that may have read the old owner before our store,
+	 * so that its handler is in our queue ahead of the drain marker. Routers
+	 * that registered since only ever see the new owner. See post().
+	 */
+	if (bucket.nRoutersInFlight[op->routerGeneration & 1].load(
+		std::memory_order_seq_cst) != 0)
+	{
+		threads[op->oldShard]->post(
+			STC(std::bind(
+				&ShardedComponent::migrateBucketReq2_onOldOwner,
+				this->shared_from_this(), op)),
+			op.get());
+		return;
+	}
+
+	threads[op->oldShard]->post(
+		STC(std::bind(
+			&ShardedComponent::migrateBucketReq3_oldOwnerDrained,
+			this->shared_from_this(), op)),
+		op.get());
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::migrateBucketReq3_oldOwnerDrained(
+	std::shared_ptr<ShardOp> op
+	)
+{
+	/* Every stale handler for the bucket has now run through runOnShard() on
+	 * this thread and been forwarded to the new owner, ahead of this post.
+	 */
+	threads[op->newShard]->post(
+		STC(std::bind(
+			&ShardedComponent::migrateBucketReq4_onNewOwner,
+			this->shared_from_this(), op)),
+		op.get());
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::migrateBucketReq4_onNewOwner(
+	std::shared_ptr<ShardOp> op
+	)
+{
+	Bucket &bucket = buckets[op->bucket];
+	bucket.inHandoff.store(false, std::memory_order_release);
+
+	std::vector<handlerFn> deferred;
+	deferred.swap(bucket.handoffDeferred);
+	for (auto &handler : deferred)
+	{
+		runOnShard(op->newShard, op->bucket, std::move(handler), false);
+	}
+
+	op->callOriginalCb();
+}
+
+template <class K, class Hash>
+void ShardedComponent<K, Hash>::rebalanceReq(
+	unsigned int maxMoves, Callback<shardOpCbFn> callback
+	)
+{
+	std::vector<uint64_t> loads = getShardLoads();
+	const size_t hottest = std::max_element(loads.begin(), loads.end())
+		- loads.begin();
+	const size_t coolest = std::min_element(loads.begin(), loads.end())
+		- loads.begin();
+
+	std::vector<size_t> candidates;
+	for (size_t i = 0; i < nBuckets; i++) {
+		if (getShardForBucket(i) == hottest) { candidates.push_back(i); }
+	}
+
+	std::sort(candidates.begin(), candidates.end(),
+		[this](size_t a, size_t b)
+			{ return getBucketLoad(a) > getBucketLoad(b); });
+
+	/**	EXPLANATION:
+	 * Greedily move the hottest buckets for as long as each move brings the
+	 * two shards' loads closer together.
+	 */
+	std::vector<size_t> moves;
+	uint64_t hotLoad = loads[hottest], coolLoad = loads[coolest];
+	for (size_t bucket : candidates)
+	{
+		if (moves.size() >= maxMoves || hottest == coolest) { break; }
+
+		const uint64_t bucketLoad = getBucketLoad(bucket);
+		if (bucketLoad == 0 || coolLoad + bucketLoad >= hotLoad) { continue; }
+
+		moves.push_back(bucket);
+		hotLoad -= bucketLoad;
+		coolLoad += bucketLoad;
+	}
+
+	const std::shared_ptr<ComponentThread> caller = ComponentThread::getSelf();
+
+	if (moves.empty())
+	{
+		if (callback.callbackFn)
+			{ caller->post(STC(callback.callbackFn)); }
+		return;
+	}
+
+	auto nPending = std::make_shared<std::atomic<size_t>>(moves.size());
+	for (size_t bucket : moves)
+	{
+		migrateBucketReq(bucket, coolest, {callback.callerContinuation,
+			[nPending, callback]()
+			{
+				if (nPending->fetch_sub(1) != 1) { return; }
+				if (callback.callbackFn) { callback.callbackFn(); }
+			}});
+	}
+}
+
+} // namespace sscl
+
+#endif // SHARDED_COMPONENT_H
@@ -0,0 +1,106 @@
+#ifndef SHARED_MEMORY_H
+#define SHARED_MEMORY_H
+
+#include <config.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <sys/types.h>
+
+#ifndef CONFIG_ENABLE_SHM_IPC
+#error "sharedMemory.h requires the library to be built with ENABLE_SHM_IPC"
+#endif
+
+namespace sscl {
+
+/**
+ * @brief SharedMemorySegment - A named POSIX shared memory mapping
+ *
+ * One process create()s the segment; the others open() it by name. The
+ * creator unlinks the name when its SharedMemorySegment is destroyed, but the
+ * memory itself stays mapped in every process that still has it open.
+ *
+ * Anything placed in a segment must be usable from several address spaces at
+ * once: no pointers, no heap-owning members, and only lock-free atomics.
+ */
+class SharedMemorySegment
+{
+public:
+	static SharedMemorySegment create(const std::string &name, size_t size);
+	static SharedMemorySegment open(const std::string &name);
+
+	SharedMemorySegment(SharedMemorySegment &&other) noexcept;
+	SharedMemorySegment &operator=(SharedMemorySegment &&other) noexcept;
+	SharedMemorySegment(const SharedMemorySegment &) = delete;
+	SharedMemorySegment &operator=(const SharedMemorySegment &) = delete;
+	~SharedMemorySegment();
+
+	void *data(void) const { return base; }
+	size_t size(void) const { return length; }
+	const std::string &getName(void) const { return name; }
+
+	// Construct a T at the start of a segment this process created.
+	template <class T, class... Args>
+	T &construct(Args&&... args)
+	{
+		checkFits(sizeof(T), alignof(T));
+		return *new (base) T(std::forward<Args>(args)...);
+	}
+
+	// Access the T that the segment's creator constructed.
+	template <class T>
+	T &attach(void) const
+	{
+		checkFits(sizeof(T), alignof(T));
+		return *static_cast<T *>(base);
+	}
+
+private:
+	SharedMemorySegment(std::string name, void *base, size_t length,
+		bool isCreator);
+
+	void checkFits(size_t objectSize, size_t objectAlign) const;
+	void unmap(void) noexcept;
+
+private:
+	std::string name;
+	void *base;
+	size_t length;
+	bool isCreator;
+};
+
+/**	EXPLANATION:
+ * Process-shared futex wrappers. These deliberately don't use
+ * FUTEX_PRIVATE_FLAG, since waiters and wakers are in different processes.
+ * std::atomic<uint32_t> is guaranteed to have the same representation as
+ * uint32_t on the platforms that have futexes.
+ */
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+/**
+ * @brief Sleep until *word != expected, a wakeup, or the timeout.
+ * @param timeout Zero means no timeout.
+ * @return false only if the timeout expired.
+ */
+bool futexWait(
+	std::atomic<uint32_t> &word, uint32_t expected,
+	std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0));
+
+void futexWake(std::atomic<uint32_t> &word, int nWaiters);
+
+/**	EXPLANATION:
+ * glibc no longer caches getpid(), and lock owners and ring claimers record
+ * their pid on every acquire or send. This caches it, and a fork handler
+ * resets the cache in the child.
+ */
+pid_t getCachedPid(void);
+
+} // namespace sscl
+
+#endif // SHARED_MEMORY_H
@@ -0,0 +1,522 @@
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <config.h>
+#include <boostAsioLinkageFix.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <signal.h>
+#include <spinscale/cacheLine.h>
+#include <spinscale/callableTracer.h>
+#include <spinscale/componentThread.h>
+#include <spinscale/sharedMemory.h>
+#include <spinscale/spinLock.h>
+
+namespace sscl {
+
+/**
+ * @brief ShmChannel - Typed messages between processes over a shared memory
+ *	ring
+ *
+ * The receiving process create()s the channel and attaches a
+ * ShmChannelReceiver to it; any number of sending processes (or threads)
+ * open() it by name and send() messages, which the receiver dispatches to
+ * handle() overloads on its ComponentThread, exactly as TypedMessageQueue
+ * does in-process.
+ *
+ * Messages are stored by value in a std::variant<MsgTs...>, so every MsgT
+ * must be trivially copyable: no pointers, std::string, shared_ptr etc.
+ * Both sides must be built with the same MsgTs in the same order; open()
+ * checks the slot layout but can't check the types themselves.
+ *
+ *	EXPLANATION:
+ * The ring is a bounded multi-producer queue where each slot carries a
+ * sequence number that says whose turn it is (producer or consumer) for that
+ * slot. Producers claim a slot with one CAS on the enqueue position and
+ * never wait on each other.
+ *
+ * A sender that dies between claiming a slot and publishing it would leave
+ * the receiver waiting on that slot forever. So right after its CAS, a
+ * sender records its pid and the claimed position in the slot; and when the
+ * receiver finds the head slot claimed but unpublished for longer than
+ * deadSenderPollInterval, it checks whether the claimer still exists, and
+ * if not, skips the slot. Only the dead sender's own message is lost. A
+ * sender that dies in the couple of instructions between its CAS and
+ * recording its pid still wedges the ring.
+ *
+ * The receiver sleeps on a futex when the ring is empty, and senders only
+ * make the wake syscall when the receiver has said it's about to sleep, so
+ * under load a send() is a CAS and a copy.
+ */
+template <class... MsgTs>
+class ShmChannel
+{
+public:
+	typedef std::variant<MsgTs...> MessageT;
+
+	static_assert(std::is_trivially_copyable_v<MessageT>,
+		"ShmChannel messages must be trivially copyable");
+	static_assert(std::atomic<uint64_t>::is_always_lock_free,
+		"ShmChannel needs lock-free 64-bit atomics");
+
+	template <class MsgT>
+	static constexpr bool accepts =
+		(std::is_same_v<std::remove_cvref_t<MsgT>, MsgTs> || ...);
+
+	static constexpr std::chrono::milliseconds deadSenderPollInterval{1};
+
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t> seq;
+		// Claimer's pid in the high half, low half of its position.
+		std::atomic<uint64_t> claim;
+		MessageT message;
+	};
+
+	struct Ring
+	{
+		static constexpr uint64_t magicValue = 0x5353434c53484d31ull;
+
+		uint64_t magic;
+		uint64_t capacity;
+		uint64_t slotSize, messageSize;
+
+		alignas(cacheLineSize) std::atomic<uint64_t> enqueuePos;
+		alignas(cacheLineSize) std::atomic<uint64_t> dequeuePos;
+		alignas(cacheLineSize) std::atomic<uint32_t> wakeSeq;
+		std::atomic<uint32_t> receiverIsSleeping;
+
+		Slot *slots(void)
+		{
+			return reinterpret_cast<Slot *>(
+				reinterpret_cast<uint8_t *>(this)
+				+ roundUpToCacheLine(sizeof(Ring)));
+		}
+	};
+
+public:
+	static size_t segmentSizeFor(size_t capacity)
+		{ return roundUpToCacheLine(sizeof(Ring)) + capacity * sizeof(Slot); }
+
+	/**
+	 * @brief Create the channel's segment; done by the receiving process.
+	 * @param capacity Max number of messages in flight; must be a power of 2.
+	 */
+	static std::shared_ptr<ShmChannel> create(
+		const std::string &name, size_t capacity)
+	{
+		if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+		{
+			throw std::invalid_argument(std::string(__func__)
+				+ ": capacity must be a power of 2, >= 2");
+		}
+
+		SharedMemorySegment segment = SharedMemorySegment::create(
+			name, segmentSizeFor(capacity));
+
+		Ring &ring = segment.construct<Ring>();
+		ring.capacity = capacity;
+		ring.slotSize = sizeof(Slot);
+		ring.messageSize = sizeof(MessageT);
+		ring.enqueuePos.store(0, std::memory_order_relaxed);
+		ring.dequeuePos.store(0, std::memory_order_relaxed);
+		ring.wakeSeq.store(0, std::memory_order_relaxed);
+		ring.receiverIsSleeping.store(0, std::memory_order_relaxed);
+
+		Slot *slots = ring.slots();
+		for (size_t i = 0; i < capacity; i++)
+		{
+			new (&slots[i]) Slot;
+			slots[i].seq.store(i, std::memory_order_relaxed);
+			slots[i].claim.store(0, std::memory_order_relaxed);
+		}
+
+		// Publish last, so open() never sees a half-initialized ring.
+		std::atomic_ref<uint64_t>(ring.magic).store(
+			Ring::magicValue, std::memory_order_release);
+
+		return std::shared_ptr<ShmChannel>(
+			new ShmChannel(std::move(segment)));
+	}
+
+	// Open an existing channel's segment; done by sending processes.
+	static std::shared_ptr<ShmChannel> open(const std::string &name)
+	{
+		SharedMemorySegment segment = SharedMemorySegment::open(name);
+		Ring &ring = segment.attach<Ring>();
+
+		if (std::atomic_ref<uint64_t>(ring.magic).load(
+			std::memory_order_acquire) != Ring::magicValue
+			|| ring.slotSize != sizeof(Slot)
+			|| ring.messageSize != sizeof(MessageT)
+			|| segment.size() < segmentSizeFor(ring.capacity))
+		{
+			throw std::runtime_error(std::string(__func__)
+				+ ": Segment " + name + " isn't an initialized ShmChannel "
+				"with this message layout");
+		}
+
+		return std::shared_ptr<ShmChannel>(
+			new ShmChannel(std::move(segment)));
+	}
+
+	/**
+	 * @brief Try to enqueue a message; may be called from any thread in any
+	 *	process that has the channel open.
+	 * @return false if the ring is full.
+	 */
+	template <class MsgT>
+	bool trySend(MsgT &&message)
+	{
+		static_assert(accepts<MsgT>,
+			"Message type was not declared in this ShmChannel's MsgTs");
+
+		Slot *slot;
+		uint64_t pos = ring->enqueuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			slot = &slots[pos & mask];
+			uint64_t seq = slot->seq.load(std::memory_order_acquire);
+			int64_t diff = static_cast<int64_t>(seq - pos);
+
+			if (diff == 0)
+			{
+				if (ring->enqueuePos.compare_exchange_weak(
+					pos, pos + 1, std::memory_order_relaxed))
+				{
+					slot->claim.store(
+						claimFor(pos), std::memory_order_relaxed);
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = ring->enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		slot->message.template emplace<std::remove_cvref_t<MsgT>>(
+			std::forward<MsgT>(message));
+		slot->seq.store(pos + 1, std::memory_order_release);
+
+		wakeReceiver();
+		return true;
+	}
+
+	/**	EXPLANATION:
+	 * Spins (yielding) while the ring is full. Backpressure from a slow
+	 * receiver therefore stalls the sending thread: ComponentThreads that
+	 * mustn't block should use trySend() and retry later instead.
+	 */
+	template <class MsgT>
+	void send(MsgT &&message)
+	{
+		while (!trySend(message)) { std::this_thread::yield(); }
+	}
+
+	// Receiving side only.
+	bool tryReceive(MessageT &out)
+	{
+		uint64_t pos = ring->dequeuePos.load(std::memory_order_relaxed);
+		Slot *slot = &slots[pos & mask];
+		uint64_t seq = slot->seq.load(std::memory_order_acquire);
+
+		if (static_cast<int64_t>(seq - (pos + 1)) < 0) { return false; }
+
+		out = slot->message;
+		slot->seq.store(pos + mask + 1, std::memory_order_release);
+		ring->dequeuePos.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool isEmpty(void) const
+	{
+		uint64_t pos = ring->dequeuePos.load(std::memory_order_relaxed);
+		uint64_t seq = slots[pos & mask].seq.load(std::memory_order_acquire);
+		return static_cast<int64_t>(seq - (pos + 1)) < 0;
+	}
+
+	/**
+	 * @brief Receiving side only: sleep until the ring is non-empty, or until
+	 *	interruptWait() is called.
+	 */
+	void waitForMessages(void)
+	{
+		/**	EXPLANATION:
+		 * Read wakeSeq before announcing that we're going to sleep and
+		 * re-checking the ring. A sender that enqueued after our re-check
+		 * sees receiverIsSleeping (all of this is seq_cst) and bumps wakeSeq,
+		 * so the futex wait returns straight away instead of missing it.
+		 */
+		while (isEmpty())
+		{
+			uint32_t seq = ring->wakeSeq.load();
+			ring->receiverIsSleeping.store(1);
+
+			if (!isEmpty())
+			{
+				ring->receiverIsSleeping.store(0);
+				return;
+			}
+
+			/* If the head slot is claimed, its sender is mid-send and will
+			 * wake us when it publishes; unless it died, so don't wait on it
+			 * indefinitely.
+			 */
+			const bool headIsClaimed = headSlotIsClaimed();
+			futexWait(
+				ring->wakeSeq, seq,
+				headIsClaimed
+					? std::chrono::nanoseconds(deadSenderPollInterval)
+					: std::chrono::nanoseconds(0));
+			ring->receiverIsSleeping.store(0);
+
+			if (interrupted.load()) { return; }
+			if (headIsClaimed) { skipHeadSlotIfClaimerDied(); }
+		}
+	}
+
+	// Receiving side only: slots skipped because their sender died mid-send.
+	uint64_t getNSkippedSlots(void) const
+		{ return nSkippedSlots.load(std::memory_order_relaxed); }
+
+	void interruptWait(void)
+	{
+		interrupted.store(true);
+		ring->wakeSeq.fetch_add(1);
+		futexWake(ring->wakeSeq, 1);
+	}
+
+	const std::string &getName(void) const { return segment.getName(); }
+
+private:
+	explicit ShmChannel(SharedMemorySegment &&_segment)
+	:	segment(std::move(_segment)),
+	ring(&segment.attach<Ring>()),
+	slots(ring->slots()),
+	mask(ring->capacity - 1),
+	interrupted(false), nSkippedSlots(0)
+	{}
+
+	static uint64_t claimFor(uint64_t pos)
+	{
+		return (static_cast<uint64_t>(getCachedPid()) << 32)
+			| static_cast<uint32_t>(pos);
+	}
+
+	bool headSlotIsClaimed(void) const
+	{
+		return ring->enqueuePos.load(std::memory_order_relaxed)
+			!= ring->dequeuePos.load(std::memory_order_relaxed);
+	}
+
+	/**	EXPLANATION:
+	 * The head slot is unpublished (seq == pos) and claimed. If the claim
+	 * recorded in it is for this position, its claimer is known, and if
+	 * that process no longer exists, nobody will ever publish the slot: hand
+	 * it back to the producers as if we'd consumed it. A claim left over
+	 * from an earlier lap doesn't match pos, so a sender that hasn't
+	 * recorded its claim yet is never skipped.
+	 */
+	void skipHeadSlotIfClaimerDied(void)
+	{
+		uint64_t pos = ring->dequeuePos.load(std::memory_order_relaxed);
+		Slot *slot = &slots[pos & mask];
+
+		if (slot->seq.load(std::memory_order_acquire) != pos) { return; }
+
+		const uint64_t claim = slot->claim.load(std::memory_order_relaxed);
+		const pid_t claimer = static_cast<pid_t>(claim >> 32);
+		if (static_cast<uint32_t>(claim) != static_cast<uint32_t>(pos)
+			|| claimer <= 0)
+			{ return; }
+
+		if (kill(claimer, 0) == 0 || errno != ESRCH) { return; }
+
+		slot->seq.store(pos + mask + 1, std::memory_order_release);
+		ring->dequeuePos.store(pos + 1, std::memory_order_relaxed);
+		nSkippedSlots.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void wakeReceiver(void)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (ring->receiverIsSleeping.load() == 0) { return; }
+
+		ring->wakeSeq.fetch_add(1);
+		futexWake(ring->wakeSeq, 1);
+	}
+
+private:
+	SharedMemorySegment segment;
+	Ring *ring;
+	Slot *slots;
+	const uint64_t mask;
+	// Local to this process.
+	std::atomic<bool> interrupted;
+	std::atomic<uint64_t> nSkippedSlots;
+};
+
+/**
+ * @brief ShmChannelReceiver - Delivers a ShmChannel's messages to a
+ *	Component's thread
+ *
+ * A dedicated waiter thread sleeps on the channel's futex while it's empty.
+ * When messages arrive it posts one drain to the component thread, which
+ * dispatches them with std::visit to HandlerT::handle() overloads, and then
+ * waits for that drain to finish before sleeping again. So there's one post
+ * per burst of messages, not per message, and the component thread itself
+ * never blocks.
+ *
+ * A drain handles at most drainQuantum messages before re-posting itself,
+ * so a flood of IPC traffic can't starve the thread's other work.
+ *
+ * The handler is held by reference and must outlive the receiver.
+ */
+template <class HandlerT, class... MsgTs>
+class ShmChannelReceiver
+:	public std::enable_shared_from_this<ShmChannelReceiver<HandlerT, MsgTs...>>
+{
+public:
+	typedef ShmChannel<MsgTs...> ChannelT;
+
+public:
+	ShmChannelReceiver(
+		const std::shared_ptr<ChannelT> &channel,
+		const std::shared_ptr<ComponentThread> &thread,
+		HandlerT &handler, size_t drainQuantum = 256)
+	:	channel(channel), thread(thread), handler(handler),
+	drainQuantum(drainQuantum),
+	isStopping(false), drainIsPending(false), nMessages(0), nDrains(0)
+	{}
+
+	~ShmChannelReceiver() { stop(); }
+
+	void start(void)
+	{
+		if (waiter.joinable())
+		{
+			throw std::runtime_error(std::string(__func__)
+				+ ": Receiver already started");
+		}
+
+		waiter = std::thread(&ShmChannelReceiver::waiterMain, this);
+	}
+
+	/**	EXPLANATION:
+	 * Must be called before the component thread stops processing posts,
+	 * since the waiter may be waiting for a drain to finish. A drain that's
+	 * already been posted holds a shared_ptr to us and is harmless.
+	 */
+	void stop(void)
+	{
+		if (!waiter.joinable()) { return; }
+
+		isStopping.store(true);
+		channel->interruptWait();
+		drainIsPending.store(false);
+		drainIsPending.notify_one();
+		waiter.join();
+	}
+
+	uint64_t getMessageCount(void) const
+		{ return nMessages.load(std::memory_order_relaxed); }
+	uint64_t getDrainCount(void) const
+		{ return nDrains.load(std::memory_order_relaxed); }
+
+private:
+	void waiterMain(void)
+	{
+		while (!isStopping.load())
+		{
+			channel->waitForMessages();
+			if (isStopping.load()) { break; }
+
+			/* We may be racing with our own destruction, in which case
+			 * stop() is about to interrupt us anyway.
+			 */
+			auto self = this->weak_from_this().lock();
+			if (!self) { break; }
+
+			drainIsPending.store(true);
+			nDrains.fetch_add(1, std::memory_order_relaxed);
+			thread->post(
+				STC(std::bind(&ShmChannelReceiver::drainReq1_posted, self)));
+			self.reset();
+
+			drainIsPending.wait(true);
+		}
+	}
+
+	void drainReq1_posted(void)
+	{
+		/**	EXPLANATION:
+		 * Unless we re-post ourself, tell the waiter thread we're done on
+		 * the way out, even if a handler throws. Otherwise it would wait on
+		 * drainIsPending forever, and nothing but stop() would wake it.
+		 */
+		struct DrainScope
+		{
+			explicit DrainScope(ShmChannelReceiver &r) : r(r) {}
+			~DrainScope()
+			{
+				r.nMessages.fetch_add(n, std::memory_order_relaxed);
+				if (isReposted) { return; }
+
+				r.drainIsPending.store(false);
+				r.drainIsPending.notify_one();
+			}
+
+			ShmChannelReceiver &r;
+			size_t n = 0;
+			bool isReposted = false;
+		} scope(*this);
+
+		typename ChannelT::MessageT message;
+
+		for (; scope.n < drainQuantum && channel->tryReceive(message); )
+		{
+			scope.n++;
+			std::visit(
+				[this](auto &msg) { handler.handle(msg); },
+				message);
+		}
+
+		if (scope.n == drainQuantum && !isStopping.load())
+		{
+			thread->post(
+				STC(std::bind(
+					&ShmChannelReceiver::drainReq1_posted,
+					this->shared_from_this())));
+			scope.isReposted = true;
+		}
+	}
+
+private:
+	std::shared_ptr<ChannelT> channel;
+	std::shared_ptr<ComponentThread> thread;
+	HandlerT &handler;
+	const size_t drainQuantum;
+
+	std::thread waiter;
+	std::atomic<bool> isStopping, drainIsPending;
+	std::atomic<uint64_t> nMessages, nDrains;
+};
+
+} // namespace sscl
+
+#endif // SHM_CHANNEL_H
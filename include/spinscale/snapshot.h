@@ -0,0 +1,272 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <spinscale/callback.h>
+#include <spinscale/componentThread.h>
+#include <spinscale/spinLock.h>
+
+namespace sscl {
+
+class SnapshotCoordinator;
+
+/**
+ * @brief Snapshot - The serialized state of every registered region, as of
+ *	one snapshot epoch
+ */
+struct Snapshot
+{
+	struct Entry
+	{
+		std::string regionName;
+		std::string bytes;
+	};
+
+	uint64_t epoch;
+	std::vector<Entry> entries;
+};
+
+/**
+ * @brief SnapshotRegion - A piece of component state that snapshots capture
+ *
+ * Registers itself with its SnapshotCoordinator on construction and
+ * unregisters on destruction. A region mustn't be constructed or destroyed
+ * while a snapshot is in progress. VersionedRegion<T> is the stock
+ * implementation; derive from this directly for structures that version
+ * themselves some other way.
+ */
+class SnapshotRegion
+{
+public:
+	SnapshotRegion(SnapshotCoordinator &coordinator, std::string name);
+	virtual ~SnapshotRegion();
+
+	SnapshotRegion(const SnapshotRegion &) = delete;
+	SnapshotRegion &operator=(const SnapshotRegion &) = delete;
+
+	const std::string &getName(void) const { return name; }
+
+protected:
+	friend class SnapshotCoordinator;
+
+	/**	EXPLANATION:
+	 * Called on the snapshot's serializer thread. Must append the region's
+	 * state as it was when `epoch` began to `out`, without stopping writers
+	 * for longer than it takes to pin that version.
+	 */
+	virtual void serializeForEpoch(uint64_t epoch, std::string &out) = 0;
+
+protected:
+	SnapshotCoordinator &coordinator;
+	const std::string name;
+};
+
+/**
+ * @brief SnapshotCoordinator - Takes consistent snapshots of registered
+ *	regions without pausing the threads that write them
+ *
+ * takeSnapshotReq() begins a new snapshot epoch by bumping a counter. That's
+ * the whole of the "stop": writers are never paused. Each region's first
+ * write after the epoch begins preserves the region's old version before
+ * modifying it, and the serializer thread then serializes the old versions
+ * region by region, posting one region per handler so that it stays
+ * responsive.
+ *
+ *	EXPLANATION:
+ * The snapshot is a consistent cut across all regions, without any global
+ * lock: a writer reads the epoch and writes the region under the region's
+ * lock, so each write lands entirely on one side of the cut. And if a write
+ * landed after the cut, anything that happens after it, e.g: a write to
+ * another component's region in response to a message it sent, also reads
+ * the new epoch, so it lands after the cut too.
+ *
+ * One snapshot is taken at a time.
+ */
+class SnapshotCoordinator
+{
+public:
+	typedef std::function<void(std::shared_ptr<Snapshot>)> takeSnapshotCbFn;
+
+	struct Stats
+	{
+		uint64_t nSnapshots;
+		// Versions preserved by writers because a snapshot still needed them.
+		uint64_t nCopiesOnWrite;
+	};
+
+public:
+	SnapshotCoordinator()
+	:	epoch(0), snapshotIsInProgress(false),
+	nSnapshots(0), nCopiesOnWrite(0)
+	{}
+
+	/**
+	 * @brief Snapshot every currently registered region.
+	 * @param serializerThread Thread that serializes the regions. Usually a
+	 *	low priority thread of its own, so serialization doesn't delay the
+	 *	components' traffic.
+	 * @param callback Posted to the calling thread with the snapshot once
+	 *	every region has been serialized.
+	 */
+	void takeSnapshotReq(
+		const std::shared_ptr<ComponentThread> &serializerThread,
+		Callback<takeSnapshotCbFn> callback);
+
+	uint64_t getEpoch(void) const
+		{ return epoch.load(std::memory_order_acquire); }
+
+	Stats getStats(void) const
+	{
+		return Stats{
+			nSnapshots.load(std::memory_order_relaxed),
+			nCopiesOnWrite.load(std::memory_order_relaxed)
+		};
+	}
+
+private:
+	friend class SnapshotRegion;
+	template <class T> friend class VersionedRegion;
+	class TakeSnapshotOp;
+
+	void registerRegion(SnapshotRegion &region);
+	void unregisterRegion(SnapshotRegion &region);
+
+	void noteCopyOnWrite(void)
+		{ nCopiesOnWrite.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> epoch;
+
+	SpinLock regionsLock;
+	// Guarded by regionsLock.
+	std::vector<SnapshotRegion *> regions;
+	bool snapshotIsInProgress;
+
+	std::atomic<uint64_t> nSnapshots, nCopiesOnWrite;
+};
+
+/**
+ * @brief VersionedRegion - A value of type T that snapshots capture by
+ *	copy-on-write
+ *
+ * Writers modify the value through a WriteScope:
+ *
+ *	VersionedRegion<Table> table(coordinator, "table", serializeTable);
+ *	{
+ *		auto w = table.write();
+ *		w->insert(key, value);
+ *	}
+ *
+ * The first WriteScope opened after a snapshot epoch begins copies T, and
+ * the snapshot keeps the old copy; the value is otherwise never copied. So a
+ * write costs an uncontended spinlock, plus one copy of T per snapshot for
+ * regions that are written while the snapshot is in progress.
+ *
+ * Keep WriteScopes short: the region's lock is held throughout, and the
+ * serializer takes it briefly to pin a version. get() is only safe on the
+ * thread(s) that write the region.
+ */
+template <class T>
+class VersionedRegion
+:	public SnapshotRegion
+{
+public:
+	typedef std::function<void(const T &value, std::string &out)> serializeFn;
+
+	class WriteScope
+	{
+	public:
+		explicit WriteScope(VersionedRegion &region)
+		:	region(region)
+		{
+			region.lock.acquire();
+			region.prepareForWrite();
+		}
+
+		~WriteScope() { region.lock.release(); }
+
+		WriteScope(const WriteScope &) = delete;
+		WriteScope &operator=(const WriteScope &) = delete;
+
+		T &operator*() const { return *region.live; }
+		T *operator->() const { return region.live.get(); }
+
+	private:
+		VersionedRegion &region;
+	};
+
+public:
+	VersionedRegion(
+		SnapshotCoordinator &coordinator, std::string name,
+		serializeFn serialize, T initialValue = T())
+	:	SnapshotRegion(coordinator, std::move(name)),
+	serialize(std::move(serialize)),
+	live(std::make_shared<T>(std::move(initialValue))),
+	// Nothing to preserve for snapshots that began before we existed.
+	liveEpoch(coordinator.getEpoch()), capturedEpoch(liveEpoch)
+	{}
+
+	const T &get(void) const { return *live; }
+	WriteScope write(void) { return WriteScope(*this); }
+
+protected:
+	void serializeForEpoch(uint64_t snapshotEpoch, std::string &out) override
+	{
+		/**	EXPLANATION:
+		 * If nobody has written since the epoch began, the live version is
+		 * the one we want: pin it, and the next writer will copy rather than
+		 * modify it, because capturedEpoch is still behind. Serialize outside
+		 * the lock, then let writers stop copying.
+		 */
+		lock.acquire();
+		std::shared_ptr<const T> version = (preserved != nullptr)
+			? preserved : std::shared_ptr<const T>(live);
+		lock.release();
+
+		serialize(*version, out);
+
+		lock.acquire();
+		capturedEpoch = snapshotEpoch;
+		preserved.reset();
+		lock.release();
+	}
+
+private:
+	// Called with `lock` held.
+	void prepareForWrite(void)
+	{
+		const uint64_t currEpoch = coordinator.getEpoch();
+
+		if (liveEpoch < currEpoch && capturedEpoch < currEpoch)
+		{
+			preserved = live;
+			live = std::make_shared<T>(*preserved);
+			coordinator.noteCopyOnWrite();
+		}
+
+		liveEpoch = currEpoch;
+	}
+
+private:
+	serializeFn serialize;
+
+	SpinLock lock;
+	// All guarded by lock.
+	std::shared_ptr<T> live;
+	// The version as of the epoch being snapshotted, once a writer moved on.
+	std::shared_ptr<const T> preserved;
+	// Epoch in which live was last written.
+	uint64_t liveEpoch;
+	// Latest epoch whose snapshot has finished with this region.
+	uint64_t capturedEpoch;
+};
+
+} // namespace sscl
+
+#endif // SNAPSHOT_H
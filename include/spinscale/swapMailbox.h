@@ -0,0 +1,124 @@
+#ifndef SWAP_MAILBOX_H
+#define SWAP_MAILBOX_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <spinscale/spinLock.h>
+
+namespace sscl {
+
+/**
+ * @brief SwapMailbox - Many-producer, single-consumer batch handoff to a
+ *	Component's thread
+ *
+ * Producers append items under a SpinLock. The consumer takes all of them
+ * in one go by swapping the pending vector with its draining vector, so
+ * producers only contend with it once per batch rather than once per item.
+ * The vectors trade places rather than being reallocated, so both keep
+ * their capacity across batches.
+ *
+ * The mailbox also tracks whether a drain is scheduled, so that only the
+ * producer that finds it idle has to post one.
+ */
+template <class T>
+class SwapMailbox
+{
+public:
+	/**
+	 * @brief Append an item. May be called from any thread.
+	 * @return true if the caller must schedule a drain, i.e: none was
+	 *	scheduled.
+	 */
+	template <class... Args>
+	bool emplace(Args&&... args)
+	{
+		return emplaceAndCheck(
+			[](size_t) { return false; }, std::forward<Args>(args)...);
+	}
+
+	/**
+	 * @brief As emplace(), but also calls onAppendedFn(nPending) under the
+	 *	lock once the item is in.
+	 *
+	 * If onAppendedFn returns true, the caller must schedule a drain even
+	 * though one already is.
+	 */
+	template <class FnT, class... Args>
+	bool emplaceAndCheck(FnT &&onAppendedFn, Args&&... args)
+	{
+		lock.acquire();
+
+		pending.emplace_back(std::forward<Args>(args)...);
+		const bool mustSchedule = onAppendedFn(pending.size())
+			|| !drainIsScheduled;
+		drainIsScheduled = true;
+
+		lock.release();
+		return mustSchedule;
+	}
+
+	// Consumer only. Call fn(pending) under the lock, e.g: to size it up.
+	template <class FnT>
+	void inspect(FnT &&fn)
+	{
+		lock.acquire();
+		fn(static_cast<const std::vector<T> &>(pending));
+		lock.release();
+	}
+
+	/**
+	 * @brief Consumer only. Take everything appended so far; the drain stays
+	 *	scheduled until tryGoIdle() succeeds.
+	 * @return The draining vector, which the consumer may modify until its
+	 *	next take.
+	 */
+	std::vector<T> &takeAll(void) { return take(false); }
+
+	// As takeAll(), but producers schedule the next drain themselves.
+	std::vector<T> &takeAllAndGoIdle(void) { return take(true); }
+
+	// Consumer only. The vector every take returns.
+	std::vector<T> &getDraining(void) { return draining; }
+
+	/**
+	 * @brief Consumer only. Stop being scheduled if nothing is pending.
+	 * @return false if items are pending, so the consumer must keep going.
+	 */
+	bool tryGoIdle(void)
+	{
+		lock.acquire();
+
+		const bool isEmpty = pending.empty();
+		if (isEmpty) { drainIsScheduled = false; }
+
+		lock.release();
+		return isEmpty;
+	}
+
+private:
+	std::vector<T> &take(bool goIdle)
+	{
+		draining.clear();
+
+		lock.acquire();
+		draining.swap(pending);
+		if (goIdle) { drainIsScheduled = false; }
+		lock.release();
+
+		return draining;
+	}
+
+private:
+	SpinLock lock;
+	// Guarded by lock.
+	std::vector<T> pending;
+	bool drainIsScheduled = false;
+
+	// Only touched by the consumer.
+	std::vector<T> draining;
+};
+
+} // namespace sscl
+
+#endif // SWAP_MAILBOX_H
@@ -0,0 +1,145 @@
+#ifndef TYPED_MESSAGE_QUEUE_H
+#define TYPED_MESSAGE_QUEUE_H
+
+#include <boostAsioLinkageFix.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <spinscale/callableTracer.h>
+#include <spinscale/componentThread.h>
+#include <spinscale/swapMailbox.h>
+
+namespace sscl {
+
+/**
+ * @brief TypedMessageQueue - Compile-time typed message delivery to a
+ *	Component's thread
+ *
+ * The Component declares the full set of messages it accepts as MsgTs, and
+ * provides a handle() overload for each of them on HandlerT, e.g:
+ *
+ *	struct Put { uint64_t key, value; };
+ *	struct Erase { uint64_t key; };
+ *
+ *	class KvComponent
+ *	{
+ *	public:
+ *		void handle(Put &msg);
+ *		void handle(Erase &msg);
+ *	};
+ *
+ *	auto q = std::make_shared<TypedMessageQueue<KvComponent, Put, Erase>>(
+ *		thread, kv);
+ *	q->send(Put{1, 2});
+ *
+ * send() stores the message by value in a std::variant<MsgTs...>, so a
+ * message costs its own size plus a tag, and nothing is heap-allocated per
+ * message once the queue's vector has grown to its working size. On the
+ * component thread, each message is dispatched with std::visit, which the
+ * compiler lowers to a switch over the tag that calls the handle() overloads
+ * directly, so they can be inlined.
+ *
+ * This coexists with ordinary closure posts to the same ComponentThread:
+ * typed messages are drained by one closure posted per batch, so ordering is
+ * only guaranteed among the messages of a single queue, not between typed
+ * messages and closures.
+ *
+ * The handler is held by reference and must outlive the queue.
+ */
+template <class HandlerT, class... MsgTs>
+class TypedMessageQueue
+:	public std::enable_shared_from_this<TypedMessageQueue<HandlerT, MsgTs...>>
+{
+	static_assert(sizeof...(MsgTs) > 0,
+		"TypedMessageQueue needs at least one message type");
+
+public:
+	typedef std::variant<MsgTs...> MessageT;
+
+	template <class MsgT>
+	static constexpr bool accepts =
+		(std::is_same_v<std::remove_cvref_t<MsgT>, MsgTs> || ...);
+
+	struct Stats
+	{
+		uint64_t nMessages;
+		// Number of drain closures posted; nMessages / nDrains is the mean
+		// number of messages each closure carried.
+		uint64_t nDrains;
+	};
+
+public:
+	TypedMessageQueue(
+		const std::shared_ptr<ComponentThread> &thread, HandlerT &handler)
+	:	thread(thread), handler(handler),
+	nMessages(0), nDrains(0)
+	{}
+
+	// May be called from any thread.
+	template <class MsgT>
+	void send(MsgT &&message)
+	{
+		emplace<std::remove_cvref_t<MsgT>>(std::forward<MsgT>(message));
+	}
+
+	// Construct the message in place in the queue.
+	template <class MsgT, class... Args>
+	void emplace(Args&&... args)
+	{
+		static_assert(accepts<MsgT>,
+			"Message type was not declared in this TypedMessageQueue's MsgTs");
+
+		const bool mustPostDrain = mailbox.emplace(
+			std::in_place_type<MsgT>, std::forward<Args>(args)...);
+
+		nMessages.fetch_add(1, std::memory_order_relaxed);
+
+		if (!mustPostDrain) { return; }
+
+		nDrains.fetch_add(1, std::memory_order_relaxed);
+		thread->post(
+			STC(std::bind(
+				&TypedMessageQueue::drainReq1_posted,
+				this->shared_from_this())));
+	}
+
+	Stats getStats(void) const
+	{
+		return Stats{
+			nMessages.load(std::memory_order_relaxed),
+			nDrains.load(std::memory_order_relaxed)
+		};
+	}
+
+private:
+	void drainReq1_posted(void)
+	{
+		std::vector<MessageT> &draining = mailbox.takeAllAndGoIdle();
+
+		for (MessageT &message : draining)
+		{
+			std::visit(
+				[this](auto &msg) { handler.handle(msg); },
+				message);
+		}
+
+		draining.clear();
+	}
+
+private:
+	std::shared_ptr<ComponentThread> thread;
+	HandlerT &handler;
+
+	SwapMailbox<MessageT> mailbox;
+
+	std::atomic<uint64_t> nMessages, nDrains;
+};
+
+} // namespace sscl
+
+#endif // TYPED_MESSAGE_QUEUE_H
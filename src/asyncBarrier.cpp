@@ -0,0 +1,167 @@
+#include <stdexcept>
+#include <string>
+#include <spinscale/callableTracer.h>
+#include <spinscale/asyncBarrier.h>
+
+namespace sscl {
+
+AsyncBarrier::AsyncBarrier(
+	unsigned int nParticipants, std::function<void()> phaseCompletionFn)
+:	nParticipants(nParticipants),
+phaseCompletionFn(std::move(phaseCompletionFn)),
+phase(0),
+nRemaining(nParticipants)
+{
+	if (nParticipants == 0)
+	{
+		throw std::invalid_argument(std::string(__func__)
+			+ ": A barrier needs at least one participant");
+	}
+
+	slots[0].resize(nParticipants);
+	slots[1].resize(nParticipants);
+}
+
+std::vector<AsyncBarrier::Slot> &AsyncBarrier::recordArrival(
+	unsigned int participant, Callback<barrierCbFn> &&callback
+	)
+{
+	if (participant >= nParticipants)
+	{
+		throw std::out_of_range(std::string(__func__)
+			+ ": Participant index out of range");
+	}
+
+	std::vector<Slot> &currSlots = slots[
+		phase.load(std::memory_order_acquire) & 1];
+
+	// Each participant only ever writes its own slot.
+	currSlots[participant] = Slot{
+		ComponentThread::getSelf(), std::move(callback)};
+
+	return currSlots;
+}
+
+void AsyncBarrier::completePhase(std::vector<Slot> &currSlots)
+{
+	/**	EXPLANATION:
+	 * Flip the sense before releasing anybody. From here on, arrivals for the
+	 * next phase go to the other slot array, so we can walk this one without
+	 * racing against them.
+	 */
+	phase.fetch_add(1, std::memory_order_acq_rel);
+
+	if (phaseCompletionFn) { phaseCompletionFn(); }
+
+	for (Slot &slot : currSlots)
+	{
+		Slot released = std::move(slot);
+		slot = Slot{};
+
+		if (!released.callback.callbackFn) { continue; }
+
+		released.thread->post(
+			STC(std::move(released.callback.callbackFn)),
+			released.callback.callerContinuation.get());
+	}
+}
+
+void AsyncBarrier::arriveReq(
+	unsigned int participant, Callback<barrierCbFn> callback
+	)
+{
+	std::vector<Slot> &currSlots = recordArrival(
+		participant, std::move(callback));
+
+	// acq_rel: the last arriver must see every other participant's slot.
+	if (nRemaining.fetch_sub(1, std::memory_order_acq_rel) != 1) { return; }
+
+	nRemaining.store(nParticipants, std::memory_order_relaxed);
+	completePhase(currSlots);
+}
+
+CombiningTreeAsyncBarrier::CombiningTreeAsyncBarrier(
+	unsigned int nParticipants, unsigned int fanIn,
+	std::function<void()> phaseCompletionFn)
+:	AsyncBarrier(nParticipants, std::move(phaseCompletionFn)),
+fanIn(fanIn),
+leafOf(nParticipants)
+{
+	if (fanIn < 2)
+	{
+		throw std::invalid_argument(std::string(__func__)
+			+ ": fanIn must be at least 2");
+	}
+
+	/**	EXPLANATION:
+	 * Build the tree bottom-up, one level at a time. Level 0 has one node per
+	 * group of fanIn participants; each level above has one node per group
+	 * of fanIn nodes below it, until a level has a single node: the root.
+	 */
+	unsigned int nLevelNodes = (nParticipants + fanIn - 1) / fanIn;
+	std::vector<unsigned int> levelSizes{nLevelNodes};
+	while (nLevelNodes > 1)
+	{
+		nLevelNodes = (nLevelNodes + fanIn - 1) / fanIn;
+		levelSizes.push_back(nLevelNodes);
+	}
+
+	size_t nNodes = 0;
+	for (unsigned int size : levelSizes) { nNodes += size; }
+	nodes = std::vector<Node>(nNodes);
+
+	for (unsigned int i = 0; i < nParticipants; i++)
+	{
+		leafOf[i] = i / fanIn;
+		nodes[leafOf[i]].nChildren++;
+	}
+
+	size_t levelBase = 0;
+	for (size_t level = 0; level + 1 < levelSizes.size(); level++)
+	{
+		const size_t parentBase = levelBase + levelSizes[level];
+
+		for (unsigned int i = 0; i < levelSizes[level]; i++)
+		{
+			const size_t parent = parentBase + i / fanIn;
+			nodes[levelBase + i].parent = static_cast<int>(parent);
+			nodes[parent].nChildren++;
+		}
+
+		levelBase = parentBase;
+	}
+
+	for (Node &node : nodes) {
+		node.nRemaining.store(node.nChildren, std::memory_order_relaxed);
+	}
+}
+
+void CombiningTreeAsyncBarrier::arriveReq(
+	unsigned int participant, Callback<barrierCbFn> callback
+	)
+{
+	std::vector<Slot> &currSlots = recordArrival(
+		participant, std::move(callback));
+
+	int curr = static_cast<int>(leafOf[participant]);
+	for (;;)
+	{
+		Node &node = nodes[curr];
+
+		if (node.nRemaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			{ return; }
+
+		/* We're the last arriver at this node, so we arrive at its parent on
+		 * behalf of all of its children. Nobody can arrive here again until
+		 * the phase completes, so it's safe to reset it now.
+		 */
+		node.nRemaining.store(node.nChildren, std::memory_order_relaxed);
+
+		if (node.parent < 0) { break; }
+		curr = node.parent;
+	}
+
+	completePhase(currSlots);
+}
+
+} // namespace sscl
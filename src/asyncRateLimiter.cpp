@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <spinscale/callableTracer.h>
+#include <spinscale/asyncRateLimiter.h>
+
+namespace sscl {
+
+AsyncRateLimiter::AsyncRateLimiter(
+	const std::shared_ptr<ComponentThread> &timerThread,
+	double ratePerSec, double burst)
+:	timerThread(timerThread),
+ratePerSec(ratePerSec), burst(burst), tokens(burst),
+lastRefill(std::chrono::steady_clock::now()),
+timerIsArmed(false),
+timer(timerThread->getIoService()),
+nGrants(0), nRefunds(0), nThrottles(0), nTimerWakeups(0)
+{
+	if (ratePerSec <= 0 || burst <= 0)
+	{
+		throw std::invalid_argument(std::string(__func__)
+			+ ": ratePerSec and burst must be positive");
+	}
+}
+
+void AsyncRateLimiter::setLimits(double newRatePerSec, double newBurst)
+{
+	if (newRatePerSec <= 0 || newBurst <= 0)
+	{
+		throw std::invalid_argument(std::string(__func__)
+			+ ": ratePerSec and burst must be positive");
+	}
+
+	lock.acquire();
+
+	/* A queued waiter whose cost no longer fits in the bucket could never be
+	 * paid for, and would sleep forever.
+	 */
+	double maxQueuedCost = 0;
+	for (const Waiter &waiter : waiters)
+		{ maxQueuedCost = std::max(maxQueuedCost, waiter.cost); }
+
+	if (newBurst < maxQueuedCost)
+	{
+		lock.release();
+		throw std::invalid_argument(std::string(__func__)
+			+ ": burst is below the cost of a queued waiter, which could "
+			"then never be met");
+	}
+
+	refill(std::chrono::steady_clock::now());
+	ratePerSec = newRatePerSec;
+	burst = newBurst;
+	tokens = std::min(tokens, burst);
+	const bool mustReevaluate = !waiters.empty() && !timerIsArmed;
+	if (mustReevaluate) { timerIsArmed = true; }
+	lock.release();
+
+	// Let the timer handler decide who can run under the new limits.
+	if (mustReevaluate)
+	{
+		timerThread->post(
+			STC(std::bind(
+				&AsyncRateLimiter::timerReq1_expired, shared_from_this())));
+	}
+}
+
+AsyncRateLimiter::WaiterList::iterator AsyncRateLimiter::registerInQueue(
+	const std::shared_ptr<LockerAndInvokerBase> &lockvoker, double cost
+	)
+{
+	lock.acquire();
+
+	if (cost > burst)
+	{
+		lock.release();
+		throw std::invalid_argument(std::string(__func__)
+			+ ": cost exceeds the limiter's burst, so it could never be met");
+	}
+
+	auto it = waiters.insert(waiters.end(), Waiter{lockvoker, cost, false});
+	lock.release();
+	return it;
+}
+
+void AsyncRateLimiter::unregisterFromQueue(WaiterList::iterator it)
+{
+	lock.acquire();
+	waiters.erase(it);
+	lock.release();
+}
+
+void AsyncRateLimiter::refill(std::chrono::steady_clock::time_point now)
+{
+	const double elapsedSec = std::chrono::duration<double>(
+		now - lastRefill).count();
+
+	tokens = std::min(burst, tokens + elapsedSec * ratePerSec);
+	lastRefill = now;
+}
+
+bool AsyncRateLimiter::tryAcquire(WaiterList::iterator it)
+{
+	lock.acquire();
+
+	refill(std::chrono::steady_clock::now());
+
+	if (tokens >= it->cost)
+	{
+		tokens -= it->cost;
+		it->isThrottled = false;
+		lock.release();
+
+		nGrants.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	it->isThrottled = true;
+	armTimerFor(it->cost);
+	lock.release();
+
+	nThrottles.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+void AsyncRateLimiter::refund(double cost)
+{
+	lock.acquire();
+	tokens = std::min(burst, tokens + cost);
+	lock.release();
+
+	nRefunds.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AsyncRateLimiter::armTimerFor(double cost)
+{
+	if (timerIsArmed) { return; }
+
+	const auto deficit = std::chrono::duration<double>(
+		(cost - tokens) / ratePerSec);
+	const auto deadline = lastRefill
+		+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			deficit);
+
+	/**	EXPLANATION:
+	 * The timer may only be touched on timerThread, so the actual arming is
+	 * posted there. timerIsArmed covers the window in between, so only one
+	 * arming is ever in flight.
+	 */
+	timerIsArmed = true;
+	timerThread->post(
+		STC(std::bind(
+			&AsyncRateLimiter::armTimerReq1_posted,
+			shared_from_this(), deadline)));
+}
+
+void AsyncRateLimiter::armTimerReq1_posted(
+	std::chrono::steady_clock::time_point deadline
+	)
+{
+	timer.expires_at(deadline);
+	timer.async_wait(
+		[self = shared_from_this()](const boost::system::error_code &ec)
+		{
+			if (ec == boost::asio::error::operation_aborted) { return; }
+			self->timerReq1_expired();
+		});
+}
+
+void AsyncRateLimiter::timerReq1_expired(void)
+{
+	nTimerWakeups.fetch_add(1, std::memory_order_relaxed);
+
+	/**	EXPLANATION:
+	 * Wake as many throttled waiters, in queue order, as the bucket can pay
+	 * for right now. They don't reserve anything, so one of them may still
+	 * lose its tokens to someone else; it then re-arms the timer itself. If
+	 * some throttled waiter can't be paid for yet, re-arm for it here, since
+	 * it's asleep and can't.
+	 */
+	std::vector<std::shared_ptr<LockerAndInvokerBase>> toAwaken;
+
+	lock.acquire();
+
+	timerIsArmed = false;
+	refill(std::chrono::steady_clock::now());
+
+	double available = tokens;
+	for (Waiter &waiter : waiters)
+	{
+		if (!waiter.isThrottled) { continue; }
+
+		if (waiter.cost > available)
+		{
+			armTimerFor(waiter.cost + (tokens - available));
+			break;
+		}
+
+		available -= waiter.cost;
+		toAwaken.push_back(waiter.lockvoker);
+	}
+
+	lock.release();
+
+	for (auto &lockvoker : toAwaken) { lockvoker->awaken(); }
+}
+
+} // namespace sscl
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <spinscale/bufferPool.h>
+#include <spinscale/cacheLine.h>
+
+namespace sscl {
+
+BufferPool::BufferPool(
+	size_t bufferSize, size_t nBuffers, size_t threadCacheSize)
+:	bufferSize(bufferSize),
+stride(roundUpToCacheLine(bufferSize)),
+nBuffers(nBuffers),
+threadCacheSize(threadCacheSize),
+slab(nullptr),
+descs(std::make_unique<BufferDesc[]>(nBuffers)),
+nAllocations(0), nLocalCacheHits(0), nRemoteFrees(0),
+nSharedRefills(0), nExhaustions(0), nBuffersInUse(0)
+{
+	if (bufferSize == 0 || nBuffers == 0 || nBuffers >= invalidIndex)
+	{
+		throw std::invalid_argument(std::string(__func__)
+			+ ": bufferSize and nBuffers must be > 0, and nBuffers must fit "
+			"in 32 bits");
+	}
+
+	slab = static_cast<uint8_t *>(
+		std::aligned_alloc(cacheLineSize, stride * nBuffers));
+	if (slab == nullptr) { throw std::bad_alloc(); }
+
+	/* Hand out low indices first so that lightly used pools only touch the
+	 * start of the slab.
+	 */
+	sharedFreeList.reserve(nBuffers);
+	for (size_t i = nBuffers; i > 0; --i) {
+		sharedFreeList.push_back(static_cast<uint32_t>(i - 1));
+	}
+
+	for (auto &cache : threadCaches) {
+		cache.store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+BufferPool::~BufferPool()
+{
+	for (auto &cache : threadCaches) {
+		delete cache.load(std::memory_order_relaxed);
+	}
+
+	std::free(slab);
+}
+
+BufferPool::ThreadCache &BufferPool::getOrCreateThreadCache(ThreadId id)
+{
+	ThreadCache *cache = threadCaches[id].load(std::memory_order_acquire);
+	if (cache != nullptr) { return *cache; }
+
+	/**	EXPLANATION:
+	 * Only thread `id` ever creates its own cache, so there's no race to
+	 * install it. Other threads only ever read the pointer, when returning
+	 * buffers to this thread, and they can only hold buffers from this
+	 * thread's cache after the cache has been published.
+	 */
+	cache = new ThreadCache;
+	cache->freeIndices.reserve(threadCacheSize * 2);
+	threadCaches[id].store(cache, std::memory_order_release);
+	return *cache;
+}
+
+bool BufferPool::refillThreadCache(ThreadCache &cache)
+{
+	// First reclaim anything that other threads have returned to us.
+	BufferDesc *returned = cache.remoteReturns.exchange(
+		nullptr, std::memory_order_acquire);
+
+	for (; returned != nullptr; returned = returned->nextRemoteReturn) {
+		cache.freeIndices.push_back(indexOf(*returned));
+	}
+
+	if (!cache.freeIndices.empty()) { return true; }
+
+	SpinLock::Guard guard(sharedFreeListLock);
+
+	const size_t nToMove = std::min(
+		sharedFreeList.size(), std::max<size_t>(threadCacheSize / 2, 1));
+	if (nToMove == 0) { return false; }
+
+	cache.freeIndices.insert(
+		cache.freeIndices.end(),
+		sharedFreeList.end() - nToMove, sharedFreeList.end());
+	sharedFreeList.resize(sharedFreeList.size() - nToMove);
+
+	nSharedRefills.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+BufferPool::Buffer BufferPool::allocate(void)
+{
+	ComponentThread *self = ComponentThread::getSelfPtr();
+	uint32_t index = invalidIndex;
+	uint16_t homeCache = maxThreadCaches;
+
+	if (self != nullptr)
+	{
+		ThreadCache &cache = getOrCreateThreadCache(self->id);
+
+		if (!cache.freeIndices.empty()) {
+			nLocalCacheHits.fetch_add(1, std::memory_order_relaxed);
+		}
+		else if (!refillThreadCache(cache))
+		{
+			nExhaustions.fetch_add(1, std::memory_order_relaxed);
+			return Buffer();
+		}
+
+		index = cache.freeIndices.back();
+		cache.freeIndices.pop_back();
+		homeCache = self->id;
+	}
+	else
+	{
+		SpinLock::Guard guard(sharedFreeListLock);
+
+		if (sharedFreeList.empty())
+		{
+			nExhaustions.fetch_add(1, std::memory_order_relaxed);
+			return Buffer();
+		}
+
+		index = sharedFreeList.back();
+		sharedFreeList.pop_back();
+	}
+
+	BufferDesc &desc = descs[index];
+	desc.homeCache = homeCache;
+	desc.nextRemoteReturn = nullptr;
+	desc.refCount.store(1, std::memory_order_relaxed);
+
+	nAllocations.fetch_add(1, std::memory_order_relaxed);
+	nBuffersInUse.fetch_add(1, std::memory_order_relaxed);
+	return Buffer(this, index);
+}
+
+void BufferPool::free(uint32_t index)
+{
+	BufferDesc &desc = descs[index];
+	ComponentThread *self = ComponentThread::getSelfPtr();
+
+	nBuffersInUse.fetch_sub(1, std::memory_order_relaxed);
+
+	if (desc.homeCache == maxThreadCaches)
+	{
+		SpinLock::Guard guard(sharedFreeListLock);
+		sharedFreeList.push_back(index);
+		return;
+	}
+
+	ThreadCache &home = *threadCaches[desc.homeCache].load(
+		std::memory_order_acquire);
+
+	if (self == nullptr || self->id != desc.homeCache)
+	{
+		/* Lock-free push onto the home thread's remote-return stack. The home
+		 * thread only ever pops by exchange()ing the whole stack, so there's
+		 * no ABA hazard here.
+		 */
+		nRemoteFrees.fetch_add(1, std::memory_order_relaxed);
+
+		BufferDesc *head = home.remoteReturns.load(std::memory_order_relaxed);
+		do {
+			desc.nextRemoteReturn = head;
+		} while (!home.remoteReturns.compare_exchange_weak(
+			head, &desc,
+			std::memory_order_release, std::memory_order_relaxed));
+
+		return;
+	}
+
+	home.freeIndices.push_back(index);
+
+	// Don't let one thread hoard buffers that others could be using.
+	if (home.freeIndices.size() > threadCacheSize)
+	{
+		const size_t nToSpill = home.freeIndices.size() - threadCacheSize / 2;
+
+		SpinLock::Guard guard(sharedFreeListLock);
+		sharedFreeList.insert(
+			sharedFreeList.end(),
+			home.freeIndices.end() - nToSpill, home.freeIndices.end());
+		home.freeIndices.resize(home.freeIndices.size() - nToSpill);
+	}
+}
+
+BufferPool::Stats BufferPool::getStats(void) const
+{
+	return Stats{
+		nAllocations.load(std::memory_order_relaxed),
+		nLocalCacheHits.load(std::memory_order_relaxed),
+		nRemoteFrees.load(std::memory_order_relaxed),
+		nSharedRefills.load(std::memory_order_relaxed),
+		nExhaustions.load(std::memory_order_relaxed),
+		nBuffersInUse.load(std::memory_order_relaxed),
+		nBuffers
+	};
+}
+
+} // namespace sscl
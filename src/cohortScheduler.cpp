@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <spinscale/callableTracer.h>
+#include <spinscale/cohortScheduler.h>
+
+namespace sscl {
+
+CohortScheduler::CohortScheduler(
+	const std::shared_ptr<ComponentThread> &thread, Options options)
+:	thread(thread), options(options),
+segments(1), nPending(0), nextSeqNo(0), drainIsPosted(false),
+nDrains(0), nOrderDependentHandlers(0)
+{
+	if (options.maxBatchSize == 0)
+	{
+		throw std::invalid_argument(std::string(__func__)
+			+ ": maxBatchSize must be at least 1");
+	}
+}
+
+CohortScheduler::CohortStatsEntry *CohortScheduler::getCohortStatsEntry(
+	const CallsiteKey &key, const std::source_location &callsite
+	)
+{
+	auto it = cohortStats.find(key);
+	if (it == cohortStats.end())
+	{
+		auto entry = std::make_unique<CohortStatsEntry>();
+		entry->callsite = callsite;
+		it = cohortStats.emplace(key, std::move(entry)).first;
+	}
+
+	return it->second.get();
+}
+
+void CohortScheduler::enqueue(
+	std::function<void()> handler, bool isOrderDependent,
+	const std::source_location &callsite
+	)
+{
+	lock.acquire();
+
+	if (isOrderDependent)
+	{
+		segments.back().hasBarrier = true;
+		segments.back().barrier = std::move(handler);
+		segments.emplace_back();
+	}
+	else
+	{
+		const CallsiteKey key{
+			callsite.file_name(), callsite.line(), callsite.column()};
+		Cohort &cohort = segments.back().cohorts[key];
+
+		if (cohort.stats == nullptr)
+			{ cohort.stats = getCohortStatsEntry(key, callsite); }
+
+		cohort.items.push_back(Item{nextSeqNo++, std::move(handler)});
+	}
+
+	nPending++;
+	const bool mustPostDrain = !drainIsPosted;
+	drainIsPosted = true;
+	lock.release();
+
+	if (mustPostDrain) { postDrain(); }
+}
+
+void CohortScheduler::drainReq1_posted(void)
+{
+	nDrains.fetch_add(1, std::memory_order_relaxed);
+
+	const auto deadline = std::chrono::steady_clock::now()
+		+ options.maxDrainDuration;
+
+	/**	EXPLANATION:
+	 * A handler may throw. If one does, the rest of its batch (already
+	 * dequeued) goes back to the front of its cohort, and we re-post
+	 * ourself before the exception propagates: drainIsPosted is still set,
+	 * so enqueue() would never post us again and the scheduler would be
+	 * wedged.
+	 */
+	struct DrainScope
+	{
+		explicit DrainScope(CohortScheduler &s) : s(s) {}
+		~DrainScope()
+		{
+			if (isFinished) { return; }
+
+			s.requeueUnrun(batchKey, batch, nRun);
+			s.postDrain();
+		}
+
+		CohortScheduler &s;
+		bool isFinished = false;
+		CallsiteKey batchKey{};
+		std::vector<Item> batch;
+		size_t nRun = 0;
+	} scope(*this);
+
+	for (;;)
+	{
+		lock.acquire();
+
+		Segment &segment = segments.front();
+		if (segment.cohorts.empty())
+		{
+			if (!segment.hasBarrier)
+			{
+				// Front segment is also the last one: nothing's pending.
+				drainIsPosted = false;
+				lock.release();
+				scope.isFinished = true;
+				return;
+			}
+
+			std::function<void()> barrier = std::move(segment.barrier);
+			segments.pop_front();
+			nPending--;
+			lock.release();
+
+			nOrderDependentHandlers.fetch_add(1, std::memory_order_relaxed);
+			barrier();
+		}
+		else
+		{
+			auto oldest = std::min_element(
+				segment.cohorts.begin(), segment.cohorts.end(),
+				[](const auto &a, const auto &b)
+				{
+					return a.second.items.front().seqNo
+						< b.second.items.front().seqNo;
+				});
+
+			Cohort &cohort = oldest->second;
+			CohortStatsEntry *stats = cohort.stats;
+			const size_t batchLimit = (nPending >= options.minDepthForCohorting)
+				? options.maxBatchSize : 1;
+
+			scope.batchKey = oldest->first;
+			while (scope.batch.size() < batchLimit && !cohort.items.empty())
+			{
+				scope.batch.push_back(std::move(cohort.items.front()));
+				cohort.items.pop_front();
+			}
+
+			if (cohort.items.empty()) { segment.cohorts.erase(oldest); }
+			nPending -= scope.batch.size();
+			lock.release();
+
+			/**	EXPLANATION:
+			 * Handlers may post() more work to us while the batch runs; it
+			 * just lands in the last segment. Nothing else drains, so the
+			 * front segment is still ours when we come back round.
+			 */
+			while (scope.nRun < scope.batch.size())
+				{ scope.batch[scope.nRun++].handler(); }
+
+			stats->nHandlers.fetch_add(
+				scope.batch.size(), std::memory_order_relaxed);
+			stats->batchSizes.record(scope.batch.size());
+			scope.batch.clear();
+			scope.nRun = 0;
+		}
+
+		if (std::chrono::steady_clock::now() >= deadline)
+		{
+			// Let the io_service's other handlers run; drainIsPosted stays set.
+			scope.isFinished = true;
+			postDrain();
+			return;
+		}
+	}
+}
+
+void CohortScheduler::requeueUnrun(
+	const CallsiteKey &key, std::vector<Item> &batch, size_t nRun
+	)
+{
+	if (nRun >= batch.size()) { return; }
+
+	lock.acquire();
+
+	/* The batch came from the front segment, which only we pop, and every
+	 * item still in its cohort is younger than the batch's.
+	 */
+	Cohort &cohort = segments.front().cohorts[key];
+	for (size_t i = batch.size(); i > nRun; i--)
+		{ cohort.items.push_front(std::move(batch[i - 1])); }
+
+	if (cohort.stats == nullptr)
+	{
+		auto it = cohortStats.find(key);
+		cohort.stats = it->second.get();
+	}
+
+	nPending += batch.size() - nRun;
+	lock.release();
+}
+
+void CohortScheduler::postDrain(void)
+{
+	thread->post(
+		STC(std::bind(
+			&CohortScheduler::drainReq1_posted, shared_from_this())));
+}
+
+CohortScheduler::Stats CohortScheduler::getStats(void)
+{
+	Stats ret{
+		nDrains.load(std::memory_order_relaxed),
+		nOrderDependentHandlers.load(std::memory_order_relaxed),
+		{}};
+
+	lock.acquire();
+	for (const auto &[key, entry] : cohortStats)
+	{
+		ret.cohorts.push_back(CohortStats{
+			entry->callsite.file_name(), entry->callsite.function_name(),
+			entry->callsite.line(),
+			entry->nHandlers.load(std::memory_order_relaxed),
+			entry->batchSizes.snapshot()});
+	}
+	lock.release();
+
+	return ret;
+}
+
+} // namespace sscl
@@ -1,9 +1,14 @@
 #include <boostAsioLinkageFix.h>
 #include <unistd.h>
+#include <alloca.h>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <pthread.h>
 #include <sched.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 #include <boost/asio/io_service.hpp>
 #include <spinscale/asynchronousContinuation.h>
 #include <spinscale/callback.h>
@@ -56,6 +61,11 @@ bool ComponentThread::tlsInitialized(void)
 	return thisComponentThread != nullptr;
 }
 
+ComponentThread *ComponentThread::getSelfPtr(void)
+{
+	return thisComponentThread.get();
+}
+
 const std::shared_ptr<ComponentThread> ComponentThread::getSelf(void)
 {
 	if (!thisComponentThread)
@@ -106,6 +116,7 @@ public:
 
 		// Execute private setup sequence here
 		// This is where each thread would implement its specific initialization
+		target->applyRealtimeConfig();
 
 		callOriginalCb();
 	}
@@ -198,10 +209,11 @@ void PuppetThread::joltThreadReq(
 	auto request = std::make_shared<ThreadLifetimeMgmtOp>(
 		mrntt, selfPtr, callback);
 
-	this->getIoService().post(
+	this->post(
 		STC(std::bind(
 			&ThreadLifetimeMgmtOp::joltThreadReq1_posted,
-			request.get(), request)));
+			request.get(), request)),
+		request.get());
 }
 
 // Thread management method implementations
@@ -212,10 +224,11 @@ void PuppetThread::startThreadReq(Callback<threadLifetimeMgmtOpCbFn> callback)
 		caller, std::static_pointer_cast<PuppetThread>(shared_from_this()),
 		callback);
 
-	this->getIoService().post(
+	this->post(
 		STC(std::bind(
 			&ThreadLifetimeMgmtOp::startThreadReq1_posted,
-			request.get(), request)));
+			request.get(), request)),
+		request.get());
 }
 
 void PuppetThread::exitThreadReq(Callback<threadLifetimeMgmtOpCbFn> callback)
@@ -225,10 +238,11 @@ void PuppetThread::exitThreadReq(Callback<threadLifetimeMgmtOpCbFn> callback)
 		caller, std::static_pointer_cast<PuppetThread>(shared_from_this()),
 		callback);
 
-	this->getIoService().post(
+	this->post(
 		STC(std::bind(
 			&ThreadLifetimeMgmtOp::exitThreadReq1_mainQueue_posted,
-			request.get(), request)));
+			request.get(), request)),
+		request.get());
 
 	pause_io_service.post(
 		STC(std::bind(
@@ -249,6 +263,11 @@ void PuppetThread::pauseThreadReq(Callback<threadLifetimeMgmtOpCbFn> callback)
 		caller, std::static_pointer_cast<PuppetThread>(shared_from_this()),
 		callback);
 
+	/**	EXPLANATION:
+	 * The PAUSE handler intentionally blocks this thread (inside
+	 * pause_io_service.run()) until it's resumed, so it mustn't be tracked as
+	 * a handler: doing so would make every paused thread look stalled.
+	 */
 	this->getIoService().post(
 		STC(std::bind(
 			&ThreadLifetimeMgmtOp::pauseThreadReq1_posted,
@@ -322,4 +341,139 @@ void PuppetThread::pinToCpu(int cpuId)
 	pinnedCpuId = cpuId;
 }
 
+namespace {
+
+#ifdef SYS_sched_setattr
+/* glibc doesn't wrap sched_setattr(), and not all versions of the UAPI
+ * headers export struct sched_attr, so we carry our own copy of it.
+ */
+struct SchedAttr
+{
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE		6
+#endif
+#endif
+
+void prefaultStack(size_t nBytes)
+{
+	/**	EXPLANATION:
+	 * Touch one byte per page in a stack frame of nBytes so that the pages
+	 * are faulted in now, rather than during a latency-critical handler.
+	 * The pages stay resident after we return since stacks never shrink.
+	 */
+	const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	volatile char *frame = static_cast<volatile char *>(alloca(nBytes));
+
+	for (size_t i = 0; i < nBytes; i += pageSize) {
+		frame[i] = 0;
+	}
+}
+
+} // anonymous namespace
+
+void PuppetThread::applyRealtimeConfig(void)
+{
+	const RealtimeConfig &cfg = realtimeConfig;
+	realtimeRefusals.clear();
+
+	auto refuse = [this](const std::string &what, int err)
+	{
+		realtimeRefusals.push_back(
+			what + ": " + std::strerror(err));
+	};
+
+	switch (cfg.policy)
+	{
+	case RealtimeConfig::Policy::INHERIT:
+		break;
+
+	case RealtimeConfig::Policy::FIFO:
+	case RealtimeConfig::Policy::RR:
+	{
+		const int policy = (cfg.policy == RealtimeConfig::Policy::FIFO)
+			? SCHED_FIFO : SCHED_RR;
+		sched_param param{};
+		param.sched_priority = cfg.priority;
+
+		int result = pthread_setschedparam(pthread_self(), policy, &param);
+		if (result != 0)
+		{
+			refuse(std::string("sched policy ")
+				+ (policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR")
+				+ " prio " + std::to_string(cfg.priority), result);
+		}
+		break;
+	}
+
+	case RealtimeConfig::Policy::DEADLINE:
+	{
+#ifdef SYS_sched_setattr
+		SchedAttr attr{};
+		attr.size = sizeof(attr);
+		attr.sched_policy = SCHED_DEADLINE;
+		attr.sched_runtime = cfg.deadlineRuntime.count();
+		attr.sched_deadline = cfg.deadlineDeadline.count();
+		attr.sched_period = cfg.deadlinePeriod.count();
+
+		if (syscall(SYS_sched_setattr, 0, &attr, 0) != 0)
+			{ refuse("sched policy SCHED_DEADLINE", errno); }
+#else
+		refuse("sched policy SCHED_DEADLINE", ENOSYS);
+#endif
+		break;
+	}
+	}
+
+	if (cfg.timerSlackNs != 0
+		&& prctl(PR_SET_TIMERSLACK, cfg.timerSlackNs, 0, 0, 0) != 0)
+	{
+		refuse("timer slack " + std::to_string(cfg.timerSlackNs) + "ns",
+			errno);
+	}
+
+	if (cfg.prefaultStackBytes != 0)
+	{
+		size_t nBytes = cfg.prefaultStackBytes;
+		pthread_attr_t attr;
+		size_t stackSize = 0;
+
+		if (pthread_getattr_np(pthread_self(), &attr) == 0)
+		{
+			pthread_attr_getstacksize(&attr, &stackSize);
+			pthread_attr_destroy(&attr);
+		}
+
+		/* Leave headroom for the frames that are already on the stack and
+		 * for whatever gets called while we're prefaulting.
+		 */
+		static constexpr size_t stackHeadroom = 64 * 1024;
+		if (stackSize <= stackHeadroom || nBytes > stackSize - stackHeadroom)
+		{
+			refuse("prefault " + std::to_string(nBytes) + " stack bytes "
+				"(stack is " + std::to_string(stackSize) + " bytes)", ERANGE);
+
+			nBytes = (stackSize > stackHeadroom)
+				? stackSize - stackHeadroom : 0;
+		}
+
+		if (nBytes > 0) { prefaultStack(nBytes); }
+	}
+
+	for (const auto &refusal : realtimeRefusals)
+	{
+		std::cerr << __func__ << ": Thread '" << name << "': could not apply "
+			<< refusal << "\n";
+	}
+}
+
 } // namespace sscl
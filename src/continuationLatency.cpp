@@ -0,0 +1,76 @@
+#include <cstdlib>
+#include <cxxabi.h>
+#include <spinscale/continuationLatency.h>
+
+namespace sscl {
+
+uint64_t ContinuationLatency::getLockWaitNs(void) const
+{
+	if (!hasBeenPosted || !hasAcquired) { return 0; }
+
+	/**	EXPLANATION:
+	 * Everything between the first post and the acquisition that wasn't
+	 * spent queued on an io_service was spent asleep, waiting for a lock.
+	 */
+	const uint64_t totalNs = std::chrono::duration_cast<
+		std::chrono::nanoseconds>(acquiredAt - firstPostedAt).count();
+
+	return totalNs > queueNs ? totalNs - queueNs : 0;
+}
+
+uint64_t ContinuationLatency::getHoldNs(Clock::time_point releasedAt) const
+{
+	if (!hasAcquired) { return 0; }
+
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		releasedAt - acquiredAt).count();
+}
+
+ContinuationLatencyRegistry::Entry &ContinuationLatencyRegistry::getEntry(
+	std::type_index type
+	)
+{
+	lock.acquire();
+
+	auto it = entries.find(type);
+	if (it == entries.end())
+	{
+		int status;
+		char *demangled = abi::__cxa_demangle(
+			type.name(), nullptr, nullptr, &status);
+
+		auto entry = std::make_unique<Entry>();
+		entry->typeName = (status == 0 ? demangled : type.name());
+		std::free(demangled);
+
+		it = entries.emplace(type, std::move(entry)).first;
+	}
+
+	Entry &entry = *it->second;
+	lock.release();
+	return entry;
+}
+
+void ContinuationLatencyRegistry::record(
+	std::type_index type, const ContinuationLatency &latency,
+	ContinuationLatency::Clock::time_point releasedAt
+	)
+{
+	Histograms &histograms = getEntry(type).histograms;
+
+	histograms.queueNs.record(latency.getQueueNs());
+	histograms.lockWaitNs.record(latency.getLockWaitNs());
+	histograms.holdNs.record(latency.getHoldNs(releasedAt));
+	histograms.nFailedAttempts.record(latency.getNFailedAttempts());
+}
+
+void ContinuationLatencyRegistry::forEach(
+	const std::function<void(const Entry &)> &fn
+	)
+{
+	lock.acquire();
+	for (const auto &[type, entry] : entries) { fn(*entry); }
+	lock.release();
+}
+
+} // namespace sscl
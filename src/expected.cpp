@@ -0,0 +1,52 @@
+#include <string>
+#include <spinscale/expected.h>
+
+namespace sscl {
+
+namespace {
+
+class SpinscaleErrorCategory
+:	public std::error_category
+{
+public:
+	const char *name(void) const noexcept override { return "spinscale"; }
+
+	std::string message(int ev) const override
+	{
+		switch (static_cast<Errc>(ev))
+		{
+		case Errc::TIMED_OUT: return "Operation timed out";
+		case Errc::CANCELLED: return "Operation cancelled";
+		case Errc::SHUTTING_DOWN: return "Component is shutting down";
+		case Errc::RESOURCE_EXHAUSTED: return "Resource exhausted";
+		case Errc::EXCEPTION_THROWN: return "Callee threw an exception";
+		}
+
+		return "Unknown spinscale error " + std::to_string(ev);
+	}
+};
+
+} // anonymous namespace
+
+const std::error_category &spinscaleCategory(void) noexcept
+{
+	static const SpinscaleErrorCategory category;
+	return category;
+}
+
+std::error_code errorCodeFromException(const std::exception_ptr &exc) noexcept
+{
+	if (!exc) { return std::error_code(); }
+
+	try {
+		std::rethrow_exception(exc);
+	}
+	catch (const std::system_error &e) {
+		return e.code();
+	}
+	catch (...) {
+		return make_error_code(Errc::EXCEPTION_THROWN);
+	}
+}
+
+} // namespace sscl
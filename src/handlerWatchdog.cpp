@@ -0,0 +1,205 @@
+#include <boostAsioLinkageFix.h>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <typeinfo>
+#include <cxxabi.h>
+#include <spinscale/handlerWatchdog.h>
+#include <spinscale/callableTracer.h>
+
+namespace sscl {
+
+HandlerWatchdog::HandlerWatchdog(
+	const std::shared_ptr<ComponentThread> &host,
+	std::chrono::milliseconds handlerSlo,
+	std::chrono::milliseconds samplePeriod)
+:	Component(host),
+handlerSlo(handlerSlo), samplePeriod(samplePeriod),
+timer(host->getIoService()),
+isRunning(false),
+nTotalStalls(0)
+{
+	if (handlerSlo.count() <= 0 || samplePeriod.count() <= 0)
+	{
+		throw std::runtime_error(std::string(__func__)
+			+ ": handlerSlo and samplePeriod must be > 0");
+	}
+}
+
+void HandlerWatchdog::watch(const std::shared_ptr<ComponentThread> &thread)
+{
+	SpinLock::Guard guard(watchedThreadsLock);
+	watchedThreads.push_back(std::make_unique<WatchedThread>(thread));
+}
+
+void HandlerWatchdog::setStallHandler(stallHandlerFn handler)
+{
+	stallHandler = std::move(handler);
+}
+
+void HandlerWatchdog::start(void)
+{
+	auto self = shared_from_this();
+	thread->post(STC([self]()
+	{
+		if (self->isRunning) { return; }
+
+		self->isRunning = true;
+		self->armTimer();
+	}));
+}
+
+void HandlerWatchdog::stop(void)
+{
+	auto self = shared_from_this();
+	thread->post(STC([self]()
+	{
+		self->isRunning = false;
+		self->timer.cancel();
+	}));
+}
+
+uint64_t HandlerWatchdog::getStallCount(ThreadId threadId) const
+{
+	SpinLock::Guard guard(watchedThreadsLock);
+
+	for (const auto &watched : watchedThreads)
+	{
+		if (watched->thread->id == threadId)
+			{ return watched->nStalls.load(std::memory_order_relaxed); }
+	}
+
+	return 0;
+}
+
+void HandlerWatchdog::armTimer(void)
+{
+	auto self = shared_from_this();
+
+	timer.expires_after(samplePeriod);
+	timer.async_wait([self](const boost::system::error_code &ec)
+	{
+		if (ec == boost::asio::error::operation_aborted || !self->isRunning)
+			{ return; }
+
+		self->sample();
+		self->armTimer();
+	});
+}
+
+void HandlerWatchdog::sample(void)
+{
+	const int64_t nowNs = ComponentThread::Heartbeat::nowNs();
+
+	/**	EXPLANATION:
+	 * We don't hold watchedThreadsLock across the stall handler, since the
+	 * stall handler is application code. The vector only ever grows and its
+	 * elements are heap allocated, so the WatchedThread objects themselves
+	 * stay put.
+	 */
+	watchedThreadsLock.acquire();
+	const size_t nWatched = watchedThreads.size();
+	watchedThreadsLock.release();
+
+	for (size_t i = 0; i < nWatched; ++i)
+	{
+		watchedThreadsLock.acquire();
+		WatchedThread &watched = *watchedThreads[i];
+		watchedThreadsLock.release();
+
+		sampleThread(watched, nowNs);
+	}
+}
+
+bool HandlerWatchdog::sampleThread(WatchedThread &watched, int64_t nowNs)
+{
+	ComponentThread::Heartbeat &hb = watched.thread->heartbeat;
+
+	const int64_t startNs = hb.outerStartNs.load(std::memory_order_acquire);
+	if (startNs == 0) { return false; }
+
+	const uint64_t seqNo = hb.outerSeqNo.load(std::memory_order_relaxed);
+	const char *callsiteFn = hb.outerCallsiteFn.load(std::memory_order_relaxed);
+	const uint_least32_t callsiteLine = hb.outerCallsiteLine.load(
+		std::memory_order_relaxed);
+
+	/* If the thread moved on to another handler while we were reading, the
+	 * fields above may be torn. That handler is brand new, so it can't have
+	 * exceeded its SLO yet anyway.
+	 */
+	if (hb.outerStartNs.load(std::memory_order_acquire) != startNs)
+		{ return false; }
+
+	const std::chrono::nanoseconds elapsed(nowNs - startNs);
+	if (elapsed < handlerSlo || seqNo == watched.lastReportedSeqNo)
+		{ return false; }
+
+	watched.lastReportedSeqNo = seqNo;
+	watched.nStalls.fetch_add(1, std::memory_order_relaxed);
+	nTotalStalls.fetch_add(1, std::memory_order_relaxed);
+
+	hb.outerContinuationLock.acquire();
+	std::shared_ptr<AsynchronousContinuationChainLink> continuation =
+		hb.outerContinuation.lock();
+	hb.outerContinuationLock.release();
+
+	StallReport report{
+		watched.thread, seqNo, elapsed, callsiteFn, callsiteLine,
+		captureContinuationChain(continuation)};
+
+	if (stallHandler) {
+		stallHandler(report);
+	} else {
+		std::cerr << formatStallReport(report);
+	}
+
+	return true;
+}
+
+std::vector<std::string> HandlerWatchdog::captureContinuationChain(
+	const std::shared_ptr<AsynchronousContinuationChainLink> &innermost
+	)
+{
+	std::vector<std::string> chain;
+
+	/**	EXPLANATION:
+	 * Walking the chain from a foreign thread is safe: each link's
+	 * callerContinuation is fixed when the link is constructed, and we hold
+	 * a sh_ptr to each link while we inspect it.
+	 */
+	for (std::shared_ptr<AsynchronousContinuationChainLink> currContin =
+			innermost;
+		currContin != nullptr;
+		currContin = currContin->getCallersContinuationShPtr())
+	{
+		const char *mangled = typeid(*currContin).name();
+		int status = -1;
+		char *demangled = abi::__cxa_demangle(
+			mangled, nullptr, nullptr, &status);
+
+		chain.emplace_back(status == 0 ? demangled : mangled);
+		std::free(demangled);
+	}
+
+	return chain;
+}
+
+std::string HandlerWatchdog::formatStallReport(const StallReport &report)
+{
+	std::ostringstream os;
+
+	os << "HandlerWatchdog: Thread '" << report.thread->name << "' stalled in "
+		"handler #" << report.handlerSeqNo << " for "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(
+			report.elapsed).count()
+		<< "ms.\n\tPosted by: "
+		<< (report.callsiteFn != nullptr ? report.callsiteFn : "<unknown>")
+		<< " at line " << report.callsiteLine << "\n";
+
+	for (const auto &link : report.continuationChain)
+		{ os << "\tContinuation: " << link << "\n"; }
+
+	return os.str();
+}
+
+} // namespace sscl
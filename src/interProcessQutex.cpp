@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cerrno>
+#include <signal.h>
+#include <boost/asio/steady_timer.hpp>
+#include <spinscale/callableTracer.h>
+#include <spinscale/interProcessQutex.h>
+
+namespace sscl {
+
+struct InterProcessQutex::AcquireOp
+:	public std::enable_shared_from_this<AcquireOp>
+{
+	AcquireOp(
+		InterProcessQutex &qutex,
+		const std::shared_ptr<ComponentThread> &thread,
+		std::function<void()> onAcquired,
+		std::chrono::microseconds maxBackoff)
+	:	qutex(qutex), thread(thread), onAcquired(std::move(onAcquired)),
+	retryTimer(thread->getIoService()),
+	backoff(std::chrono::microseconds(1)), maxBackoff(maxBackoff)
+	{}
+
+	void acquireReq1_posted(void)
+	{
+		if (qutex.tryAcquire())
+		{
+			onAcquired();
+			return;
+		}
+
+		retryTimer.expires_after(backoff);
+		backoff = std::min(backoff * 2, maxBackoff);
+		retryTimer.async_wait(
+			[self = shared_from_this()](const boost::system::error_code &ec)
+			{
+				if (ec == boost::asio::error::operation_aborted) { return; }
+				self->acquireReq1_posted();
+			});
+	}
+
+	InterProcessQutex &qutex;
+	std::shared_ptr<ComponentThread> thread;
+	std::function<void()> onAcquired;
+	boost::asio::steady_timer retryTimer;
+	std::chrono::microseconds backoff;
+	const std::chrono::microseconds maxBackoff;
+};
+
+bool InterProcessQutex::tryAcquire(void)
+{
+	uint32_t expected = FREE;
+	return word.compare_exchange_strong(
+		expected, static_cast<uint32_t>(getCachedPid()), std::memory_order_acquire);
+}
+
+void InterProcessQutex::acquire(void)
+{
+	const uint32_t self = static_cast<uint32_t>(getCachedPid());
+
+	uint32_t expected = FREE;
+	if (word.compare_exchange_strong(
+		expected, self, std::memory_order_acquire))
+		{ return; }
+
+	/**	EXPLANATION:
+	 * Once we've had to sleep, we always take the lock with WAITERS_BIT set,
+	 * since we can't know whether other sleepers remain. That costs at most
+	 * one spurious wake syscall on release.
+	 */
+	for (;;)
+	{
+		if (expected == FREE)
+		{
+			if (word.compare_exchange_weak(
+				expected, self | WAITERS_BIT, std::memory_order_acquire))
+				{ return; }
+
+			continue;
+		}
+
+		if (!(expected & WAITERS_BIT)
+			&& !word.compare_exchange_weak(
+				expected, expected | WAITERS_BIT, std::memory_order_relaxed))
+			{ continue; }
+
+		futexWait(word, expected | WAITERS_BIT);
+		expected = word.load(std::memory_order_relaxed);
+	}
+}
+
+void InterProcessQutex::release(void)
+{
+	if (word.exchange(FREE, std::memory_order_release) & WAITERS_BIT)
+		{ futexWake(word, 1); }
+}
+
+void InterProcessQutex::acquireReq(
+	const std::shared_ptr<ComponentThread> &thread,
+	std::function<void()> onAcquired,
+	std::chrono::microseconds maxBackoff)
+{
+	auto request = std::make_shared<AcquireOp>(
+		*this, thread, std::move(onAcquired), maxBackoff);
+
+	thread->post(
+		STC(std::bind(&AcquireOp::acquireReq1_posted, request)));
+}
+
+bool InterProcessQutex::releaseIfOwnerDied(void)
+{
+	uint32_t observed = word.load(std::memory_order_relaxed);
+
+	for (;;)
+	{
+		const pid_t owner = static_cast<pid_t>(observed & ~WAITERS_BIT);
+		if (owner == 0 || kill(owner, 0) == 0 || errno != ESRCH) {
+			return false;
+		}
+
+		/* Only succeeds if the word still names the same dead owner. If a
+		 * sleeper just set WAITERS_BIT, the owner is still dead: go round.
+		 */
+		if (word.compare_exchange_strong(
+			observed, FREE, std::memory_order_acq_rel))
+			{ break; }
+	}
+
+	if (observed & WAITERS_BIT) { futexWake(word, 1); }
+	return true;
+}
+
+} // namespace sscl
@@ -0,0 +1,465 @@
+#include <boostAsioLinkageFix.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <spinscale/asynchronousContinuation.h>
+#include <spinscale/callableTracer.h>
+#include <spinscale/ioUringComponent.h>
+
+namespace sscl {
+
+namespace {
+
+int ioUringSetup(unsigned nEntries, struct io_uring_params *params)
+{
+	return static_cast<int>(syscall(SYS_io_uring_setup, nEntries, params));
+}
+
+int ioUringEnter(int ringFd, unsigned nToSubmit, unsigned minComplete,
+	unsigned flags)
+{
+	return static_cast<int>(syscall(SYS_io_uring_enter,
+		ringFd, nToSubmit, minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int ringFd, unsigned opcode, const void *arg,
+	unsigned nArgs)
+{
+	return static_cast<int>(syscall(SYS_io_uring_register,
+		ringFd, opcode, arg, nArgs));
+}
+
+std::runtime_error makeErrnoError(const char *func, const std::string &what)
+{
+	return std::runtime_error(std::string(func) + ": " + what + ": "
+		+ std::strerror(errno));
+}
+
+template <class T>
+T *ringPtr(void *base, uint32_t offset)
+	{ return reinterpret_cast<T *>(static_cast<char *>(base) + offset); }
+
+} // anonymous namespace
+
+/**	EXPLANATION:
+ * Pointers into the mmap()ed SQ and CQ rings. The head/tail indices are
+ * shared with the kernel, so they're accessed through std::atomic_ref with
+ * acquire/release ordering.
+ */
+struct IoUringComponent::Ring
+{
+	explicit Ring(unsigned nEntries)
+	{
+		struct io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+
+		fd = ioUringSetup(nEntries, &params);
+		if (fd < 0)
+			{ throw makeErrnoError(__func__, "io_uring_setup() failed"); }
+
+		sqRingSize = params.sq_off.array
+			+ params.sq_entries * sizeof(uint32_t);
+		cqRingSize = params.cq_off.cqes
+			+ params.cq_entries * sizeof(struct io_uring_cqe);
+
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			if (cqRingSize > sqRingSize) { sqRingSize = cqRingSize; }
+			cqRingSize = sqRingSize;
+		}
+
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sqRing == MAP_FAILED)
+		{
+			close(fd);
+			throw makeErrnoError(__func__, "mmap() of SQ ring failed");
+		}
+
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			cqRing = sqRing;
+		}
+		else
+		{
+			cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if (cqRing == MAP_FAILED)
+			{
+				munmap(sqRing, sqRingSize);
+				close(fd);
+				throw makeErrnoError(__func__, "mmap() of CQ ring failed");
+			}
+		}
+
+		sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		void *sqesMapping = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqesMapping == MAP_FAILED)
+		{
+			if (cqRing != sqRing) { munmap(cqRing, cqRingSize); }
+			munmap(sqRing, sqRingSize);
+			close(fd);
+			throw makeErrnoError(__func__, "mmap() of SQEs failed");
+		}
+
+		sqes = static_cast<struct io_uring_sqe *>(sqesMapping);
+		sqHead = ringPtr<uint32_t>(sqRing, params.sq_off.head);
+		sqTail = ringPtr<uint32_t>(sqRing, params.sq_off.tail);
+		sqMask = *ringPtr<uint32_t>(sqRing, params.sq_off.ring_mask);
+		sqArray = ringPtr<uint32_t>(sqRing, params.sq_off.array);
+		sqEntries = params.sq_entries;
+
+		cqHead = ringPtr<uint32_t>(cqRing, params.cq_off.head);
+		cqTail = ringPtr<uint32_t>(cqRing, params.cq_off.tail);
+		cqMask = *ringPtr<uint32_t>(cqRing, params.cq_off.ring_mask);
+		cqes = ringPtr<struct io_uring_cqe>(cqRing, params.cq_off.cqes);
+		cqEntries = params.cq_entries;
+	}
+
+	~Ring()
+	{
+		munmap(sqes, sqesSize);
+		if (cqRing != sqRing) { munmap(cqRing, cqRingSize); }
+		munmap(sqRing, sqRingSize);
+		close(fd);
+	}
+
+	// Returns nullptr if the SQ is full.
+	struct io_uring_sqe *getSqe(void)
+	{
+		const uint32_t head = std::atomic_ref<uint32_t>(*sqHead)
+			.load(std::memory_order_acquire);
+		const uint32_t tail = *sqTail;
+
+		if (tail - head >= sqEntries) { return nullptr; }
+
+		struct io_uring_sqe *sqe = &sqes[tail & sqMask];
+		std::memset(sqe, 0, sizeof(*sqe));
+		sqArray[tail & sqMask] = tail & sqMask;
+		std::atomic_ref<uint32_t>(*sqTail).store(
+			tail + 1, std::memory_order_release);
+
+		return sqe;
+	}
+
+	int fd;
+	size_t sqRingSize, cqRingSize, sqesSize;
+	void *sqRing, *cqRing;
+	struct io_uring_sqe *sqes;
+	uint32_t *sqHead, *sqTail, *sqArray, sqMask, sqEntries;
+	uint32_t *cqHead, *cqTail, cqMask, cqEntries;
+	struct io_uring_cqe *cqes;
+};
+
+class IoUringComponent::IoOp
+:	public PostedAsynchronousContinuation<ioOpCbFn>
+{
+public:
+	IoOp(
+		const std::shared_ptr<ComponentThread> &caller,
+		Callback<ioOpCbFn> callback,
+		uint8_t opcode, int fd, const void *buf, size_t len, uint64_t offset)
+	:	PostedAsynchronousContinuation<ioOpCbFn>(caller, callback),
+	opcode(opcode), fd(fd), buf(buf), len(len), offset(offset),
+	bufIndex(0), sqeFlags(0), fsyncFlags(0)
+	{}
+
+	void fillSqe(struct io_uring_sqe &sqe) const
+	{
+		sqe.opcode = opcode;
+		sqe.flags = sqeFlags;
+		sqe.fd = fd;
+		sqe.addr = reinterpret_cast<uint64_t>(buf);
+		sqe.len = static_cast<uint32_t>(len);
+		sqe.off = offset;
+		sqe.buf_index = bufIndex;
+		sqe.fsync_flags = fsyncFlags;
+	}
+
+public:
+	uint8_t opcode;
+	int fd;
+	const void *buf;
+	size_t len;
+	uint64_t offset;
+	uint16_t bufIndex;
+	uint8_t sqeFlags;
+	uint32_t fsyncFlags;
+	// Keeps pool-backed payloads alive while the kernel is using them.
+	BufferPool::Slice payload;
+};
+
+IoUringComponent::IoUringComponent(
+	const std::shared_ptr<ComponentThread> &thread, unsigned nEntries)
+:	Component(thread),
+ring(std::make_unique<Ring>(nEntries)),
+eventFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+eventFdDescriptor(thread->getIoService()),
+eventFdReadBuf(0),
+nQueuedSqes(0), nInFlight(0), flushIsScheduled(false),
+nSubmitted(0), nSubmitCalls(0), nCompleted(0)
+{
+	if (eventFd < 0)
+		{ throw makeErrnoError(__func__, "eventfd() failed"); }
+
+	if (ioUringRegister(ring->fd, IORING_REGISTER_EVENTFD, &eventFd, 1) < 0)
+	{
+		close(eventFd);
+		throw makeErrnoError(__func__, "IORING_REGISTER_EVENTFD failed");
+	}
+
+	// The descriptor takes ownership of eventFd and closes it.
+	eventFdDescriptor.assign(eventFd);
+}
+
+IoUringComponent::~IoUringComponent() = default;
+
+void IoUringComponent::start(void)
+{
+	auto self = shared_from_this();
+	thread->post(STC([self]() { self->armCompletionWatch(); }));
+}
+
+void IoUringComponent::registerFiles(const std::vector<int> &fds)
+{
+	if (ioUringRegister(ring->fd, IORING_REGISTER_FILES,
+		fds.data(), static_cast<unsigned>(fds.size())) < 0)
+	{
+		throw makeErrnoError(__func__, "IORING_REGISTER_FILES failed");
+	}
+}
+
+void IoUringComponent::registerBuffers(
+	const std::vector<struct iovec> &buffers
+	)
+{
+	if (ioUringRegister(ring->fd, IORING_REGISTER_BUFFERS,
+		buffers.data(), static_cast<unsigned>(buffers.size())) < 0)
+	{
+		throw makeErrnoError(__func__, "IORING_REGISTER_BUFFERS failed");
+	}
+}
+
+void IoUringComponent::readReq(
+	int fd, void *buf, size_t len, uint64_t offset,
+	Callback<ioOpCbFn> callback
+	)
+{
+	submitReq(std::make_shared<IoOp>(
+		ComponentThread::getSelf(), callback,
+		IORING_OP_READ, fd, buf, len, offset));
+}
+
+void IoUringComponent::writeReq(
+	int fd, const void *buf, size_t len, uint64_t offset,
+	Callback<ioOpCbFn> callback
+	)
+{
+	submitReq(std::make_shared<IoOp>(
+		ComponentThread::getSelf(), callback,
+		IORING_OP_WRITE, fd, buf, len, offset));
+}
+
+void IoUringComponent::readReq(
+	int fd, const BufferPool::Slice &slice, uint64_t offset,
+	Callback<ioOpCbFn> callback
+	)
+{
+	auto op = std::make_shared<IoOp>(
+		ComponentThread::getSelf(), callback,
+		IORING_OP_READ, fd, slice.data(), slice.size(), offset);
+
+	op->payload = slice;
+	submitReq(op);
+}
+
+void IoUringComponent::writeReq(
+	int fd, const BufferPool::Slice &slice, uint64_t offset,
+	Callback<ioOpCbFn> callback
+	)
+{
+	auto op = std::make_shared<IoOp>(
+		ComponentThread::getSelf(), callback,
+		IORING_OP_WRITE, fd, slice.data(), slice.size(), offset);
+
+	op->payload = slice;
+	submitReq(op);
+}
+
+void IoUringComponent::fsyncReq(
+	int fd, bool dataOnly, Callback<ioOpCbFn> callback
+	)
+{
+	auto op = std::make_shared<IoOp>(
+		ComponentThread::getSelf(), callback,
+		IORING_OP_FSYNC, fd, nullptr, 0, 0);
+
+	if (dataOnly) { op->fsyncFlags = IORING_FSYNC_DATASYNC; }
+	submitReq(op);
+}
+
+void IoUringComponent::readFixedReq(
+	unsigned fileIndex, unsigned bufIndex,
+	void *buf, size_t len, uint64_t offset,
+	Callback<ioOpCbFn> callback
+	)
+{
+	auto op = std::make_shared<IoOp>(
+		ComponentThread::getSelf(), callback,
+		IORING_OP_READ_FIXED, static_cast<int>(fileIndex), buf, len, offset);
+
+	op->bufIndex = static_cast<uint16_t>(bufIndex);
+	op->sqeFlags = IOSQE_FIXED_FILE;
+	submitReq(op);
+}
+
+void IoUringComponent::writeFixedReq(
+	unsigned fileIndex, unsigned bufIndex,
+	const void *buf, size_t len, uint64_t offset,
+	Callback<ioOpCbFn> callback
+	)
+{
+	auto op = std::make_shared<IoOp>(
+		ComponentThread::getSelf(), callback,
+		IORING_OP_WRITE_FIXED, static_cast<int>(fileIndex), buf, len, offset);
+
+	op->bufIndex = static_cast<uint16_t>(bufIndex);
+	op->sqeFlags = IOSQE_FIXED_FILE;
+	submitReq(op);
+}
+
+void IoUringComponent::submitReq(const std::shared_ptr<IoOp> &op)
+{
+	thread->post(
+		STC(std::bind(
+			&IoUringComponent::submitReq1_posted,
+			shared_from_this(), op)),
+		op.get());
+}
+
+void IoUringComponent::submitReq1_posted(std::shared_ptr<IoOp> op)
+{
+	backlog.push_back(std::move(op));
+
+	/**	EXPLANATION:
+	 * Rather than calling io_uring_enter() once per request, we defer the
+	 * flush to a handler posted behind the requests which are already queued
+	 * on this thread. Every request which is handled before the flush runs
+	 * gets submitted by the same syscall.
+	 */
+	if (flushIsScheduled) { return; }
+
+	flushIsScheduled = true;
+	auto self = shared_from_this();
+	thread->post(STC([self]() { self->flushSubmissions(); }));
+}
+
+void IoUringComponent::flushSubmissions(void)
+{
+	flushIsScheduled = false;
+
+	/* Don't let more ops be in flight than the CQ can hold, or the kernel
+	 * would have to buffer overflowed completions for us.
+	 */
+	size_t nMoved = 0;
+	for (; nMoved < backlog.size(); ++nMoved)
+	{
+		if (nInFlight + nQueuedSqes >= ring->cqEntries) { break; }
+
+		struct io_uring_sqe *sqe = ring->getSqe();
+		if (sqe == nullptr) { break; }
+
+		backlog[nMoved]->fillSqe(*sqe);
+		// Ownership of this sh_ptr is released in reapCompletions().
+		sqe->user_data = reinterpret_cast<uint64_t>(
+			new std::shared_ptr<IoOp>(std::move(backlog[nMoved])));
+		++nQueuedSqes;
+	}
+
+	backlog.erase(backlog.begin(), backlog.begin() + nMoved);
+
+	if (nQueuedSqes == 0) { return; }
+
+	int nConsumed = ioUringEnter(ring->fd, nQueuedSqes, 0, 0);
+	if (nConsumed < 0)
+	{
+		if (errno == EAGAIN || errno == EBUSY || errno == EINTR)
+		{
+			/* Retry once some completions have been reaped; or straight
+			 * away if there's nothing in flight to wake us up later.
+			 */
+			if (nInFlight == 0 && !flushIsScheduled)
+			{
+				flushIsScheduled = true;
+				auto self = shared_from_this();
+				thread->post(STC([self]() { self->flushSubmissions(); }));
+			}
+
+			return;
+		}
+
+		throw makeErrnoError(__func__, "io_uring_enter() failed");
+	}
+
+	nQueuedSqes -= static_cast<unsigned>(nConsumed);
+	nInFlight += static_cast<unsigned>(nConsumed);
+	nSubmitted.fetch_add(nConsumed, std::memory_order_relaxed);
+	nSubmitCalls.fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned IoUringComponent::reapCompletions(void)
+{
+	unsigned nReaped = 0;
+	uint32_t head = std::atomic_ref<uint32_t>(*ring->cqHead)
+		.load(std::memory_order_relaxed);
+
+	for (;;)
+	{
+		const uint32_t tail = std::atomic_ref<uint32_t>(*ring->cqTail)
+			.load(std::memory_order_acquire);
+		if (head == tail) { break; }
+
+		const struct io_uring_cqe &cqe = ring->cqes[head & ring->cqMask];
+		std::unique_ptr<std::shared_ptr<IoOp>> op(
+			reinterpret_cast<std::shared_ptr<IoOp> *>(cqe.user_data));
+		const int result = cqe.res;
+
+		++head;
+		std::atomic_ref<uint32_t>(*ring->cqHead).store(
+			head, std::memory_order_release);
+
+		(*op)->callOriginalCb(result);
+		++nReaped;
+	}
+
+	nInFlight -= nReaped;
+	nCompleted.fetch_add(nReaped, std::memory_order_relaxed);
+
+	if ((!backlog.empty() || nQueuedSqes > 0) && nReaped > 0)
+		{ flushSubmissions(); }
+
+	return nReaped;
+}
+
+void IoUringComponent::armCompletionWatch(void)
+{
+	auto self = shared_from_this();
+
+	eventFdDescriptor.async_read_some(
+		boost::asio::buffer(&eventFdReadBuf, sizeof(eventFdReadBuf)),
+		[self](const boost::system::error_code &ec, size_t)
+		{
+			if (ec == boost::asio::error::operation_aborted) { return; }
+
+			self->reapCompletions();
+			self->armCompletionWatch();
+		});
+}
+
+} // namespace sscl
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <spinscale/callableTracer.h>
+#include <spinscale/lightweightComponent.h>
+
+namespace sscl {
+
+LightweightComponentScheduler::LightweightComponentScheduler(
+	const std::vector<std::shared_ptr<ComponentThread>> &threads,
+	unsigned int quantum)
+:	threads(threads), quantum(quantum), nextId(0)
+{
+	if (threads.empty() || quantum == 0)
+	{
+		throw std::invalid_argument(std::string(__func__)
+			+ ": Need at least one thread and a non-zero quantum");
+	}
+}
+
+LightweightComponent::LightweightComponent(
+	LightweightComponentScheduler &scheduler)
+:	id(scheduler.allocateId()),
+homeThread(scheduler.getThreadFor(id)),
+quantum(scheduler.getQuantum()),
+drainPos(0)
+{
+}
+
+void LightweightComponent::post(messageFn message)
+{
+	if (!mailbox.emplace(std::move(message))) { return; }
+
+	homeThread->post(
+		STC(std::bind(&LightweightComponent::runQuantum, shared_from_this())));
+}
+
+void LightweightComponent::runQuantum(void)
+{
+	/**	EXPLANATION:
+	 * We take the whole mailbox in one go. Whatever's left of the batch after
+	 * this quantum is run on our next turn, before anything that was posted
+	 * since.
+	 */
+	std::vector<messageFn> &draining = mailbox.getDraining();
+	if (drainPos == draining.size())
+	{
+		mailbox.takeAll();
+		drainPos = 0;
+	}
+
+	/**	EXPLANATION:
+	 * A message may throw. drainPos is advanced before each one runs, so the
+	 * thrower isn't run again, and the scope below reschedules us (or lets
+	 * the mailbox go idle) on the way out regardless. Otherwise we'd stay
+	 * marked as scheduled without being queued, and our mailbox would be
+	 * dead.
+	 */
+	struct RescheduleScope
+	{
+		explicit RescheduleScope(LightweightComponent &c) : c(c) {}
+		~RescheduleScope() { c.rescheduleOrIdle(); }
+
+		LightweightComponent &c;
+	} rescheduleScope(*this);
+
+	const size_t end = std::min(draining.size(), drainPos + quantum);
+	while (drainPos < end)
+	{
+		messageFn message = std::move(draining[drainPos++]);
+		message();
+	}
+}
+
+void LightweightComponent::rescheduleOrIdle(void)
+{
+	if (drainPos == mailbox.getDraining().size() && mailbox.tryGoIdle())
+		{ return; }
+
+	// Go to the back of the line so other components on this thread get a turn.
+	homeThread->post(
+		STC(std::bind(&LightweightComponent::runQuantum, shared_from_this())));
+}
+
+} // namespace sscl
@@ -0,0 +1,90 @@
+#include <sched.h>
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <spinscale/numaTopology.h>
+
+namespace sscl {
+
+NumaTopology::NumaTopology(void)
+{
+	namespace fs = std::filesystem;
+	const fs::path nodesDir("/sys/devices/system/node");
+	std::error_code ec;
+
+	for (const auto &dirent : fs::directory_iterator(nodesDir, ec))
+	{
+		const std::string name = dirent.path().filename().string();
+		if (name.rfind("node", 0) != 0 || name.size() == 4
+			|| name.find_first_not_of("0123456789", 4) != std::string::npos)
+			{ continue; }
+
+		std::ifstream cpuListFile(dirent.path() / "cpulist");
+		std::string cpuList;
+		if (!std::getline(cpuListFile, cpuList)) { continue; }
+
+		/**	EXPLANATION:
+		 * Node ids can have gaps, and memory-only nodes have no CPUs. Both
+		 * are kept as empty nodes so that node ids match the kernel's.
+		 */
+		const unsigned int node = std::stoul(name.substr(4));
+		if (node >= nodeCpus.size()) { nodeCpus.resize(node + 1); }
+		nodeCpus[node] = parseCpuList(cpuList);
+	}
+
+	if (nodeCpus.empty())
+	{
+		long nCpus = sysconf(_SC_NPROCESSORS_CONF);
+		nodeCpus.resize(1);
+		for (long cpu = 0; cpu < (nCpus > 0 ? nCpus : 1); cpu++)
+			{ nodeCpus[0].push_back(cpu); }
+	}
+
+	for (unsigned int node = 0; node < nodeCpus.size(); node++)
+	{
+		for (int cpu : nodeCpus[node])
+		{
+			if (static_cast<size_t>(cpu) >= cpuToNode.size())
+				{ cpuToNode.resize(cpu + 1, 0); }
+
+			cpuToNode[cpu] = node;
+		}
+	}
+}
+
+std::vector<int> NumaTopology::parseCpuList(const std::string &cpuList)
+{
+	std::vector<int> cpus;
+	std::istringstream ranges(cpuList);
+	std::string range;
+
+	while (std::getline(ranges, range, ','))
+	{
+		if (range.empty()) { continue; }
+
+		try {
+			const size_t dash = range.find('-');
+			const int first = std::stoi(range.substr(0, dash));
+			const int last = (dash == std::string::npos)
+				? first : std::stoi(range.substr(dash + 1));
+
+			for (int cpu = first; cpu <= last; cpu++) { cpus.push_back(cpu); }
+		}
+		catch (const std::logic_error &) {
+			throw std::invalid_argument(std::string(__func__)
+				+ ": Malformed CPU list: '" + cpuList + "'");
+		}
+	}
+
+	return cpus;
+}
+
+unsigned int NumaTopology::getCurrentNode(void) const
+{
+	return getNodeOfCpu(sched_getcpu());
+}
+
+} // namespace sscl
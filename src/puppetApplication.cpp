@@ -1,4 +1,7 @@
+#include <cerrno>
+#include <cstring>
 #include <iostream>
+#include <sys/mman.h>
 #include <spinscale/asynchronousContinuation.h>
 #include <spinscale/asynchronousLoop.h>
 #include <spinscale/callback.h>
@@ -55,6 +58,32 @@ public:
 		callOriginalCb();
 	}
 
+	void startAllPuppetThreadsReq1(
+		[[maybe_unused]] std::shared_ptr<PuppetThreadLifetimeMgmtOp> context
+		)
+	{
+		loop.incrementSuccessOrFailureDueTo(true);
+		if (!loop.isComplete()) {
+			return;
+		}
+
+		// Every thread has applied its RealtimeConfig by now.
+		for (auto& thread : parent.componentThreads)
+		{
+			for (const auto &refusal : thread->getRealtimeRefusals()) {
+				parent.realtimeRefusals.push_back(thread->name + ": " + refusal);
+			}
+		}
+
+		if (!parent.realtimeRefusals.empty())
+		{
+			std::cerr << "Mrntt: " << parent.realtimeRefusals.size()
+				<< " realtime setting(s) were refused by the kernel.\n";
+		}
+
+		callOriginalCb();
+	}
+
 	void exitAllPuppetThreadsReq1(
 		[[maybe_unused]] std::shared_ptr<PuppetThreadLifetimeMgmtOp> context
 		)
@@ -110,6 +139,15 @@ void PuppetApplication::startAllPuppetThreadsReq(
 	Callback<puppetThreadLifetimeMgmtOpCbFn> callback
 	)
 {
+	realtimeRefusals.clear();
+
+	if (lockAllMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		realtimeRefusals.push_back(
+			std::string("process: mlockall(MCL_CURRENT | MCL_FUTURE): ")
+			+ std::strerror(errno));
+	}
+
 	// If no threads, call callback immediately
 	if (componentThreads.size() == 0 && callback.callbackFn)
 	{
@@ -125,7 +163,7 @@ void PuppetApplication::startAllPuppetThreadsReq(
 	{
 		thread->startThreadReq(
 			{request, std::bind(
-				&PuppetThreadLifetimeMgmtOp::executeGenericOpOnAllPuppetThreadsReq1,
+				&PuppetThreadLifetimeMgmtOp::startAllPuppetThreadsReq1,
 				request.get(), request)});
 	}
 }
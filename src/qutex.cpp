@@ -1,5 +1,7 @@
+#include <chrono>
 #include <spinscale/qutex.h>
 #include <spinscale/lockerAndInvokerBase.h>
+#include <spinscale/componentThread.h>
 
 namespace sscl {
 
@@ -28,6 +30,43 @@ bool Qutex::tryAcquire(
 		return false;
 	}
 
+#ifdef CONFIG_ENABLE_RECORD_REPLAY
+	RecordReplay::EventId expectedAcquirer = 0;
+	switch (RecordReplay::checkQutexAcquirer(
+		*this, tryingLockvoker.getRecordReplayId(), expectedAcquirer))
+	{
+	case RecordReplay::QutexVerdict::ADMIT:
+		grantTo(tryingLockvoker);
+		lock.release();
+		return true;
+
+	case RecordReplay::QutexVerdict::REFUSE:
+	{
+		/**	EXPLANATION:
+		 * The Qutex is free but reserved for a continuation that acquired it
+		 * next in the recording. If that one is already queued, it may be
+		 * asleep waiting for a release that isn't coming, so wake it up.
+		 */
+		std::shared_ptr<LockerAndInvokerBase> expected;
+		for (const auto &lockvoker : queue)
+		{
+			if (lockvoker->getRecordReplayId() == expectedAcquirer)
+			{
+				expected = lockvoker;
+				break;
+			}
+		}
+
+		lock.release();
+		if (expected != nullptr) { expected->awaken(); }
+		return false;
+	}
+
+	case RecordReplay::QutexVerdict::UNCONSTRAINED:
+		break;
+	}
+#endif
+
 	/**	EXPLANATION:
 	 * Calculate how many items from the rear we need to scan
 	 *
@@ -42,12 +81,7 @@ bool Qutex::tryAcquire(
 	// results in 0 rear items to scan, we automatically succeed
 	if (qNItems == 1 || nRearItemsToScan < 1)
 	{
-		isOwned = true;
-#ifdef CONFIG_ENABLE_DEBUG_LOCKS
-		// Use the stored iterator from the LockSet
-		auto it = tryingLockvoker.getLockvokerIteratorForQutex(*this);
-		currOwner = *it;
-#endif
+		grantTo(tryingLockvoker);
 		lock.release();
 		return true;
 	}
@@ -59,10 +93,7 @@ bool Qutex::tryAcquire(
 
 		if ((*queue.front()) == tryingLockvoker)
 		{
-			isOwned = true;
-#ifdef CONFIG_ENABLE_DEBUG_LOCKS
-			currOwner = queue.front();
-#endif
+			grantTo(tryingLockvoker);
 			ret = true;
 		}
 		else {
@@ -96,14 +127,25 @@ bool Qutex::tryAcquire(
 	}
 
 	// Not found in rear portion - must be in top X%, so succeed
+	grantTo(tryingLockvoker);
+	lock.release();
+	return true;
+}
+
+void Qutex::grantTo(const LockerAndInvokerBase &newOwner)
+{
 	isOwned = true;
+	bumpVersionOnAcquire();
+#ifdef CONFIG_ENABLE_QUTEX_STATS
+	noteAcquired();
+#endif
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
 	// Use the stored iterator from the LockSet
-	auto it = tryingLockvoker.getLockvokerIteratorForQutex(*this);
+	auto it = newOwner.getLockvokerIteratorForQutex(*this);
 	currOwner = *it;
+#else
+	(void)newOwner;
 #endif
-	lock.release();
-	return true;
 }
 
 void Qutex::backoff(
@@ -250,11 +292,20 @@ void Qutex::backoff(
 	}
 
 	isOwned = false;
+	bumpVersionOnRelease();
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
 	currOwner = nullptr;
 #endif
 	LockerAndInvokerBase &newFront = *queue.front();
 
+#ifdef CONFIG_QUTEX_IDLE_AWARE_WAKEUP
+	std::shared_ptr<LockerAndInvokerBase> idleWaiter;
+	if (nQItems > 1) { idleWaiter = pickIdleWaiter(&failedAcquirer); }
+#endif
+#ifdef CONFIG_ENABLE_QUTEX_STATS
+	if (nQItems > 1) { noteFreedWithWaiters(); }
+#endif
+
 	lock.release();
 
 	/**	EXPLANATION:
@@ -306,6 +357,10 @@ void Qutex::backoff(
 	if (nQItems > 1) {
 		newFront.awaken();
 	}
+
+#ifdef CONFIG_QUTEX_IDLE_AWARE_WAKEUP
+	if (idleWaiter != nullptr) { idleWaiter->awaken(); }
+#endif
 }
 
 void Qutex::release()
@@ -330,6 +385,7 @@ void Qutex::release()
 	}
 
 	isOwned = false;
+	bumpVersionOnRelease();
 #ifdef CONFIG_ENABLE_DEBUG_LOCKS
 	currOwner = nullptr;
 #endif
@@ -372,9 +428,103 @@ void Qutex::release()
 	 */
 	LockerAndInvokerBase &front = *queue.front();
 
+#ifdef CONFIG_QUTEX_IDLE_AWARE_WAKEUP
+	std::shared_ptr<LockerAndInvokerBase> idleWaiter = pickIdleWaiter(nullptr);
+#endif
+#ifdef CONFIG_ENABLE_QUTEX_STATS
+	noteFreedWithWaiters();
+#endif
+
 	lock.release();
 
 	front.awaken();
+
+#ifdef CONFIG_QUTEX_IDLE_AWARE_WAKEUP
+	if (idleWaiter != nullptr) { idleWaiter->awaken(); }
+#endif
 }
 
+#ifdef CONFIG_QUTEX_IDLE_AWARE_WAKEUP
+std::shared_ptr<LockerAndInvokerBase> Qutex::pickIdleWaiter(
+	const LockerAndInvokerBase *exclude
+	)
+{
+	/**	EXPLANATION:
+	 * Must be called with `lock` held, on a non-empty queue.
+	 *
+	 * The front waiter is always awakened by our callers, because that's
+	 * what guarantees forward progress (see the comments in release() and
+	 * backoff()). But if the front waiter's thread has a deep queue, the
+	 * Qutex will sit free-but-unclaimed until that thread gets around to
+	 * running it. So we look a little way behind the front for a waiter
+	 * which:
+	 *	* Would be admitted by tryAcquire() from its current position. Since
+	 *	  single-lock waiters are only admitted at the front, only
+	 *	  multi-lock waiters qualify.
+	 *	* Is targeted at a thread that's idle or nearly so.
+	 * If we find one, our caller wakes it as well. Whoever runs first gets
+	 * the Qutex; the other fails and goes back to sleep, as with any other
+	 * spurious wakeup. So this never admits a waiter that the admission
+	 * policy wouldn't, it only changes which of the admissible waiters is
+	 * likely to get there first.
+	 */
+	ComponentThread *frontThread = queue.front()->getTargetThread();
+	if (frontThread == nullptr || frontThread->isIdleOrNearlyIdle())
+		{ return nullptr; }
+
+	const int qNItems = static_cast<int>(queue.size());
+	auto it = std::next(queue.begin());
+
+	for (int pos = 1;
+		pos <= maxIdleAwareWakeupScan && it != queue.end();
+		++pos, ++it)
+	{
+		LockerAndInvokerBase &candidate = **it;
+		const int nRequiredLocks = static_cast<int>(
+			candidate.getLockSetSize());
+
+		if (nRequiredLocks < 2) { continue; }
+		if (exclude != nullptr && candidate == *exclude) { continue; }
+
+		// Same computation as tryAcquire(): must not be in the rear n/r items.
+		const int nRearItems = qNItems / nRequiredLocks;
+		if (pos >= qNItems - nRearItems) { continue; }
+
+		ComponentThread *thread = candidate.getTargetThread();
+		if (thread == nullptr || !thread->isIdleOrNearlyIdle()) { continue; }
+
+#ifdef CONFIG_ENABLE_QUTEX_STATS
+		nIdleAwareWakeups.fetch_add(1, std::memory_order_relaxed);
+#endif
+		return *it;
+	}
+
+	return nullptr;
+}
+#endif
+
+#ifdef CONFIG_ENABLE_QUTEX_STATS
+static int64_t qutexStatsNowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Both of these must be called with `lock` held.
+void Qutex::noteFreedWithWaiters()
+{
+	freedWithWaitersAtNs = qutexStatsNowNs();
+}
+
+void Qutex::noteAcquired()
+{
+	if (freedWithWaitersAtNs == 0) { return; }
+
+	nGrantsToWaiters.fetch_add(1, std::memory_order_relaxed);
+	idleWhileGrantedNs.fetch_add(
+		qutexStatsNowNs() - freedWithWaitersAtNs, std::memory_order_relaxed);
+	freedWithWaitersAtNs = 0;
+}
+#endif
+
 } // namespace sscl
@@ -0,0 +1,67 @@
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <spinscale/cacheLine.h>
+#include <spinscale/qutexArena.h>
+
+namespace sscl {
+
+static_assert(sizeof(Qutex) % cacheLineSize == 0,
+	"Qutexes in an arena must not share cache lines");
+
+QutexArena::QutexArena(size_t nQutexes, const std::string &namePrefix)
+:	nQutexes(nQutexes), qutexes(nullptr)
+{
+	if (nQutexes == 0)
+	{
+		throw std::invalid_argument(std::string(__func__)
+			+ ": nQutexes must be > 0");
+	}
+
+	qutexes = static_cast<Qutex *>(
+		std::aligned_alloc(alignof(Qutex), sizeof(Qutex) * nQutexes));
+	if (qutexes == nullptr) { throw std::bad_alloc(); }
+
+	size_t nConstructed = 0;
+	try {
+		for (; nConstructed < nQutexes; ++nConstructed)
+		{
+			new (&qutexes[nConstructed]) Qutex(
+				namePrefix + std::to_string(nConstructed));
+		}
+	}
+	catch (...)
+	{
+		while (nConstructed > 0) { qutexes[--nConstructed].~Qutex(); }
+		std::free(qutexes);
+		throw;
+	}
+}
+
+QutexArena::~QutexArena()
+{
+	for (size_t i = nQutexes; i > 0; --i) { qutexes[i - 1].~Qutex(); }
+	std::free(qutexes);
+}
+
+std::vector<std::reference_wrapper<Qutex>> QutexArena::getQutexes(
+	const std::vector<size_t> &indices)
+{
+	std::vector<std::reference_wrapper<Qutex>> ret;
+	ret.reserve(indices.size());
+
+	for (size_t i : indices)
+	{
+		if (i >= nQutexes)
+		{
+			throw std::out_of_range(std::string(__func__)
+				+ ": Qutex index " + std::to_string(i) + " is out of range");
+		}
+
+		ret.push_back(std::ref(qutexes[i]));
+	}
+
+	return ret;
+}
+
+} // namespace sscl
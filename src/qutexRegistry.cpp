@@ -0,0 +1,70 @@
+#include <functional>
+#include <queue>
+#include <vector>
+#include <spinscale/spinLock.h>
+#include <spinscale/qutexRegistry.h>
+
+namespace sscl {
+
+namespace {
+
+/* Function-local, since Qutexes with static storage duration allocate ids
+ * during static initialization.
+ */
+struct RegistryState
+{
+	SpinLock lock;
+	// Guarded by lock.
+	uint32_t nextNewId = 0;
+	uint32_t nIdsInUse = 0;
+	std::priority_queue<
+		uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> freeIds;
+};
+
+RegistryState &getState(void)
+{
+	static RegistryState state;
+	return state;
+}
+
+} // namespace
+
+uint32_t QutexRegistry::allocateId(void)
+{
+	RegistryState &state = getState();
+	uint32_t id;
+
+	state.lock.acquire();
+	if (!state.freeIds.empty())
+	{
+		id = state.freeIds.top();
+		state.freeIds.pop();
+	}
+	else { id = state.nextNewId++; }
+	state.nIdsInUse++;
+	state.lock.release();
+
+	return id;
+}
+
+void QutexRegistry::releaseId(uint32_t id)
+{
+	RegistryState &state = getState();
+
+	state.lock.acquire();
+	state.freeIds.push(id);
+	state.nIdsInUse--;
+	state.lock.release();
+}
+
+uint32_t QutexRegistry::getNIdsInUse(void)
+{
+	RegistryState &state = getState();
+
+	state.lock.acquire();
+	const uint32_t ret = state.nIdsInUse;
+	state.lock.release();
+	return ret;
+}
+
+} // namespace sscl
@@ -0,0 +1,613 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <spinscale/componentThread.h>
+#include <spinscale/qutex.h>
+#include <spinscale/recordReplay.h>
+#include <spinscale/spinLock.h>
+
+namespace sscl {
+
+std::atomic<RecordReplay::Mode> RecordReplay::mode{RecordReplay::Mode::OFF};
+std::atomic<uint32_t> RecordReplay::nextQutexOrdinal{0};
+
+namespace {
+
+constexpr char logMagic[8] = { 'S', 'S', 'C', 'L', 'R', 'R', 'L', 'G' };
+constexpr uint32_t logVersion = 1;
+// How often the recorder's writer thread collects and writes out events.
+constexpr std::chrono::milliseconds recordWriterInterval(10);
+
+struct LogHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t eventSize;
+};
+static_assert(sizeof(LogHeader) == 16);
+
+int64_t nowNs(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct SequencedEvent
+{
+	uint64_t seq;
+	RecordReplay::Event event;
+};
+
+// One per appending thread per recording; only contended by the writer.
+struct AppenderBuffer
+{
+	SpinLock lock;
+	// Guarded by lock.
+	std::vector<SequencedEvent> events;
+};
+
+/**	EXPLANATION:
+ * Appenders are called from inside the posting and Qutex critical sections,
+ * so they mustn't contend with each other or wait on I/O. Each one takes a
+ * global sequence number, which orders its event exactly as the critical
+ * section it's called from does, and adds the event to a buffer of its own
+ * thread's. A writer thread collects the buffers, sorts what it collected by
+ * sequence number, and writes out the gapless prefix; anything after a gap
+ * waits for the next round, since the missing event is still being appended.
+ */
+struct Recorder
+{
+	std::atomic<bool> isAccepting{false};
+	std::atomic<uint64_t> nextSeq{0};
+	std::atomic<size_t> nInFlightAppends{0};
+	// Bumped by each startRecording(), so threads register anew.
+	std::atomic<uint64_t> generation{0};
+
+	SpinLock registryLock;
+	// Guarded by registryLock.
+	std::vector<std::shared_ptr<AppenderBuffer>> buffers;
+
+	// Only touched by the writer thread, or after it has been joined.
+	std::ofstream out;
+	std::vector<SequencedEvent> pending;
+	uint64_t nextSeqToWrite = 0;
+
+	std::atomic<bool> writerShouldExit{false};
+	std::thread writer;
+
+	void append(const RecordReplay::Event &event);
+	AppenderBuffer &getAppenderBuffer(void);
+
+	void collectAndWrite(void);
+
+	void writerMain(void)
+	{
+		while (!writerShouldExit.load())
+		{
+			std::this_thread::sleep_for(recordWriterInterval);
+			collectAndWrite();
+		}
+	}
+};
+
+struct QutexSchedule
+{
+	// Ids of the acquiring continuations, in order.
+	std::vector<RecordReplay::EventId> acquirers;
+	/* Only advanced by the Qutex's owner, and only read with the Qutex
+	 * unowned and its spinlock held.
+	 */
+	size_t cursor = 0;
+};
+
+struct DestinationSchedule
+{
+	// Ids of the posts to this destination, in queue order.
+	std::vector<RecordReplay::EventId> expected;
+	std::unordered_set<RecordReplay::EventId> isExpected;
+
+	// Both guarded by the destination's postLock.
+	size_t cursor = 0;
+	// Early posts, waiting for their turn.
+	std::unordered_map<RecordReplay::EventId, std::function<void()>> held;
+};
+
+struct Replayer
+{
+	DestinationSchedule destinations[256];
+	// Keyed by Qutex creation ordinal. Not modified after loading.
+	std::unordered_map<uint32_t, QutexSchedule> qutexSchedules;
+
+	int64_t divergenceTimeoutNs;
+	std::atomic<int64_t> lastProgressNs;
+	size_t nEnforcedEvents;
+	std::atomic<size_t> nEnforcedEventsConsumed;
+	std::atomic<bool> diverged;
+
+	std::atomic<bool> monitorShouldExit;
+	std::thread monitor;
+
+	Replayer()
+	:	divergenceTimeoutNs(0), lastProgressNs(0), nEnforcedEvents(0),
+	nEnforcedEventsConsumed(0), diverged(false), monitorShouldExit(false)
+	{}
+
+	void noteProgress(void)
+	{
+		nEnforcedEventsConsumed.fetch_add(1, std::memory_order_relaxed);
+		lastProgressNs.store(nowNs(), std::memory_order_relaxed);
+	}
+
+	bool isStalled(void) const
+	{
+		return nEnforcedEventsConsumed.load(std::memory_order_relaxed)
+				< nEnforcedEvents
+			&& nowNs() - lastProgressNs.load(std::memory_order_relaxed)
+				> divergenceTimeoutNs;
+	}
+
+	void reportDivergence(const std::string &what);
+	void releaseAllHeldPosts(void);
+
+	/* Enqueue the held posts that are now due. Called with the
+	 * destination's postLock held.
+	 */
+	void releaseDuePosts(DestinationSchedule &dest)
+	{
+		while (dest.cursor < dest.expected.size())
+		{
+			auto it = dest.held.find(dest.expected[dest.cursor]);
+			if (it == dest.held.end()) { return; }
+
+			std::function<void()> enqueueFn = std::move(it->second);
+			dest.held.erase(it);
+			enqueueFn();
+			dest.cursor++;
+			noteProgress();
+		}
+	}
+
+	void monitorMain(void)
+	{
+		/**	EXPLANATION:
+		 * A Qutex acquirer that's held back goes to sleep until the Qutex is
+		 * released, so if the recorded acquirer never turns up, nothing
+		 * would ever notice. This catches that case, and any other stall.
+		 */
+		while (!monitorShouldExit.load() && !diverged.load())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			if (isStalled()) {
+				reportDivergence("no recorded event happened within the "
+					"divergence timeout");
+			}
+		}
+	}
+};
+
+/**	EXPLANATION:
+ * The handler that's running on this thread, and how many posts and
+ * continuations it has created so far. Outside of any handler, each thread
+ * has a root context of its own.
+ */
+struct HandlerContext
+{
+	RecordReplay::EventId id = 0;
+	uint64_t nChildren = 0;
+	bool isInitialized = false;
+};
+
+thread_local HandlerContext currentContext;
+
+uint64_t splitMix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+HandlerContext &getCurrentContext(void)
+{
+	HandlerContext &ctx = currentContext;
+	if (ctx.isInitialized) { return ctx; }
+
+	ComponentThread *self = ComponentThread::getSelfPtr();
+	// Non-ComponentThreads all share one seed, distinct from any ThreadId.
+	const uint64_t rootSeed = (self != nullptr) ? self->id : 0x100u;
+
+	ctx.id = splitMix64(rootSeed);
+	ctx.isInitialized = true;
+	return ctx;
+}
+
+/* Held while a post is enqueued and logged (or held back), so that the
+ * log's order matches the destination queue's.
+ */
+SpinLock postLocks[256];
+
+Recorder recorder;
+
+struct AppenderContext
+{
+	std::shared_ptr<AppenderBuffer> buffer;
+	uint64_t generation = 0;
+};
+
+thread_local AppenderContext currentAppender;
+
+AppenderBuffer &Recorder::getAppenderBuffer(void)
+{
+	AppenderContext &ctx = currentAppender;
+	const uint64_t currGeneration = generation.load(std::memory_order_acquire);
+	if (ctx.buffer != nullptr && ctx.generation == currGeneration)
+		{ return *ctx.buffer; }
+
+	/* Shared with the registry so that the buffer, and the events in it,
+	 * outlive this thread if it exits before the writer collects them.
+	 */
+	ctx.buffer = std::make_shared<AppenderBuffer>();
+	ctx.generation = currGeneration;
+
+	registryLock.acquire();
+	buffers.push_back(ctx.buffer);
+	registryLock.release();
+
+	return *ctx.buffer;
+}
+
+void Recorder::append(const RecordReplay::Event &event)
+{
+	/* stopRecording() clears isAccepting and then waits for
+	 * nInFlightAppends to drop to 0, after which every sequence number
+	 * taken is in some buffer.
+	 */
+	nInFlightAppends.fetch_add(1);
+	if (!isAccepting.load())
+	{
+		nInFlightAppends.fetch_sub(1);
+		return;
+	}
+
+	AppenderBuffer &buffer = getAppenderBuffer();
+
+	buffer.lock.acquire();
+	buffer.events.push_back(SequencedEvent{nextSeq.fetch_add(1), event});
+	buffer.lock.release();
+
+	nInFlightAppends.fetch_sub(1);
+}
+
+void Recorder::collectAndWrite(void)
+{
+	registryLock.acquire();
+	std::vector<std::shared_ptr<AppenderBuffer>> currBuffers = buffers;
+	registryLock.release();
+
+	std::vector<SequencedEvent> collected;
+	for (auto &buffer : currBuffers)
+	{
+		collected.clear();
+
+		buffer->lock.acquire();
+		collected.swap(buffer->events);
+		buffer->lock.release();
+
+		pending.insert(pending.end(), collected.begin(), collected.end());
+	}
+
+	std::sort(
+		pending.begin(), pending.end(),
+		[](const SequencedEvent &a, const SequencedEvent &b)
+			{ return a.seq < b.seq; });
+
+	size_t nWritable = 0;
+	while (nWritable < pending.size()
+		&& pending[nWritable].seq == nextSeqToWrite)
+	{
+		out.write(
+			reinterpret_cast<const char *>(&pending[nWritable].event),
+			sizeof(RecordReplay::Event));
+		nWritable++;
+		nextSeqToWrite++;
+	}
+
+	pending.erase(pending.begin(), pending.begin() + nWritable);
+}
+
+/* Never freed once replay starts: a thread that read the mode just before
+ * replay stopped may still be looking at the schedule.
+ */
+Replayer *replayer = nullptr;
+
+void Replayer::reportDivergence(const std::string &what)
+{
+	if (diverged.exchange(true)) { return; }
+
+	std::cerr << "RecordReplay: replay diverged after "
+		<< nEnforcedEventsConsumed.load() << " of " << nEnforcedEvents
+		<< " enforced events: " << what
+		<< ". No longer enforcing the recorded order." << std::endl;
+
+	releaseAllHeldPosts();
+}
+
+void Replayer::releaseAllHeldPosts(void)
+{
+	// Let everything that was held back through, in the recorded order.
+	for (size_t i = 0; i < 256; i++)
+	{
+		DestinationSchedule &dest = destinations[i];
+
+		postLocks[i].acquire();
+		for (; dest.cursor < dest.expected.size(); dest.cursor++)
+		{
+			auto it = dest.held.find(dest.expected[dest.cursor]);
+			if (it == dest.held.end()) { continue; }
+
+			it->second();
+			dest.held.erase(it);
+		}
+		postLocks[i].release();
+	}
+}
+
+} // anonymous namespace
+
+void RecordReplay::startRecording(const std::string &logPath)
+{
+	if (getMode() != Mode::OFF)
+	{
+		throw std::runtime_error(std::string(__func__)
+			+ ": Already recording or replaying");
+	}
+
+	recorder.out.open(logPath, std::ios::binary | std::ios::trunc);
+	if (!recorder.out)
+	{
+		throw std::runtime_error(std::string(__func__)
+			+ ": Can't open " + logPath + " for writing");
+	}
+
+	LogHeader header;
+	std::memcpy(header.magic, logMagic, sizeof(header.magic));
+	header.version = logVersion;
+	header.eventSize = sizeof(Event);
+	recorder.out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+	recorder.nextSeq.store(0);
+	recorder.nextSeqToWrite = 0;
+	recorder.pending.clear();
+	recorder.registryLock.acquire();
+	recorder.buffers.clear();
+	recorder.registryLock.release();
+	recorder.generation.fetch_add(1);
+
+	recorder.writerShouldExit.store(false);
+	recorder.writer = std::thread(&Recorder::writerMain, &recorder);
+	recorder.isAccepting.store(true);
+
+	mode.store(Mode::RECORD, std::memory_order_release);
+}
+
+void RecordReplay::stopRecording(void)
+{
+	if (getMode() != Mode::RECORD) { return; }
+
+	mode.store(Mode::OFF, std::memory_order_release);
+
+	// Let the appenders that got in before the mode changed finish.
+	recorder.isAccepting.store(false);
+	while (recorder.nInFlightAppends.load() != 0)
+		{ std::this_thread::yield(); }
+
+	recorder.writerShouldExit.store(true);
+	recorder.writer.join();
+	recorder.collectAndWrite();
+	recorder.out.close();
+}
+
+void RecordReplay::startReplay(
+	const std::string &logPath, std::chrono::milliseconds divergenceTimeout)
+{
+	if (getMode() != Mode::OFF)
+	{
+		throw std::runtime_error(std::string(__func__)
+			+ ": Already recording or replaying");
+	}
+
+	std::ifstream in(logPath, std::ios::binary);
+	LogHeader header;
+	if (!in || !in.read(reinterpret_cast<char *>(&header), sizeof(header))
+		|| std::memcmp(header.magic, logMagic, sizeof(header.magic)) != 0
+		|| header.version != logVersion || header.eventSize != sizeof(Event))
+	{
+		throw std::runtime_error(std::string(__func__)
+			+ ": " + logPath + " isn't a RecordReplay log of this version");
+	}
+
+	auto r = std::make_unique<Replayer>();
+	r->divergenceTimeoutNs = std::chrono::duration_cast<
+		std::chrono::nanoseconds>(divergenceTimeout).count();
+
+	Event event;
+	while (in.read(reinterpret_cast<char *>(&event), sizeof(event)))
+	{
+		switch (event.type)
+		{
+		case EventType::POST:
+			r->destinations[event.thread].expected.push_back(event.id);
+			r->destinations[event.thread].isExpected.insert(event.id);
+			r->nEnforcedEvents++;
+			break;
+
+		case EventType::QUTEX_ACQUIRE:
+			r->qutexSchedules[event.qutexOrdinal].acquirers.push_back(
+				event.id);
+			r->nEnforcedEvents++;
+			break;
+
+		case EventType::EXEC:
+			// Implied by the POST order; kept in the log for offline tools.
+			break;
+
+		default:
+			throw std::runtime_error(std::string(__func__)
+				+ ": " + logPath + " contains an unknown event type");
+		}
+	}
+
+	r->lastProgressNs.store(nowNs());
+	r->monitor = std::thread(&Replayer::monitorMain, r.get());
+	replayer = r.release();
+
+	mode.store(Mode::REPLAY, std::memory_order_release);
+}
+
+void RecordReplay::stopReplay(void)
+{
+	if (getMode() != Mode::REPLAY) { return; }
+
+	mode.store(Mode::OFF, std::memory_order_release);
+
+	replayer->monitorShouldExit.store(true);
+	replayer->monitor.join();
+	replayer->releaseAllHeldPosts();
+}
+
+bool RecordReplay::hasDiverged(void)
+{
+	return replayer != nullptr && replayer->diverged.load();
+}
+
+RecordReplay::EventId RecordReplay::allocateChildId(void)
+{
+	HandlerContext &ctx = getCurrentContext();
+	return splitMix64(ctx.id ^ splitMix64(ctx.nChildren++));
+}
+
+void RecordReplay::HandlerScope::begin(
+	ComponentThread &thread, EventId id, bool isOrdered)
+{
+	HandlerContext &ctx = getCurrentContext();
+
+	savedId = ctx.id;
+	savedNChildren = ctx.nChildren;
+	ctx.id = id;
+	ctx.nChildren = 0;
+
+	if (isOrdered && getMode() == Mode::RECORD)
+		{ recorder.append(Event{id, 0, EventType::EXEC, thread.id, 0, 0}); }
+}
+
+void RecordReplay::HandlerScope::end(void)
+{
+	currentContext.id = savedId;
+	currentContext.nChildren = savedNChildren;
+}
+
+void RecordReplay::PostScope::begin(void)
+{
+	postId = allocateChildId();
+	postLocks[destination.id].acquire();
+
+	if (getMode() != Mode::REPLAY || replayer->diverged.load()) { return; }
+
+	/**	EXPLANATION:
+	 * Posts that were never recorded for this destination, and posts made
+	 * after its recording has run out, go straight through.
+	 */
+	DestinationSchedule &dest = replayer->destinations[destination.id];
+	if (dest.cursor >= dest.expected.size()
+		|| !dest.isExpected.count(postId))
+		{ return; }
+
+	if (dest.expected[dest.cursor] == postId) {
+		isInTurn = true;
+	}
+	else {
+		isEarly = true;
+	}
+}
+
+void RecordReplay::PostScope::defer(std::function<void()> enqueueFn)
+{
+	replayer->destinations[destination.id].held.emplace(
+		postId, std::move(enqueueFn));
+}
+
+void RecordReplay::PostScope::end(void)
+{
+	if (getMode() == Mode::RECORD)
+	{
+		ComponentThread *self = ComponentThread::getSelfPtr();
+		recorder.append(Event{
+			postId, 0, EventType::POST, destination.id,
+			self != nullptr ? self->id : externalThreadId, 0});
+	}
+
+	if (isInTurn)
+	{
+		DestinationSchedule &dest = replayer->destinations[destination.id];
+		dest.cursor++;
+		replayer->noteProgress();
+		replayer->releaseDuePosts(dest);
+	}
+
+	postLocks[destination.id].release();
+}
+
+RecordReplay::QutexVerdict RecordReplay::replayCheckQutexAcquirer(
+	const Qutex &qutex, EventId acquirer, EventId &expectedAcquirer)
+{
+	Replayer &r = *replayer;
+	if (r.diverged.load(std::memory_order_relaxed))
+		{ return QutexVerdict::UNCONSTRAINED; }
+
+	auto it = r.qutexSchedules.find(qutex.getRecordReplayOrdinal());
+	if (it == r.qutexSchedules.end()) { return QutexVerdict::UNCONSTRAINED; }
+
+	const QutexSchedule &schedule = it->second;
+	if (schedule.cursor >= schedule.acquirers.size())
+		{ return QutexVerdict::UNCONSTRAINED; }
+
+	expectedAcquirer = schedule.acquirers[schedule.cursor];
+	return (expectedAcquirer == acquirer)
+		? QutexVerdict::ADMIT : QutexVerdict::REFUSE;
+}
+
+void RecordReplay::noteLockSetAcquired(const Qutex &qutex, EventId acquirer)
+{
+	if (getMode() == Mode::RECORD)
+	{
+		ComponentThread *self = ComponentThread::getSelfPtr();
+		recorder.append(Event{
+			acquirer, qutex.getRecordReplayOrdinal(),
+			EventType::QUTEX_ACQUIRE,
+			self != nullptr ? self->id : externalThreadId, 0, 0});
+		return;
+	}
+
+	Replayer &r = *replayer;
+	auto it = r.qutexSchedules.find(qutex.getRecordReplayOrdinal());
+	if (it == r.qutexSchedules.end()) { return; }
+
+	QutexSchedule &schedule = it->second;
+	if (schedule.cursor >= schedule.acquirers.size()
+		|| schedule.acquirers[schedule.cursor] != acquirer)
+		{ return; }
+
+	schedule.cursor++;
+	r.noteProgress();
+}
+
+} // namespace sscl
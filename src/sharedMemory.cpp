@@ -0,0 +1,207 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <spinscale/sharedMemory.h>
+
+namespace sscl {
+
+namespace {
+
+std::string errnoString(int err)
+	{ return std::string(std::strerror(err)); }
+
+std::atomic<pid_t> cachedPid(0);
+
+void resetCachedPidInChild(void)
+	{ cachedPid.store(0, std::memory_order_relaxed); }
+
+} // anonymous namespace
+
+SharedMemorySegment SharedMemorySegment::create(
+	const std::string &name, size_t size)
+{
+	if (size == 0)
+	{
+		throw std::invalid_argument(std::string(__func__)
+			+ ": Segment size must be > 0");
+	}
+
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+	{
+		throw std::runtime_error(std::string(__func__)
+			+ ": shm_open(" + name + ") failed: " + errnoString(errno));
+	}
+
+	if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+	{
+		int err = errno;
+		close(fd);
+		shm_unlink(name.c_str());
+		throw std::runtime_error(std::string(__func__)
+			+ ": ftruncate(" + name + ") failed: " + errnoString(err));
+	}
+
+	void *base = mmap(
+		nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int err = errno;
+	close(fd);
+
+	if (base == MAP_FAILED)
+	{
+		shm_unlink(name.c_str());
+		throw std::runtime_error(std::string(__func__)
+			+ ": mmap(" + name + ") failed: " + errnoString(err));
+	}
+
+	return SharedMemorySegment(name, base, size, true);
+}
+
+SharedMemorySegment SharedMemorySegment::open(const std::string &name)
+{
+	int fd = shm_open(name.c_str(), O_RDWR, 0);
+	if (fd < 0)
+	{
+		throw std::runtime_error(std::string(__func__)
+			+ ": shm_open(" + name + ") failed: " + errnoString(errno));
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0)
+	{
+		int err = errno;
+		close(fd);
+		throw std::runtime_error(std::string(__func__)
+			+ ": Segment " + name + " is empty or can't be sized: "
+			+ errnoString(err));
+	}
+
+	const size_t size = static_cast<size_t>(st.st_size);
+	void *base = mmap(
+		nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int err = errno;
+	close(fd);
+
+	if (base == MAP_FAILED)
+	{
+		throw std::runtime_error(std::string(__func__)
+			+ ": mmap(" + name + ") failed: " + errnoString(err));
+	}
+
+	return SharedMemorySegment(name, base, size, false);
+}
+
+SharedMemorySegment::SharedMemorySegment(
+	std::string name, void *base, size_t length, bool isCreator)
+:	name(std::move(name)), base(base), length(length), isCreator(isCreator)
+{
+}
+
+SharedMemorySegment::SharedMemorySegment(SharedMemorySegment &&other) noexcept
+:	name(std::move(other.name)), base(other.base), length(other.length),
+isCreator(other.isCreator)
+{
+	other.base = nullptr;
+	other.length = 0;
+	other.isCreator = false;
+}
+
+SharedMemorySegment &SharedMemorySegment::operator=(
+	SharedMemorySegment &&other) noexcept
+{
+	if (this == &other) { return *this; }
+
+	unmap();
+	name = std::move(other.name);
+	base = other.base;
+	length = other.length;
+	isCreator = other.isCreator;
+	other.base = nullptr;
+	other.length = 0;
+	other.isCreator = false;
+	return *this;
+}
+
+SharedMemorySegment::~SharedMemorySegment()
+{
+	unmap();
+}
+
+void SharedMemorySegment::unmap(void) noexcept
+{
+	if (base == nullptr) { return; }
+
+	munmap(base, length);
+	if (isCreator) { shm_unlink(name.c_str()); }
+	base = nullptr;
+}
+
+void SharedMemorySegment::checkFits(
+	size_t objectSize, size_t objectAlign) const
+{
+	/* mmap() returns page-aligned memory, so only absurd alignments can
+	 * fail here, but check anyway since a misaligned atomic in shared memory
+	 * fails silently.
+	 */
+	if (base == nullptr || objectSize > length
+		|| reinterpret_cast<uintptr_t>(base) % objectAlign != 0)
+	{
+		throw std::runtime_error(std::string(__func__)
+			+ ": Object doesn't fit in segment " + name);
+	}
+}
+
+bool futexWait(
+	std::atomic<uint32_t> &word, uint32_t expected,
+	std::chrono::nanoseconds timeout)
+{
+	struct timespec ts;
+	struct timespec *tsp = nullptr;
+
+	if (timeout.count() > 0)
+	{
+		ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+		ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+		tsp = &ts;
+	}
+
+	long ret = syscall(
+		SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT,
+		expected, tsp, nullptr, 0);
+
+	// EAGAIN (value already changed) and EINTR count as wakeups.
+	return !(ret != 0 && errno == ETIMEDOUT);
+}
+
+void futexWake(std::atomic<uint32_t> &word, int nWaiters)
+{
+	syscall(
+		SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE,
+		nWaiters, nullptr, nullptr, 0);
+}
+
+pid_t getCachedPid(void)
+{
+	static const int atforkRegistered = pthread_atfork(
+		nullptr, nullptr, &resetCachedPidInChild);
+	(void)atforkRegistered;
+
+	pid_t pid = cachedPid.load(std::memory_order_relaxed);
+	if (pid == 0)
+	{
+		pid = getpid();
+		cachedPid.store(pid, std::memory_order_relaxed);
+	}
+
+	return pid;
+}
+
+} // namespace sscl
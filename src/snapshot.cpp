@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <spinscale/callableTracer.h>
+#include <spinscale/callbackDelivery.h>
+#include <spinscale/snapshot.h>
+
+namespace sscl {
+
+SnapshotRegion::SnapshotRegion(
+	SnapshotCoordinator &coordinator, std::string name)
+:	coordinator(coordinator), name(std::move(name))
+{
+	coordinator.registerRegion(*this);
+}
+
+SnapshotRegion::~SnapshotRegion()
+{
+	coordinator.unregisterRegion(*this);
+}
+
+void SnapshotCoordinator::registerRegion(SnapshotRegion &region)
+{
+	regionsLock.acquire();
+	regions.push_back(&region);
+	regionsLock.release();
+}
+
+void SnapshotCoordinator::unregisterRegion(SnapshotRegion &region)
+{
+	regionsLock.acquire();
+	regions.erase(
+		std::remove(regions.begin(), regions.end(), &region),
+		regions.end());
+	regionsLock.release();
+}
+
+class SnapshotCoordinator::TakeSnapshotOp
+:	public std::enable_shared_from_this<TakeSnapshotOp>
+{
+public:
+	TakeSnapshotOp(
+		SnapshotCoordinator &coordinator,
+		std::shared_ptr<ComponentThread> serializerThread,
+		std::vector<SnapshotRegion *> regions, uint64_t epoch,
+		Callback<takeSnapshotCbFn> callback)
+	:	coordinator(coordinator),
+	serializerThread(std::move(serializerThread)),
+	caller(ComponentThread::getSelf()),
+	regions(std::move(regions)), nextRegion(0),
+	snapshot(std::make_shared<Snapshot>()),
+	callback(std::move(callback))
+	{
+		snapshot->epoch = epoch;
+		snapshot->entries.reserve(this->regions.size());
+	}
+
+	void takeSnapshotReq1_posted(void)
+	{
+		// One region per handler, so the serializer thread stays responsive.
+		if (nextRegion < regions.size())
+		{
+			SnapshotRegion &region = *regions[nextRegion++];
+
+			snapshot->entries.push_back(Snapshot::Entry{region.getName(), {}});
+			region.serializeForEpoch(
+				snapshot->epoch, snapshot->entries.back().bytes);
+
+			serializerThread->post(
+				STC(std::bind(
+					&TakeSnapshotOp::takeSnapshotReq1_posted,
+					shared_from_this())),
+				callback.callerContinuation.get());
+			return;
+		}
+
+		coordinator.regionsLock.acquire();
+		coordinator.snapshotIsInProgress = false;
+		coordinator.regionsLock.release();
+		coordinator.nSnapshots.fetch_add(1, std::memory_order_relaxed);
+
+		deliverCallback(caller, callback, snapshot);
+	}
+
+private:
+	SnapshotCoordinator &coordinator;
+	std::shared_ptr<ComponentThread> serializerThread, caller;
+	std::vector<SnapshotRegion *> regions;
+	size_t nextRegion;
+	std::shared_ptr<Snapshot> snapshot;
+	Callback<takeSnapshotCbFn> callback;
+};
+
+void SnapshotCoordinator::takeSnapshotReq(
+	const std::shared_ptr<ComponentThread> &serializerThread,
+	Callback<takeSnapshotCbFn> callback
+	)
+{
+	regionsLock.acquire();
+
+	if (snapshotIsInProgress)
+	{
+		regionsLock.release();
+		throw std::runtime_error(std::string(__func__)
+			+ ": A snapshot is already in progress");
+	}
+
+	snapshotIsInProgress = true;
+	std::vector<SnapshotRegion *> snapshotRegions = regions;
+
+	/**	EXPLANATION:
+	 * This is the cut. Every write that reads the new epoch preserves the
+	 * version it's about to overwrite until we've serialized it.
+	 */
+	const uint64_t snapshotEpoch =
+		epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+	regionsLock.release();
+
+	AsynchronousContinuationChainLink *callerContinuation =
+		callback.callerContinuation.get();
+	auto request = std::make_shared<TakeSnapshotOp>(
+		*this, serializerThread, std::move(snapshotRegions), snapshotEpoch,
+		std::move(callback));
+
+	serializerThread->post(
+		STC(std::bind(
+			&TakeSnapshotOp::takeSnapshotReq1_posted, request)),
+		callerContinuation);
+}
+
+} // namespace sscl